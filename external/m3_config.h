@@ -57,6 +57,10 @@
 //# define d_m3FixedHeap                        (32*1024)
 # endif
 
+# ifndef d_m3ExternalAllocator                         // m3_Malloc_Impl, m3_Realloc_Impl and m3_Free_Impl are provided by the embedder
+#   define d_m3ExternalAllocator                false
+# endif
+
 # ifndef d_m3FixedHeapAlign
 #   define d_m3FixedHeapAlign                   16
 # endif
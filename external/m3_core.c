@@ -122,6 +122,10 @@ void *  m3_Realloc_Impl  (void * i_ptr, size_t i_newSize, size_t i_oldSize)
     return newPtr;
 }
 
+#elif d_m3ExternalAllocator
+
+// implemented by the embedder
+
 #else
 
 void *  m3_Malloc_Impl  (size_t i_size)
@@ -8,7 +8,7 @@ project "visualscript"
 		"external/**.h",
 		"genie.lua"
 	}
-	defines { "BUILDING_VISUALSCRIPT" }
+	defines { "BUILDING_VISUALSCRIPT", "d_m3ExternalAllocator=1" }
 	links { "engine", "core" }
 	if build_studio then
 		links { "editor" }
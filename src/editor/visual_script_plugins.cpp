@@ -1,11 +1,14 @@
 #include "core/allocator.h"
 #include "core/crt.h"
+#include "core/hash_map.h"
 #include "core/log.h"
 #include "core/math.h"
 #include "core/os.h"
 #include "core/profiler.h"
+#include "core/sort.h"
 #include "core/stream.h"
 #include "core/stack_array.h"
+#include "core/sync.h"
 #include "editor/asset_browser.h"
 #include "editor/asset_compiler.h"
 #include "editor/editor_asset.h"
@@ -19,7 +22,6 @@
 #include "engine/reflection.h"
 #include "engine/world.h"
 #include "../script.h"
-#include "../m3_lumix.h"
 
 #include "imgui/imgui.h"
 
@@ -29,8 +31,18 @@ using namespace Lumix;
 namespace {
 
 static const u32 OUTPUT_FLAG = NodeEditor::OUTPUT_FLAG;
+// input of an entry node which generates an export dispatching to several nodes, never linked, see TimerNode
+static const u32 DISPATCH_INPUT = 0x7fff;
 static const ComponentType SCRIPT_TYPE = reflection::getComponentType("script");
 
+// unlike reflection::getComponentType, does not register unknown names, so graphs can be loaded on any thread
+static ComponentType findComponentType(const char* name) {
+	for (const reflection::RegisteredComponent& cmp : reflection::getComponents()) {
+		if (equalStrings(cmp.cmp->name, name)) return cmp.cmp->component_type;
+	}
+	return INVALID_COMPONENT_TYPE;
+}
+
 struct Variable {
 	Variable(IAllocator& allocator) : name(allocator) {}
 	String name;
@@ -43,16 +55,27 @@ enum class WASMLumixAPI : u32 {
 	SET_YAW,
 	SET_PROPERTY_FLOAT,
 	GET_PROPERTY_FLOAT,
+	GET_POSITION,
+	SET_POSITION,
+	GET_ROTATION,
+	SET_ROTATION,
+	YAW_TO_DIR,
+	SET_PROPERTY_I32,
+	GET_PROPERTY_I32,
+	SET_PROPERTY_VEC3,
+	GET_PROPERTY_VEC3,
+	SET_PROPERTY_VEC4,
+	GET_PROPERTY_VEC4,
+	CALL_FUNCTION,
+	QUERY_RADIUS,
+	ADD_PROPERTY_FLOAT,
+	ADD_POSITION,
+	SCHEDULE_TIMER,
+	SET_RESUMABLE,
 
 	COUNT
 };
 
-enum class WASMGlobals : u32 {
-	SELF,
-
-	USER
-};
-
 enum class WASMSection : u8 {
 	TYPE = 1,
 	IMPORT = 2,
@@ -85,24 +108,36 @@ enum class WASMType : u8 {
 };
 
 enum class WasmOp : u8 {
+	BLOCK = 0x02,
+	LOOP = 0x03,
 	IF = 0x04,
 	ELSE = 0x05,
 	END = 0x0B,
+	BR = 0x0C,
+	BR_IF = 0x0D,
 	CALL = 0x10,
 	LOCAL_GET = 0x20,
+	LOCAL_SET = 0x21,
+	LOCAL_TEE = 0x22,
 	GLOBAL_GET = 0x23,
 	GLOBAL_SET = 0x24,
+	I32_LOAD = 0x28,
+	F32_LOAD = 0x2A,
+	I32_STORE = 0x36,
+	F32_STORE = 0x38,
 	I32_CONST = 0x41,
 	I64_CONST = 0x42,
 	F32_CONST = 0x43,
 	F64_CONST = 0x44,
 
+	I32_EQZ = 0x45,
 	I32_EQ = 0x46,
 	I32_NEQ = 0x47,
 	I32_LT_S = 0x48,
 	I32_GT_S = 0x4A,
 	I32_LE_S = 0x4C,
 	I32_GE_S = 0x4E,
+	I32_GE_U = 0x4F,
 
 	F32_EQ = 0x5B,
 	F32_NEQ = 0x5C,
@@ -113,8 +148,67 @@ enum class WasmOp : u8 {
 
 	I32_ADD = 0x6A,
 	I32_MUL = 0x6C,
+	I32_OR = 0x72,
+	F32_SQRT = 0x91,
 	F32_ADD = 0x92,
+	F32_SUB = 0x93,
 	F32_MUL = 0x94,
+	F32_DIV = 0x95,
+	I32_TRUNC_F32_S = 0xA8,
+	F32_CONVERT_I32_S = 0xB2,
+};
+
+// number of wasm values a value of `type` is made of, vectors are passed around as their f32 components
+static u32 getComponentCount(ScriptValueType type) {
+	switch (type) {
+		case ScriptValueType::VEC3: return 3;
+		case ScriptValueType::QUAT:
+		case ScriptValueType::VEC4: return 4;
+		default: return 1;
+	}
+}
+
+static WASMType getComponentType(ScriptValueType type) {
+	switch (type) {
+		case ScriptValueType::FLOAT:
+		case ScriptValueType::VEC3:
+		case ScriptValueType::QUAT:
+		case ScriptValueType::VEC4: return WASMType::F32;
+		default: return WASMType::I32;
+	}
+}
+
+// value of a data output known at compile time
+struct ConstValue {
+	ScriptValueType type;
+	union {
+		i32 i;
+		float f;
+	};
+};
+
+// state a value is computed from, one bit per variable or property, the last bit is shared by all the rest
+struct Reads {
+	static u64 bit(u32 idx) { return u64(1) << minimum(idx, 63u); }
+	bool intersects(const Reads& rhs) const {
+		return (variables & rhs.variables) || (properties & rhs.properties) || (transforms && rhs.transforms);
+	}
+	static Reads all() {
+		Reads res;
+		res.variables = res.properties = ~u64(0);
+		res.transforms = true;
+		return res;
+	}
+	void add(const Reads& rhs) {
+		variables |= rhs.variables;
+		properties |= rhs.properties;
+		transforms = transforms || rhs.transforms;
+	}
+	
+	u64 variables = 0;
+	u64 properties = 0;
+	// position or rotation of any entity
+	bool transforms = false;
 };
 
 struct Node : NodeEditorNode {
@@ -143,7 +237,25 @@ struct Node : NodeEditorNode {
 		LTE,
 		KEY_INPUT,
 		GET_PROPERTY,
-		SWITCH
+		SWITCH,
+		SPLIT_VEC3,
+		DOT,
+		CROSS,
+		NORMALIZE,
+		LERP,
+		ROTATE,
+		GET_POSITION,
+		SET_POSITION,
+		GET_ROTATION,
+		SET_ROTATION,
+		FOR_EACH_IN_RADIUS,
+		FOR,
+		WHILE,
+		DELAY,
+		EVERY,
+		WAIT_UNTIL,
+		MOVE_TO,
+		MOUSE_BUTTON
 	};
 
 	bool nodeGUI() override {
@@ -151,14 +263,23 @@ struct Node : NodeEditorNode {
 		m_output_pin_counter = 0;
 		ImGuiEx::BeginNode(m_id, m_pos, &m_selected);
 		bool res = onGUI();
+		const bool has_heat = m_heat >= 0 && m_error.length() == 0;
 		if (m_error.length() > 0) {
 			ImGui::PushStyleColor(ImGuiCol_Border, IM_COL32(0xff, 0, 0, 0xff));
 		}
+		else if (has_heat) {
+			// yellow to orange, the hotter the node is
+			ImGui::PushStyleColor(ImGuiCol_Border, IM_COL32(0xff, u8(0xff - m_heat * 0x9f), 0, 0xff));
+		}
 		ImGuiEx::EndNode();
 		if (m_error.length() > 0) {
 			ImGui::PopStyleColor();
 			if (ImGui::IsItemHovered()) ImGui::SetTooltip("%s", m_error.c_str());
 		}
+		else if (has_heat) {
+			ImGui::PopStyleColor();
+			if (ImGui::IsItemHovered()) ImGui::SetTooltip("Executed %u times", m_execution_count);
+		}
 		return res;
 	}
 	
@@ -173,7 +294,7 @@ struct Node : NodeEditorNode {
 	void generateNext(OutputMemoryStream& blob, const Graph& graph) {
 		NodeInput n = getOutputNode(0, graph);
 		if (!n.node) return;
-		n.node->generate(blob, graph, n.input_idx);
+		n.generate(blob, graph);
 	}
 
 	void clearError() { m_error = ""; }
@@ -184,28 +305,37 @@ struct Node : NodeEditorNode {
 	virtual void serialize(OutputMemoryStream& blob) const {}
 	virtual void deserialize(InputMemoryStream& blob) {}
 	virtual ScriptValueType getOutputType(u32 idx, const Graph& graph) { return ScriptValueType::I32; }
+	// returns true if output's value is known at compile time, such outputs are emitted as constants
+	virtual bool evalConst(u32 output_idx, const Graph& graph, ConstValue& value) { return false; }
+	// by default an output reads whatever its inputs read
+	virtual void getReads(u32 output_idx, const Graph& graph, Reads& reads);
+	// how many times is the input's value used by generated code
+	virtual u32 getInputUses(u32 input_idx, const Graph& graph) { return 1; }
+
+	struct NodeOutput {
+		Node* node;
+		u32 output_idx;
+		operator bool() const { return node; }
+		void generate(OutputMemoryStream& blob, const Graph& graph);
+	};
+
+	NodeOutput getInputNode(u32 idx, const Graph& graph);
 
 	bool m_selected = false;
+	// execution count relative to the hottest node of the graph, negative if not profiled
+	float m_heat = -1;
+	u32 m_execution_count = 0;
 protected:
 	struct NodeInput {
 		Node* node;
 		u32 input_idx;
-		void generate(OutputMemoryStream& blob, const Graph& graph) { node->generate(blob, graph, input_idx); }
+		void generate(OutputMemoryStream& blob, const Graph& graph);
 	};
 
 	NodeInput getOutputNode(u32 idx, const Graph& graph);
 	Node(IAllocator& allocator) : m_error(allocator) {}
 
-	struct NodeOutput {
-		Node* node;
-		u32 output_idx;
-		operator bool() const { return node; }
-		void generate(OutputMemoryStream& blob, const Graph& graph) {
-			node->generate(blob, graph, output_idx);
-		}
-	};
-
-	NodeOutput getInputNode(u32 idx, const Graph& graph);
+	bool evalInputConst(u32 idx, const Graph& graph, ConstValue& value);
 
 	void inputPin() {
 		ImGuiEx::Pin(m_id | (m_input_pin_counter << 16), true);
@@ -233,8 +363,8 @@ protected:
 	String m_error;
 };
 
-// TODO check if negative numbers are correctly handled
-static void writeLEB128(OutputMemoryStream& blob, u64 val) {
+// signed, unsigned values are written the same way as long as they fit in i64
+static void writeLEB128(OutputMemoryStream& blob, i64 val) {
   bool end;
   do {
 	u8 byte = val & 0x7f;
@@ -246,36 +376,82 @@ static void writeLEB128(OutputMemoryStream& blob, u64 val) {
   } while (!end);
 }
 
+struct WASMWriter;
+static void generateFunction(OutputMemoryStream& blob, const Graph& graph, WASMWriter& writer, u32 function_idx);
+
+// `indent` tabs, all `args` and a new line
+template <typename... Args>
+static void writeLine(OutputMemoryStream& out, u32 indent, const Args&... args) {
+	for (u32 i = 0; i < indent; ++i) out << "\t";
+	const StaticString<512> line(args...);
+	out << line.data << "\n";
+}
+
 struct WASMWriter {
 	using TypeHandle = u32;
 	using FunctionHandle = u32;
 
 	WASMWriter(IAllocator& allocator)
 		: m_allocator(allocator)
-		, m_exports(allocator)
+		, m_functions(allocator)
 		, m_imports(allocator)
 		, m_globals(allocator)
+		, m_bodies(allocator)
 	{}
 
 	void addFunctionImport(const char* module_name, const char* field_name, WASMType ret_type, Span<const WASMType> args) {
+		if (ret_type == WASMType::VOID) addFunctionImport(module_name, field_name, Span<const WASMType>(), args);
+		else addFunctionImport(module_name, field_name, Span<const WASMType>(&ret_type, 1), args);
+	}
+
+	// multiple results are returned on the operand stack, e.g. components of a vector
+	void addFunctionImport(const char* module_name, const char* field_name, Span<const WASMType> rets, Span<const WASMType> args) {
 		Import& import = m_imports.emplace(m_allocator);
 		import.module_name = module_name;
 		import.field_name = field_name;
 		ASSERT(args.length() <= lengthOf(import.args));
+		ASSERT(rets.length() <= lengthOf(import.rets));
 		if (args.length() > 0) memcpy(import.args, args.begin(), args.length() * sizeof(args[0]));
+		if (rets.length() > 0) memcpy(import.rets, rets.begin(), rets.length() * sizeof(rets[0]));
 		import.num_args = args.length();
-		import.ret_type = ret_type;
+		import.num_rets = rets.length();
 	}
 
-	void addFunctionExport(const char* name, Node* node, Span<const WASMType> args) {
-		Export& e = m_exports.emplace(m_allocator);
+	void addFunctionExport(const char* name, Node* node, Span<const WASMType> args, u32 input_idx = 0) {
+		Function& e = m_functions.emplace(m_allocator);
 		e.node = node;
+		e.input_idx = input_idx;
 		e.name = name;
 		ASSERT(args.length() <= lengthOf(e.args));
 		if (args.length() > 0) memcpy(e.args, args.begin(), args.length() * sizeof(args[0]));
 		e.num_args = args.length();
 	}
+
+	// index of internal function running the flow entering `node` through `input_idx`,
+	// it has the same params as the `caller` function, so the flow can read them
+	u32 getFlowFunction(Node* node, u32 input_idx, u32 caller, u32 instance_local) {
+		WASMType args[lengthOf(Function::args)];
+		const u32 num_args = m_functions[caller].num_args;
+		memcpy(args, m_functions[caller].args, sizeof(args));
+
+		for (const Function& f : m_functions) {
+			if (f.is_exported || f.node != node || f.input_idx != input_idx || f.instance_local != instance_local) continue;
+			if (f.num_args != num_args || memcmp(f.args, args, num_args * sizeof(args[0])) != 0) continue;
+			return m_imports.size() + u32(&f - m_functions.begin());
+		}
+
+		Function& f = m_functions.emplace(m_allocator);
+		f.node = node;
+		f.input_idx = input_idx;
+		f.is_exported = false;
+		f.instance_local = instance_local;
+		f.num_args = num_args;
+		memcpy(f.args, args, sizeof(args));
+		return m_imports.size() + m_functions.size() - 1;
+	}
 	
+	void addMemory(u32 num_pages) { m_memory_pages = num_pages; }
+
 	void addGlobal(WASMType type, const char* export_name) {
 		Global& global = m_globals.emplace(m_allocator);
 		global.type = type;
@@ -283,11 +459,26 @@ struct WASMWriter {
 	}
 
 	void write(OutputMemoryStream& blob, Graph& graph) {
+		// generating code can add flow functions, so it's done before sections listing functions are written
+		OutputMemoryStream code(m_allocator);
+		OutputMemoryStream func_blob(m_allocator);
+		m_stack_slots = 0;
+		m_bodies.clear();
+		for (u32 i = 0; i < (u32)m_functions.size(); ++i) {
+			func_blob.clear();
+			generateFunction(func_blob, graph, *this, i);
+			const u32 slots = estimateStackSlots(func_blob, m_functions[i].num_args);
+			m_stack_slots = slots != U32_MAX && m_stack_slots != U32_MAX ? m_stack_slots + slots : U32_MAX;
+			writeLEB128(code, (u32)func_blob.size());
+			code.write(func_blob.data(), func_blob.size());
+			m_bodies.emplace(m_allocator).write(func_blob.data(), func_blob.size());
+		}
+
 		blob.write(u32(0x6d736100));
 		blob.write(u32(1));
 	
 		writeSection(blob, WASMSection::TYPE, [this](OutputMemoryStream& blob){
-			writeLEB128(blob, m_imports.size() + m_exports.size());
+			writeLEB128(blob, m_imports.size() + m_functions.size());
 
 			for (const Import& import : m_imports) {
 				blob.write(u8(0x60)); // function
@@ -295,16 +486,13 @@ struct WASMWriter {
 				for (u32 i = 0; i < import.num_args; ++i) {
 					blob.write(import.args[i]);
 				}
-				if (import.ret_type == WASMType::VOID) {
-					blob.write(u8(0)); // num results
-				}
-				else {
-					blob.write(u8(1)); // num results
-					blob.write(import.ret_type);
+				blob.write(u8(import.num_rets));
+				for (u32 i = 0; i < import.num_rets; ++i) {
+					blob.write(import.rets[i]);
 				}
 			}
 
-			for (const Export& e : m_exports) {
+			for (const Function& e : m_functions) {
 				blob.write(u8(0x60)); // function
 				blob.write(u8(e.num_args));
 				for (u32 i = 0; i < e.num_args; ++i) {
@@ -326,13 +514,21 @@ struct WASMWriter {
 		});
 
 		writeSection(blob, WASMSection::FUNCTION, [this](OutputMemoryStream& blob){
-			writeLEB128(blob, m_exports.size());
+			writeLEB128(blob, m_functions.size());
 			
-			for (const Export& func : m_exports) {
-				writeLEB128(blob, m_imports.size() + (&func - m_exports.begin()));
+			for (const Function& func : m_functions) {
+				writeLEB128(blob, m_imports.size() + (&func - m_functions.begin()));
 			}
 		});
 
+		if (m_memory_pages > 0) {
+			writeSection(blob, WASMSection::MEMORY, [this](OutputMemoryStream& blob){
+				writeLEB128(blob, 1);
+				blob.write(u8(0)); // no maximum
+				writeLEB128(blob, m_memory_pages);
+			});
+		}
+
 		writeSection(blob, WASMSection::GLOBAL, [this](OutputMemoryStream& blob){
 			writeLEB128(blob, m_globals.size());
 			
@@ -365,12 +561,17 @@ struct WASMWriter {
 		});
 
 		writeSection(blob, WASMSection::EXPORT, [this](OutputMemoryStream& blob){
-			writeLEB128(blob, m_exports.size() + m_globals.size());
+			u32 num_exports = m_globals.size();
+			for (const Function& e : m_functions) {
+				if (e.is_exported) ++num_exports;
+			}
+			writeLEB128(blob, num_exports);
 
-			for (const Export& e : m_exports) {
+			for (const Function& e : m_functions) {
+				if (!e.is_exported) continue;
 				writeString(blob, e.name.c_str());
 				blob.write(WASMExternalType::FUNCTION);
-				writeLEB128(blob, m_imports.size() + (&e - m_exports.begin()));
+				writeLEB128(blob, m_imports.size() + (&e - m_functions.begin()));
 			}
 			for (const Global& g : m_globals) {
 				writeString(blob, g.export_name.c_str());
@@ -379,19 +580,492 @@ struct WASMWriter {
 			}
 		});
 
-		writeSection(blob, WASMSection::CODE, [this, &graph](OutputMemoryStream& blob){
-			writeLEB128(blob, m_exports.size());
-			OutputMemoryStream func_blob(m_allocator);
-			
-			for (const Export& code : m_exports) {
-				func_blob.clear();
-				code.node->generate(func_blob, graph, 0);
-				writeLEB128(blob, (u32)func_blob.size());
-				blob.write(func_blob.data(), func_blob.size());
-			}
+		writeSection(blob, WASMSection::CODE, [this, &code](OutputMemoryStream& blob){
+			writeLEB128(blob, m_functions.size());
+			blob.write(code.data(), code.size());
 		});
 	}
 	
+	// stack size needed by the runtime to call any exported function, 0 if unknown
+	u32 getStackSize() const {
+		if (m_stack_slots == U32_MAX) return 0;
+		// runtime keeps some values (e.g. constants) in separate slots, be generous
+		return (m_stack_slots * 2 + 16) * sizeof(u64);
+	}
+
+	static u32 readLEB128(InputMemoryStream& blob) {
+		u32 res = 0;
+		u32 shift = 0;
+		for (;;) {
+			const u8 byte = blob.read<u8>();
+			res |= u32(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) return res;
+			shift += 7;
+		}
+	}
+
+	// upper bound of slots used by function's arguments, locals and operand stack, U32_MAX if the code contains unknown op
+	u32 estimateStackSlots(const OutputMemoryStream& code, u32 num_args) const {
+		InputMemoryStream blob(code);
+		u32 num_locals = 0;
+		const u32 num_local_groups = readLEB128(blob);
+		for (u32 i = 0; i < num_local_groups; ++i) {
+			num_locals += readLEB128(blob);
+			blob.read<WASMType>();
+		}
+
+		i32 depth = 0;
+		i32 max_depth = 0;
+		u32 num_consts = 0;
+		StackArray<i32, 16> block_depths(m_allocator);
+		while (blob.remaining() > 0) {
+			const WasmOp op = blob.read<WasmOp>();
+			switch (op) {
+				case WasmOp::BLOCK:
+				case WasmOp::LOOP:
+					blob.read<u8>(); // block type
+					block_depths.push(depth);
+					break;
+				case WasmOp::IF:
+					blob.read<u8>(); // block type
+					--depth;
+					block_depths.push(depth);
+					break;
+				case WasmOp::BR:
+					readLEB128(blob);
+					break;
+				case WasmOp::BR_IF:
+					readLEB128(blob);
+					--depth;
+					break;
+				case WasmOp::ELSE:
+					depth = block_depths.last();
+					break;
+				case WasmOp::END:
+					if (!block_depths.empty()) block_depths.pop();
+					break;
+				case WasmOp::CALL: {
+					const u32 fn_idx = readLEB128(blob);
+					if (fn_idx >= (u32)m_imports.size()) {
+						// flow function, its slots are counted separately
+						if (fn_idx >= (u32)(m_imports.size() + m_functions.size())) return U32_MAX;
+						depth -= (i32)m_functions[fn_idx - m_imports.size()].num_args;
+						break;
+					}
+					const Import& import = m_imports[fn_idx];
+					depth -= (i32)import.num_args;
+					depth += (i32)import.num_rets;
+					break;
+				}
+				case WasmOp::LOCAL_GET:
+				case WasmOp::GLOBAL_GET:
+					readLEB128(blob);
+					++depth;
+					break;
+				case WasmOp::LOCAL_SET:
+				case WasmOp::GLOBAL_SET:
+					readLEB128(blob);
+					--depth;
+					break;
+				case WasmOp::LOCAL_TEE:
+					readLEB128(blob);
+					break;
+				case WasmOp::I32_LOAD:
+				case WasmOp::F32_LOAD:
+					readLEB128(blob); // align
+					readLEB128(blob); // offset
+					break;
+				case WasmOp::I32_STORE:
+				case WasmOp::F32_STORE:
+					readLEB128(blob); // align
+					readLEB128(blob); // offset
+					depth -= 2;
+					break;
+				case WasmOp::I32_CONST:
+				case WasmOp::I64_CONST:
+					readLEB128(blob);
+					++depth;
+					++num_consts;
+					break;
+				case WasmOp::F32_CONST:
+					blob.skip(sizeof(float));
+					++depth;
+					++num_consts;
+					break;
+				case WasmOp::F64_CONST:
+					blob.skip(sizeof(double));
+					++depth;
+					++num_consts;
+					break;
+				case WasmOp::I32_EQ:
+				case WasmOp::I32_NEQ:
+				case WasmOp::I32_LT_S:
+				case WasmOp::I32_GT_S:
+				case WasmOp::I32_LE_S:
+				case WasmOp::I32_GE_S:
+				case WasmOp::I32_GE_U:
+				case WasmOp::F32_EQ:
+				case WasmOp::F32_NEQ:
+				case WasmOp::F32_LT:
+				case WasmOp::F32_GT:
+				case WasmOp::F32_LE:
+				case WasmOp::F32_GE:
+				case WasmOp::I32_ADD:
+				case WasmOp::I32_MUL:
+				case WasmOp::I32_OR:
+				case WasmOp::F32_ADD:
+				case WasmOp::F32_SUB:
+				case WasmOp::F32_MUL:
+				case WasmOp::F32_DIV:
+					--depth;
+					break;
+				case WasmOp::I32_EQZ:
+				case WasmOp::F32_SQRT:
+				case WasmOp::I32_TRUNC_F32_S:
+				case WasmOp::F32_CONVERT_I32_S:
+					break;
+				default:
+					ASSERT(false);
+					return U32_MAX;
+			}
+			max_depth = maximum(max_depth, depth);
+		}
+		return num_args + num_locals + num_consts + (u32)max_depth;
+	}
+
+	static i64 readSignedLEB128(InputMemoryStream& blob) {
+		i64 res = 0;
+		u32 shift = 0;
+		u8 byte;
+		do {
+			byte = blob.read<u8>();
+			res |= i64(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		if (shift < 64 && (byte & 0x40)) res |= -(i64(1) << shift);
+		return res;
+	}
+
+	// C++ source doing the same as the module produced by the last write, see ScriptNative
+	// returns false if the module uses something the translation does not know
+	bool writeNative(OutputMemoryStream& out, StableHash bytecode_hash, const Path& path) const {
+		Array<ScriptImport> imports(m_allocator);
+		for (const Import& import : m_imports) {
+			u32 idx = 0;
+			while (idx < (u32)ScriptImport::COUNT && !equalStrings(getScriptImportName((ScriptImport)idx), import.field_name.c_str())) ++idx;
+			if (idx == (u32)ScriptImport::COUNT || !equalStrings(import.module_name.c_str(), "LumixAPI")) {
+				logError(path, ": ", import.module_name.c_str(), ".", import.field_name.c_str(), " can not be called from native code");
+				return false;
+			}
+			imports.push((ScriptImport)idx);
+		}
+
+		writeLine(out, 0, "// generated by the visual script editor from ", path.c_str(), ", do not edit");
+		writeLine(out, 0, "// used only by resources with exactly the same bytecode, regenerate it after the script is changed");
+		writeLine(out, 0, "#include \"core/crt.h\"");
+		writeLine(out, 0, "#include \"script.h\"");
+		writeLine(out, 0);
+		writeLine(out, 0, "namespace Lumix {");
+		writeLine(out, 0, "namespace {");
+		writeLine(out, 0);
+		writeLine(out, 0, "static float asF32(u64 value) { return ScriptNativeContext::toF32(value); }");
+		writeLine(out, 0, "static u64 fromF32(float value) { return ScriptNativeContext::fromF32(value); }");
+		writeLine(out, 0);
+		for (u32 i = 0; i < (u32)m_functions.size(); ++i) {
+			writeLine(out, 0, "static M3Result f", i, "(const ScriptNativeContext& ctx, const u64* args);");
+		}
+		for (u32 i = 0; i < (u32)m_functions.size(); ++i) {
+			writeLine(out, 0);
+			if (!writeNativeFunction(out, i, imports)) {
+				logError(path, ": function ", i, " can not be translated to native code");
+				return false;
+			}
+		}
+
+		writeLine(out, 0);
+		const u64 hash = bytecode_hash.getHashValue();
+		writeLine(out, 0, "ScriptNative g_native = {");
+		writeLine(out, 1, "StableHash::fromU64(", hash, "ull),");
+		writeLine(out, 1, "{");
+		for (u32 i = 0; i < (u32)ScriptCallback::COUNT; ++i) {
+			const char* name = getScriptCallbackName((ScriptCallback)i);
+			u32 fn_idx = 0;
+			while (fn_idx < (u32)m_functions.size()) {
+				const Function& f = m_functions[fn_idx];
+				if (f.is_exported && equalStrings(f.name.c_str(), name)) break;
+				++fn_idx;
+			}
+			if (fn_idx < (u32)m_functions.size()) writeLine(out, 2, "f", fn_idx, ", // ", name);
+			else writeLine(out, 2, "nullptr, // ", name);
+		}
+		writeLine(out, 1, "}");
+		writeLine(out, 0, "};");
+		writeLine(out, 0);
+		writeLine(out, 0, "struct Registration {");
+		writeLine(out, 1, "Registration() { registerScriptNative(g_native); }");
+		writeLine(out, 0, "} g_registration;");
+		writeLine(out, 0);
+		writeLine(out, 0, "} // anonymous namespace");
+		writeLine(out, 0, "} // namespace Lumix");
+		return true;
+	}
+
+	// operand stack and locals become u64 variables holding raw values, control flow becomes gotos
+	bool writeNativeFunction(OutputMemoryStream& out, u32 function_idx, const Array<ScriptImport>& imports) const {
+		struct Label {
+			u32 id;
+			bool is_loop;
+			bool is_if;
+			// operand stack depth at the block's start
+			u32 depth;
+			u32 num_results;
+			bool referenced;
+		};
+
+		InputMemoryStream blob(m_bodies[function_idx]);
+		const u32 num_args = m_functions[function_idx].num_args;
+		u32 num_locals = num_args;
+		const u32 num_local_groups = readLEB128(blob);
+		for (u32 i = 0; i < num_local_groups; ++i) {
+			num_locals += readLEB128(blob);
+			blob.read<WASMType>();
+		}
+		Array<bool> used_locals(m_allocator);
+		for (u32 i = 0; i < num_locals; ++i) used_locals.push(false);
+
+		OutputMemoryStream body(m_allocator);
+		StackArray<Label, 16> labels(m_allocator);
+		u32 depth = 0;
+		u32 max_depth = 0;
+		u32 num_labels = 0;
+		bool ended = false;
+		
+		auto pop = [&](u32 count) {
+			if (depth < count) return false;
+			depth -= count;
+			return true;
+		};
+
+		auto readLocal = [&]() {
+			const u32 idx = readLEB128(blob);
+			if (idx < num_locals) used_locals[idx] = true;
+			return idx;
+		};
+		
+		auto beginBlock = [&](bool is_loop, bool is_if) {
+			const u8 block_type = blob.read<u8>();
+			Label& label = labels.emplace();
+			label.id = num_labels++;
+			label.is_loop = is_loop;
+			label.is_if = is_if;
+			label.depth = depth;
+			label.num_results = block_type == 0x40 ? 0 : 1;
+			label.referenced = false;
+		};
+
+		// jump to the end of a block or to the start of a loop, `idx` counts from the innermost block
+		auto branch = [&](u32 idx, u32 indent) {
+			if (idx >= (u32)labels.size()) return false;
+			Label& label = labels[labels.size() - 1 - idx];
+			if (!label.is_loop && label.num_results > 0 && depth == 0) return false;
+			if (!label.is_loop && label.num_results > 0) writeLine(body, indent, "s", label.depth, " = s", depth - 1, ";");
+			label.referenced = true;
+			writeLine(body, indent, "goto L", label.id, ";");
+			return true;
+		};
+
+		auto binary = [&](const char* lhs_cast, const char* op, const char* rhs_cast, const char* result_cast, const char* result_end) {
+			if (!pop(1) || depth == 0) return false;
+			writeLine(body, labels.size() + 1, "s", depth - 1, " = ", result_cast, lhs_cast, "s", depth - 1, ")", op, rhs_cast, "s", depth, ")", result_end, ";");
+			return true;
+		};
+		auto binaryI32 = [&](const char* op) { return binary("(i32)(", op, "(i32)(", "(u32)(", ")"); };
+		auto binaryU32 = [&](const char* op) { return binary("(u32)(", op, "(u32)(", "(u32)(", ")"); };
+		auto binaryF32 = [&](const char* op) { return binary("asF32(", op, "asF32(", "fromF32(", ")"); };
+		auto compareF32 = [&](const char* op) { return binary("asF32(", op, "asF32(", "(u64)(", ")"); };
+
+		while (blob.remaining() > 0) {
+			if (ended) return false;
+			const WasmOp op = blob.read<WasmOp>();
+			const u32 indent = labels.size() + 1;
+			bool valid = true;
+			switch (op) {
+				case WasmOp::BLOCK:
+					beginBlock(false, false);
+					break;
+				case WasmOp::LOOP:
+					beginBlock(true, false);
+					writeLine(body, indent - 1, "L", labels.last().id, ":;");
+					break;
+				case WasmOp::IF:
+					valid = pop(1);
+					beginBlock(false, true);
+					writeLine(body, indent, "if ((u32)s", depth, ") {");
+					break;
+				case WasmOp::ELSE:
+					if (labels.empty() || !labels.last().is_if) return false;
+					depth = labels.last().depth;
+					writeLine(body, indent - 1, "} else {");
+					break;
+				case WasmOp::END:
+					if (labels.empty()) {
+						writeLine(body, 1, "return m3Err_none;");
+						ended = true;
+						break;
+					}
+					if (labels.last().is_if) writeLine(body, indent - 1, "}");
+					if (!labels.last().is_loop && labels.last().referenced) writeLine(body, indent - 1, "L", labels.last().id, ":;");
+					depth = labels.last().depth + labels.last().num_results;
+					labels.pop();
+					break;
+				case WasmOp::BR:
+					valid = branch(readLEB128(blob), indent);
+					break;
+				case WasmOp::BR_IF:
+					valid = pop(1);
+					writeLine(body, indent, "if ((u32)s", depth, ") {");
+					valid = valid && branch(readLEB128(blob), indent + 1);
+					writeLine(body, indent, "}");
+					break;
+				case WasmOp::CALL: {
+					const u32 fn_idx = readLEB128(blob);
+					if (fn_idx < (u32)m_imports.size()) {
+						const Import& import = m_imports[fn_idx];
+						if (!pop(import.num_args)) return false;
+						writeLine(body, indent, "{");
+						writeLine(body, indent + 1, "u64 sp[", maximum(import.num_rets + import.num_args, 1u), "] = {};");
+						for (u32 i = 0; i < import.num_args; ++i) {
+							writeLine(body, indent + 1, "sp[", import.num_rets + i, "] = s", depth + i, ";");
+						}
+						writeLine(body, indent + 1, "if (const M3Result res = ctx.call((ScriptImport)", (u32)imports[fn_idx], ", sp)) return res; // ", import.field_name.c_str());
+						for (u32 i = 0; i < import.num_rets; ++i) {
+							writeLine(body, indent + 1, "s", depth + i, " = sp[", i, "];");
+						}
+						writeLine(body, indent, "}");
+						depth += import.num_rets;
+						break;
+					}
+					const u32 callee = fn_idx - m_imports.size();
+					if (callee >= (u32)m_functions.size()) return false;
+					const u32 callee_args = m_functions[callee].num_args;
+					if (!pop(callee_args)) return false;
+					writeLine(body, indent, "{");
+					writeLine(body, indent + 1, "u64 a[", maximum(callee_args, 1u), "] = {};");
+					for (u32 i = 0; i < callee_args; ++i) {
+						writeLine(body, indent + 1, "a[", i, "] = s", depth + i, ";");
+					}
+					writeLine(body, indent + 1, "if (const M3Result res = f", callee, "(ctx, a)) return res;");
+					writeLine(body, indent, "}");
+					break;
+				}
+				case WasmOp::LOCAL_GET:
+					writeLine(body, indent, "s", depth, " = l", readLocal(), ";");
+					++depth;
+					break;
+				case WasmOp::LOCAL_SET:
+					valid = pop(1);
+					writeLine(body, indent, "l", readLocal(), " = s", depth, ";");
+					break;
+				case WasmOp::LOCAL_TEE:
+					valid = depth > 0;
+					writeLine(body, indent, "l", readLocal(), " = s", depth - 1, ";");
+					break;
+				case WasmOp::I32_LOAD:
+				case WasmOp::F32_LOAD: {
+					readLEB128(blob); // align
+					const u32 offset = readLEB128(blob);
+					valid = depth > 0;
+					writeLine(body, indent, "s", depth - 1, " = ctx.load((u32)s", depth - 1, " + ", offset, "u);");
+					break;
+				}
+				case WasmOp::I32_STORE:
+				case WasmOp::F32_STORE: {
+					readLEB128(blob); // align
+					const u32 offset = readLEB128(blob);
+					valid = pop(2);
+					writeLine(body, indent, "ctx.store((u32)s", depth, " + ", offset, "u, (u32)s", depth + 1, ");");
+					break;
+				}
+				case WasmOp::I32_CONST:
+					writeLine(body, indent, "s", depth, " = ", (u32)readSignedLEB128(blob), "u;");
+					++depth;
+					break;
+				case WasmOp::I64_CONST:
+					writeLine(body, indent, "s", depth, " = ", (u64)readSignedLEB128(blob), "ull;");
+					++depth;
+					break;
+				case WasmOp::F32_CONST:
+					writeLine(body, indent, "s", depth, " = ", blob.read<u32>(), "u;");
+					++depth;
+					break;
+				case WasmOp::F64_CONST:
+					writeLine(body, indent, "s", depth, " = ", blob.read<u64>(), "ull;");
+					++depth;
+					break;
+				case WasmOp::I32_EQZ:
+					valid = depth > 0;
+					writeLine(body, indent, "s", depth - 1, " = (u32)s", depth - 1, " == 0;");
+					break;
+				case WasmOp::I32_EQ: valid = binaryI32(" == "); break;
+				case WasmOp::I32_NEQ: valid = binaryI32(" != "); break;
+				case WasmOp::I32_LT_S: valid = binaryI32(" < "); break;
+				case WasmOp::I32_GT_S: valid = binaryI32(" > "); break;
+				case WasmOp::I32_LE_S: valid = binaryI32(" <= "); break;
+				case WasmOp::I32_GE_S: valid = binaryI32(" >= "); break;
+				case WasmOp::I32_GE_U: valid = binaryU32(" >= "); break;
+				case WasmOp::F32_EQ: valid = compareF32(" == "); break;
+				case WasmOp::F32_NEQ: valid = compareF32(" != "); break;
+				case WasmOp::F32_LT: valid = compareF32(" < "); break;
+				case WasmOp::F32_GT: valid = compareF32(" > "); break;
+				case WasmOp::F32_LE: valid = compareF32(" <= "); break;
+				case WasmOp::F32_GE: valid = compareF32(" >= "); break;
+				case WasmOp::I32_ADD: valid = binaryU32(" + "); break;
+				case WasmOp::I32_MUL: valid = binaryU32(" * "); break;
+				case WasmOp::I32_OR: valid = binaryU32(" | "); break;
+				case WasmOp::F32_ADD: valid = binaryF32(" + "); break;
+				case WasmOp::F32_SUB: valid = binaryF32(" - "); break;
+				case WasmOp::F32_MUL: valid = binaryF32(" * "); break;
+				case WasmOp::F32_DIV: valid = binaryF32(" / "); break;
+				case WasmOp::F32_SQRT:
+					valid = depth > 0;
+					writeLine(body, indent, "s", depth - 1, " = fromF32(sqrtf(asF32(s", depth - 1, ")));");
+					break;
+				case WasmOp::I32_TRUNC_F32_S:
+					// traps the same as wasm3, the cast is undefined for NaN and out of range values
+					valid = depth > 0;
+					writeLine(body, indent, "{");
+					writeLine(body, indent + 1, "const float f = asF32(s", depth - 1, ");");
+					writeLine(body, indent + 1, "if (f != f) return m3Err_trapIntegerConversion;");
+					writeLine(body, indent + 1, "if (f >= 2147483648.f || f < -2147483648.f) return m3Err_trapIntegerOverflow;");
+					writeLine(body, indent + 1, "s", depth - 1, " = (u32)(i32)f;");
+					writeLine(body, indent, "}");
+					break;
+				case WasmOp::F32_CONVERT_I32_S:
+					valid = depth > 0;
+					writeLine(body, indent, "s", depth - 1, " = fromF32((float)(i32)s", depth - 1, ");");
+					break;
+				default:
+					// e.g. globals, graphs keep their state in instance records
+					return false;
+			}
+			if (!valid) return false;
+			max_depth = maximum(max_depth, depth);
+		}
+		if (!ended) return false;
+
+		writeLine(out, 0, "static M3Result f", function_idx, "(const ScriptNativeContext& ctx, const u64* args) {");
+		if (num_args == 0) writeLine(out, 1, "(void)args;");
+		for (u32 i = 0; i < num_locals; ++i) {
+			if (!used_locals[i]) continue;
+			if (i < num_args) writeLine(out, 1, "u64 l", i, " = args[", i, "];");
+			else writeLine(out, 1, "u64 l", i, " = 0;");
+		}
+		for (u32 i = 0; i < max_depth; ++i) writeLine(out, 1, "u64 s", i, " = 0;");
+		out.write(body.data(), body.size());
+		writeLine(out, 0, "}");
+		return true;
+	}
+
 	static void writeString(OutputMemoryStream& blob, const char* value) {
 		const i32 len = stringLength(value);
 		writeLEB128(blob, len);
@@ -407,10 +1081,15 @@ struct WASMWriter {
 		blob.write(tmp.data(), tmp.size());
 	}
 
-	struct Export {
-		Export(IAllocator& allocator) : name(allocator) {}
+	// exported functions are entry points called by the host, the others run flow shared by several nodes
+	struct Function {
+		Function(IAllocator& allocator) : name(allocator) {}
 		Node* node = nullptr;
+		u32 input_idx = 0;
 		String name;
+		bool is_exported = true;
+		// Graph::m_instance_local of the code calling the function
+		u32 instance_local = U32_MAX;
 		u32 num_args = 0;
 		WASMType args[8];
 	};
@@ -426,14 +1105,20 @@ struct WASMWriter {
 		String module_name;
 		String field_name;
 		u32 num_args = 0;
+		u32 num_rets = 0;
 		WASMType args[8];
-		WASMType ret_type;
+		WASMType rets[4];
 	};
 
 	IAllocator& m_allocator;
 	Array<Import> m_imports;
 	Array<Global> m_globals;
-	Array<Export> m_exports;
+	Array<Function> m_functions;
+	// code of m_functions from the last write, kept for writeNative
+	Array<OutputMemoryStream> m_bodies;
+	// sum over all functions, U32_MAX if unknown
+	u32 m_stack_slots = 0;
+	u32 m_memory_pages = 0;
 };
 
 struct Graph {
@@ -442,6 +1127,18 @@ struct Graph {
 		, m_nodes(allocator)
 		, m_links(allocator)
 		, m_variables(allocator)
+		, m_properties(allocator)
+		, m_functions(allocator)
+		, m_profiled_nodes(allocator)
+		, m_locals(allocator)
+		, m_cache(allocator)
+		, m_output_types(allocator)
+		, m_links_by_from(allocator)
+		, m_links_by_to(allocator)
+		, m_from_ranges(allocator)
+		, m_to_ranges(allocator)
+		, m_node_map(allocator)
+		, m_export_signatures(allocator)
 		, m_path(path)
 	{}
 
@@ -467,117 +1164,752 @@ struct Graph {
 	}
 
 	static constexpr u32 MAGIC = '_LVS';
-	
-	template <typename... Args>
-	void addExport(WASMWriter& writer, Node::Type node_type, const char* name, Args... args) {
-		for (Node* n : m_nodes) {
-			if (n->getType() == node_type) {
-				WASMType a[] = { args..., WASMType::VOID };
-				writer.addFunctionExport(name, n, Span(a, lengthOf(a) - 1));
-				break;
-			}
+
+	enum class Version : u32 {
+		BATCH_UPDATE,
+		PROFILE_NODES,
+		UPDATE_POLICY,
+
+		LAST
+	};
+
+	// instances keep their state in linear memory as records of this layout:
+	// i32 self followed by variables, 4 bytes per component, followed by states of latent nodes
+	static constexpr u32 SELF_OFFSET = 0;
+	// first page is for instance records, second one for host call buffers
+	static constexpr u32 MEMORY_PAGES = 2;
+	static constexpr u32 RESERVED_MEMORY = 64 * 1024;
+	static constexpr u32 RESERVED_OFFSET = MEMORY_PAGES * 64 * 1024 - RESERVED_MEMORY;
+	// arguments of host calls, the last ScriptResource::SCRATCH_SIZE bytes of memory
+	static constexpr u32 SCRATCH_OFFSET = MEMORY_PAGES * 64 * 1024 - ScriptResource::SCRATCH_SIZE;
+	// node execution counters at the start of reserved memory, if m_profile_nodes
+	static constexpr u32 PROFILE_OFFSET = RESERVED_OFFSET;
+	static constexpr u32 MAX_PROFILED_NODES = 1024;
+
+	// query nodes get disjoint parts of reserved memory, so nested queries do not overwrite each other's records
+	void getQueryBuffer(const Node* node, u32& offset, u32& capacity) const {
+		u32 num_queries = 0;
+		u32 index = 0;
+		for (const Node* n : m_nodes) {
+			if (n->getType() != Node::Type::FOR_EACH_IN_RADIUS) continue;
+			if (n == node) index = num_queries;
+			++num_queries;
 		}
+		const u32 profile_size = m_profile_nodes ? MAX_PROFILED_NODES * sizeof(u32) : 0;
+		const u32 size = (RESERVED_MEMORY - ScriptResource::SCRATCH_SIZE - profile_size) / num_queries;
+		capacity = size / sizeof(ScriptQueryRecord);
+		offset = RESERVED_OFFSET + profile_size + index * capacity * sizeof(ScriptQueryRecord);
 	}
-	
-	template <typename... Args>
-	void addImport(WASMWriter& writer, const char* module_name, const char* field_name, WASMType ret_type, Args... args) {
-		WASMType a[] = { args... };
-		writer.addFunctionImport(module_name, field_name, ret_type, Span(a, lengthOf(a)));
+
+	u32 getVariableOffset(u32 var) const {
+		u32 offset = sizeof(i32);
+		for (u32 i = 0; i < var; ++i) offset += getComponentCount(m_variables[i].type) * sizeof(i32);
+		return offset;
 	}
 
-	void generate(OutputMemoryStream& blob) {
-		for (Node* node : m_nodes) {
-			node->clearError();
+	// latent nodes wait across frames, their state lives in the instance record
+	static bool isLatent(const Node* node) {
+		return node->getType() == Node::Type::WAIT_UNTIL || node->getType() == Node::Type::MOVE_TO;
+	}
+	// i32 nonzero while waiting, followed by live values of the node
+	static constexpr u32 LATENT_STATE_SIZE = 5 * sizeof(i32);
+
+	// offset of `node`'s state in the instance record, end of the record if `node` is null
+	u32 getLatentOffset(const Node* node) const {
+		u32 offset = getVariableOffset(m_variables.size());
+		for (const Node* n : m_nodes) {
+			if (n == node) break;
+			if (isLatent(n)) offset += LATENT_STATE_SIZE;
 		}
+		return offset;
+	}
+	u32 getInstanceSize() const { return getLatentOffset(nullptr); }
 
-		WASMWriter writer(m_allocator);
-		addExport(writer, Node::Type::UPDATE, "update", WASMType::F32);
-		addExport(writer, Node::Type::MOUSE_MOVE, "onMouseMove", WASMType::F32, WASMType::F32);
-		addExport(writer, Node::Type::KEY_INPUT, "onKeyEvent", WASMType::I32);
-		addExport(writer, Node::Type::START, "start");
-		
-		addImport(writer, "LumixAPI", "setYaw", WASMType::VOID, WASMType::I32, WASMType::F32);
-		addImport(writer, "LumixAPI", "setPropertyFloat", WASMType::VOID, WASMType::I32, WASMType::I64, WASMType::F32);
-		addImport(writer, "LumixAPI", "getPropertyFloat", WASMType::F32,  WASMType::I32, WASMType::I64);
+	void beginFunction(u32 num_params) const {
+		m_num_params = num_params;
+		m_locals.clear();
+		m_cache.clear();
+		m_written = {};
+	}
 
-		writer.addGlobal(WASMType::I32, "self");
-		for (const Variable& var : m_variables) {
-			switch (var.type) {
-				case ScriptValueType::I32:
-					writer.addGlobal(WASMType::I32, var.name.c_str());
-					break;
-				case ScriptValueType::FLOAT:
-					writer.addGlobal(WASMType::F32, var.name.c_str());
-					break;
-				default: ASSERT(false); break;
-			}
-		}
+	// returns index of a new local in currently generated function
+	u32 allocLocal(WASMType type) const {
+		m_locals.push(type);
+		return m_num_params + m_locals.size() - 1;
+	}
 
-		ScriptResource::Header header;
-		blob.write(header);
-		writer.write(blob, *this);
+	// consecutive locals for all components of `type`, returns index of the first one
+	u32 allocLocals(ScriptValueType type) const {
+		const u32 first = allocLocal(getComponentType(type));
+		for (u32 i = 1, c = getComponentCount(type); i < c; ++i) allocLocal(getComponentType(type));
+		return first;
 	}
 
-	void clear() {
-		for (Node* n : m_nodes) {
-			LUMIX_DELETE(m_allocator, n);
+	// pops `count` values from the operand stack to locals starting at `local`
+	static void generateSpill(OutputMemoryStream& blob, u32 local, u32 count) {
+		for (u32 i = count; i > 0; --i) {
+			blob.write(WasmOp::LOCAL_SET);
+			writeLEB128(blob, local + i - 1);
 		}
-		m_nodes.clear();
-		m_links.clear();
-		m_variables.clear();
 	}
 
-	bool deserialize(InputMemoryStream& blob) {
-		const u32 magic = blob.read<u32>();
-		if (magic != MAGIC) return false;
-		const u32 version = blob.read<u32>();
-		if (version != 0) return false;
-		
-		blob.read(m_node_counter);
-		const u32 var_count = blob.read<u32>();
-		m_variables.reserve(var_count);
-		for (u32 i = 0; i < var_count; ++i) {
-			Variable& var = m_variables.emplace(m_allocator);
-			var.name = blob.readString();
-			blob.read(var.type);
+	static void generateFill(OutputMemoryStream& blob, u32 local, u32 count) {
+		for (u32 i = 0; i < count; ++i) {
+			blob.write(WasmOp::LOCAL_GET);
+			writeLEB128(blob, local + i);
 		}
+	}
 
-		const u32 link_count = blob.read<u32>();
-		m_links.reserve(link_count);
-		for (u32 i = 0; i < link_count; ++i) {
-			NodeEditorLink& link = m_links.emplace();
-			blob.read(link);
+	// resolves type of each linked output once, so codegen does not walk the inputs of every consumer again
+	// the graph must not change until m_types_inferred is reset
+	void inferTypes() const {
+		m_output_types.clear();
+		m_types_inferred = true;
+		for (const NodeEditorLink& link : m_links) {
+			Node* node = getNode(link.getFromNode());
+			if (node) getType({node, link.getFromPin()});
 		}
+	}
 
-		const u32 node_count = blob.read<u32>();
-		m_nodes.reserve(node_count);
-		for (u32 i = 0; i < node_count; ++i) {
-			const Node::Type type = blob.read<Node::Type>();
-			Node* n = createNode(type);
-			blob.read(n->m_id);
-			blob.read(n->m_pos);
-			n->deserialize(blob);
+	ScriptValueType getType(Node::NodeOutput output) const {
+		if (!m_types_inferred) return output.node->getOutputType(output.output_idx, *this);
+		const u32 key = output.node->m_id | (output.output_idx << 16);
+		auto iter = m_output_types.find(key);
+		if (iter.isValid()) return iter.value();
+		// outputs depending on themselves resolve to i32 instead of recursing forever
+		m_output_types.insert(key, ScriptValueType::I32);
+		const ScriptValueType type = output.node->getOutputType(output.output_idx, *this);
+		m_output_types[key] = type;
+		return type;
+	}
+
+	// type both operands of arithmetic or comparison are converted to, i32 is promoted to float
+	static bool getCommonType(ScriptValueType a, ScriptValueType b, ScriptValueType& common) {
+		if (a == b) {
+			common = a;
+			return true;
 		}
+		const bool a_int = a == ScriptValueType::I32 || a == ScriptValueType::ENTITY;
+		const bool b_int = b == ScriptValueType::I32 || b == ScriptValueType::ENTITY;
+		if (a_int && b_int) common = ScriptValueType::I32;
+		else if ((a_int && b == ScriptValueType::FLOAT) || (b_int && a == ScriptValueType::FLOAT)) common = ScriptValueType::FLOAT;
+		else return false;
 		return true;
 	}
 
-	Node* createNode(Node::Type type);
+	static bool isNumber(ScriptValueType type) {
+		return type == ScriptValueType::I32 || type == ScriptValueType::FLOAT || type == ScriptValueType::ENTITY;
+	}
 
-	void serialize(OutputMemoryStream& blob) {
-		blob.write(MAGIC);
-		const u32 version = 0;
-		blob.write(version);
-		blob.write(m_node_counter);
-		
-		blob.write(m_variables.size());
-		for (const Variable& var : m_variables) {
-			blob.writeString(var.name.c_str());
-			blob.write(var.type);
-		}
+	// generates i32 which is nonzero if `cond` is, `cond` must be a number, see isNumber
+	void generateCondition(OutputMemoryStream& blob, Node::NodeOutput cond) const {
+		cond.generate(blob, *this);
+		if (getType(cond) != ScriptValueType::FLOAT) return;
+		blob.write(WasmOp::F32_CONST);
+		blob.write(0.f);
+		blob.write(WasmOp::F32_NEQ);
+	}
 
-		blob.write(m_links.size());
-		for (const NodeEditorLink& link : m_links) {
-			blob.write(link);
+	// `from` can be generated as `to`, see generateAs
+	static bool isConvertible(ScriptValueType from, ScriptValueType to) {
+		return from == to || (isNumber(from) && isNumber(to));
+	}
+
+	// generates `output` converted to `type`, only scalar i32 (entity is i32 too) and float are converted, other types as they are
+	void generateAs(OutputMemoryStream& blob, Node::NodeOutput output, ScriptValueType type) const {
+		output.generate(blob, *this);
+		const ScriptValueType from = getType(output);
+		const bool from_int = from == ScriptValueType::I32 || from == ScriptValueType::ENTITY;
+		const bool to_int = type == ScriptValueType::I32 || type == ScriptValueType::ENTITY;
+		if (from == ScriptValueType::FLOAT && to_int) blob.write(WasmOp::I32_TRUNC_F32_S);
+		else if (from_int && type == ScriptValueType::FLOAT) blob.write(WasmOp::F32_CONVERT_I32_S);
+	}
+
+	// generates `output` to new locals, returns index of the first one
+	u32 generateToLocals(OutputMemoryStream& blob, Node::NodeOutput output) const;
+
+	u32 getFanOut(const Node* node, u32 output_idx) const {
+		u32 count = 0;
+		for (u32 i : getLinksFrom(node->m_id)) {
+			const NodeEditorLink& link = m_links[i];
+			if (link.getFromPin() != output_idx) continue;
+			Node* to = getNode(link.getToNode());
+			count += to ? to->getInputUses(link.to >> 16, *this) : 1;
+		}
+		return count;
+	}
+
+	// outputs read by more than one consumer are evaluated once into a local, until something they read is written
+	void generateCached(OutputMemoryStream& blob, Node* node, u32 output_idx) const {
+		if (getFanOut(node, output_idx) < 2) {
+			node->generate(blob, *this, output_idx);
+			return;
+		}
+
+		const ScriptValueType type = getType({node, output_idx});
+		const u32 num_components = getComponentCount(type);
+		auto store = [&](u32 local){
+			if (num_components == 1) {
+				blob.write(WasmOp::LOCAL_TEE);
+				writeLEB128(blob, local);
+				return;
+			}
+			generateSpill(blob, local, num_components);
+			generateFill(blob, local, num_components);
+		};
+
+		for (u32 i = 0, c = m_cache.size(); i < c; ++i) {
+			if (m_cache[i].node != node || m_cache[i].output_idx != output_idx) continue;
+			if (m_cache[i].valid) {
+				generateFill(blob, m_cache[i].local, num_components);
+				return;
+			}
+			node->generate(blob, *this, output_idx);
+			store(m_cache[i].local);
+			m_cache[i].valid = true;
+			return;
+		}
+
+		OutputMemoryStream tmp(m_allocator);
+		node->generate(tmp, *this, output_idx);
+		blob.write(tmp.data(), tmp.size());
+		// not worth a local, e.g. local.get of a parameter
+		if (tmp.size() <= 2) return;
+
+		CachedOutput& cached = m_cache.emplace();
+		cached.node = node;
+		cached.output_idx = output_idx;
+		cached.local = allocLocals(type);
+		node->getReads(output_idx, *this, cached.reads);
+		store(cached.local);
+	}
+
+	// must be called after code which writes `written` is generated
+	void invalidateCache(const Reads& written) const {
+		for (CachedOutput& cached : m_cache) {
+			if (cached.reads.intersects(written)) cached.valid = false;
+		}
+		m_written.add(written);
+	}
+
+	// loop body can run any number of times, so values it caches are not available after it and
+	// values cached before it are not reused in it if the body writes something they read
+	template <typename F>
+	void generateLoopBody(OutputMemoryStream& blob, F body) const {
+		StackArray<bool, 16> valid(m_allocator);
+		for (const CachedOutput& cached : m_cache) valid.push(cached.valid);
+		auto restore = [&](){
+			for (u32 i = 0; i < (u32)m_cache.size(); ++i) m_cache[i].valid = i < (u32)valid.size() && valid[i];
+		};
+		const Reads written = m_written;
+
+		OutputMemoryStream tmp(m_allocator);
+		m_written = {};
+		++m_loop_depth;
+		body(tmp);
+		const Reads body_written = m_written;
+		restore();
+
+		bool needs_regenerate = false;
+		for (u32 i = 0; i < (u32)valid.size(); ++i) {
+			if (valid[i] && m_cache[i].reads.intersects(body_written)) {
+				m_cache[i].valid = valid[i] = false;
+				needs_regenerate = true;
+			}
+		}
+		if (needs_regenerate) {
+			tmp.clear();
+			body(tmp);
+			restore();
+		}
+		--m_loop_depth;
+		blob.write(tmp.data(), tmp.size());
+
+		m_written = written;
+		invalidateCache(body_written);
+	}
+
+	// increments `node`'s execution counter, if nodes are profiled
+	void generateNodeCounter(OutputMemoryStream& blob, const Node* node) const {
+		if (!m_profile_nodes) return;
+		i32 idx = m_profiled_nodes.indexOf(node->m_id);
+		if (idx < 0) {
+			if (m_profiled_nodes.size() == MAX_PROFILED_NODES) return;
+			m_profiled_nodes.push(node->m_id);
+			idx = m_profiled_nodes.size() - 1;
+		}
+		const u32 address = PROFILE_OFFSET + idx * sizeof(u32);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, address);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, address);
+		blob.write(WasmOp::I32_LOAD);
+		generateMemArg(blob, 0);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, 1);
+		blob.write(WasmOp::I32_ADD);
+		blob.write(WasmOp::I32_STORE);
+		generateMemArg(blob, 0);
+	}
+
+	// number of links entering `node`'s (flow) input
+	u32 getFanIn(const Node* node, u32 input_idx) const {
+		const u32 to = node->m_id | (input_idx << 16);
+		u32 count = 0;
+		for (u32 i : getLinksTo(node->m_id)) {
+			if (m_links[i].to == to) ++count;
+		}
+		return count;
+	}
+
+	// flow entered from several places is generated only once, as a function called from all of them,
+	// inside loops it's inlined since it can use locals of the loop (e.g. index)
+	void generateFlow(OutputMemoryStream& blob, Node* node, u32 input_idx) const {
+		if (m_loop_depth > 0 || getFanIn(node, input_idx) < 2) {
+			generateNodeCounter(blob, node);
+			node->generate(blob, *this, input_idx);
+			return;
+		}
+
+		const u32 fn = m_writer->getFlowFunction(node, input_idx, m_function, m_instance_local);
+		generateFill(blob, 0, m_num_params);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, fn);
+		// we do not know what the function writes
+		invalidateCache(Reads::all());
+	}
+
+	// generates mutually exclusive branches, values cached in one branch are not available in the other one or after them
+	template <typename F0, typename F1>
+	void generateBranches(F0 branch0, F1 branch1) const {
+		StackArray<bool, 16> valid(m_allocator);
+		for (const CachedOutput& cached : m_cache) valid.push(cached.valid);
+		auto restore = [&](){
+			for (u32 i = 0; i < (u32)m_cache.size(); ++i) m_cache[i].valid = i < (u32)valid.size() && valid[i];
+		};
+		const Reads written = m_written;
+		m_written = {};
+		
+		branch0();
+		restore();
+		branch1();
+		restore();
+
+		const Reads branches_written = m_written;
+		m_written = written;
+		invalidateCache(branches_written);
+	}
+
+	// address of the current instance's record, the record is at 0 outside of updateBatch's loop
+	void generateInstanceAddress(OutputMemoryStream& blob) const {
+		if (m_instance_local == U32_MAX) {
+			blob.write(WasmOp::I32_CONST);
+			writeLEB128(blob, 0);
+		}
+		else {
+			blob.write(WasmOp::LOCAL_GET);
+			writeLEB128(blob, m_instance_local);
+		}
+	}
+
+	static void generateMemArg(OutputMemoryStream& blob, u32 offset) {
+		writeLEB128(blob, 2); // align
+		writeLEB128(blob, offset);
+	}
+
+	void generateSelf(OutputMemoryStream& blob) const {
+		generateInstanceAddress(blob);
+		blob.write(WasmOp::I32_LOAD);
+		generateMemArg(blob, SELF_OFFSET);
+	}
+
+	void generateVariableGet(OutputMemoryStream& blob, u32 var) const {
+		const ScriptValueType type = m_variables[var].type;
+		const u32 offset = getVariableOffset(var);
+		for (u32 i = 0, c = getComponentCount(type); i < c; ++i) {
+			generateInstanceAddress(blob);
+			blob.write(getComponentType(type) == WASMType::F32 ? WasmOp::F32_LOAD : WasmOp::I32_LOAD);
+			generateMemArg(blob, offset + i * sizeof(i32));
+		}
+	}
+
+	// `address` generates base address, `value` generates the stored value
+	template <typename FAddress, typename FValue>
+	void generateStore(OutputMemoryStream& blob, ScriptValueType type, u32 offset, FAddress address, FValue value) const {
+		const u32 num_components = getComponentCount(type);
+		const WasmOp store_op = getComponentType(type) == WASMType::F32 ? WasmOp::F32_STORE : WasmOp::I32_STORE;
+		if (num_components == 1) {
+			address();
+			value();
+			blob.write(store_op);
+			generateMemArg(blob, offset);
+			return;
+		}
+
+		// store needs the address below the value, so components go through locals
+		value();
+		const u32 local = allocLocals(type);
+		generateSpill(blob, local, num_components);
+		for (u32 i = 0; i < num_components; ++i) {
+			address();
+			blob.write(WasmOp::LOCAL_GET);
+			writeLEB128(blob, local + i);
+			blob.write(store_op);
+			generateMemArg(blob, offset + i * sizeof(i32));
+		}
+	}
+
+	// `value` generates the stored value
+	template <typename F>
+	void generateVariableSet(OutputMemoryStream& blob, u32 var, F value) const {
+		generateStore(blob, m_variables[var].type, getVariableOffset(var), [&](){ generateInstanceAddress(blob); }, value);
+		Reads written;
+		written.variables = Reads::bit(var);
+		invalidateCache(written);
+	}
+	
+	template <typename... Args>
+	void addExport(WASMWriter& writer, Node::Type node_type, const char* name, Args... args) {
+		for (Node* n : m_nodes) {
+			if (n->getType() == node_type) {
+				// nothing connected to the entry node's flow output, do not make the host call an empty function
+				bool has_flow = false;
+				for (u32 i : getLinksFrom(n->m_id)) has_flow = has_flow || m_links[i].getFromPin() == 0;
+				if (!has_flow) break;
+
+				WASMType a[] = { args..., WASMType::VOID };
+				writer.addFunctionExport(name, n, Span(a, lengthOf(a) - 1));
+				break;
+			}
+		}
+	}
+	
+	template <typename... Args>
+	void addImport(WASMWriter& writer, const char* module_name, const char* field_name, WASMType ret_type, Args... args) {
+		WASMType a[] = { args... };
+		writer.addFunctionImport(module_name, field_name, ret_type, Span(a, lengthOf(a)));
+	}
+
+	// import returning all components of `ret_type`
+	template <typename... Args>
+	void addImport(WASMWriter& writer, const char* module_name, const char* field_name, ScriptValueType ret_type, Args... args) {
+		WASMType a[] = { args... };
+		WASMType rets[4];
+		const u32 num_rets = getComponentCount(ret_type);
+		for (u32 i = 0; i < num_rets; ++i) rets[i] = getComponentType(ret_type);
+		writer.addFunctionImport(module_name, field_name, Span<const WASMType>(rets, num_rets), Span(a, lengthOf(a)));
+	}
+
+	// exports, imports and memory, the same for full generate and for updateErrors
+	void setupWriter(WASMWriter& writer) {
+		if (m_batch_update) {
+			// time delta, first instance record address, instance count
+			addExport(writer, Node::Type::UPDATE, "updateBatch", WASMType::F32, WASMType::I32, WASMType::I32);
+		}
+		else {
+			addExport(writer, Node::Type::UPDATE, "update", WASMType::F32);
+		}
+		addExport(writer, Node::Type::MOUSE_MOVE, "onMouseMove", WASMType::F32, WASMType::F32);
+		// button's key id, 1 if pressed, 0 if released
+		addExport(writer, Node::Type::MOUSE_BUTTON, "onMouseButton", WASMType::I32, WASMType::I32);
+		addExport(writer, Node::Type::KEY_INPUT, "onKeyEvent", WASMType::I32);
+		addExport(writer, Node::Type::START, "start");
+		// all timer nodes share one export, the host passes id of the expired timer
+		for (Node* n : m_nodes) {
+			if (n->getType() != Node::Type::DELAY && n->getType() != Node::Type::EVERY) continue;
+			const WASMType arg = WASMType::I32;
+			writer.addFunctionExport("onTimer", n, Span(&arg, 1), DISPATCH_INPUT);
+			break;
+		}
+		// all latent nodes share one export, called by the host each frame while any of them waits
+		for (Node* n : m_nodes) {
+			if (!isLatent(n)) continue;
+			const WASMType arg = WASMType::F32;
+			writer.addFunctionExport("resume", n, Span(&arg, 1), DISPATCH_INPUT);
+			break;
+		}
+		
+		addImport(writer, "LumixAPI", "setYaw", WASMType::VOID, WASMType::I32, WASMType::F32);
+		addImport(writer, "LumixAPI", "setPropertyFloat", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::F32);
+		addImport(writer, "LumixAPI", "getPropertyFloat", WASMType::F32,  WASMType::I32, WASMType::I32);
+		addImport(writer, "LumixAPI", "getPosition", ScriptValueType::VEC3, WASMType::I32);
+		addImport(writer, "LumixAPI", "setPosition", WASMType::VOID, WASMType::I32, WASMType::F32, WASMType::F32, WASMType::F32);
+		addImport(writer, "LumixAPI", "getRotation", ScriptValueType::QUAT, WASMType::I32);
+		addImport(writer, "LumixAPI", "setRotation", WASMType::VOID, WASMType::I32, WASMType::F32, WASMType::F32, WASMType::F32, WASMType::F32);
+		addImport(writer, "LumixAPI", "yawToDir", ScriptValueType::VEC3, WASMType::F32);
+		addImport(writer, "LumixAPI", "setPropertyI32", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::I32);
+		addImport(writer, "LumixAPI", "getPropertyI32", WASMType::I32, WASMType::I32, WASMType::I32);
+		addImport(writer, "LumixAPI", "setPropertyVec3", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::F32, WASMType::F32, WASMType::F32);
+		addImport(writer, "LumixAPI", "getPropertyVec3", ScriptValueType::VEC3, WASMType::I32, WASMType::I32);
+		addImport(writer, "LumixAPI", "setPropertyVec4", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::F32, WASMType::F32, WASMType::F32, WASMType::F32);
+		addImport(writer, "LumixAPI", "getPropertyVec4", ScriptValueType::VEC4, WASMType::I32, WASMType::I32);
+		// function index, entity, address of arguments
+		addImport(writer, "LumixAPI", "callFunction", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::I32);
+		// center, radius, property index, records address, records capacity
+		addImport(writer, "LumixAPI", "queryRadius", WASMType::I32, WASMType::F32, WASMType::F32, WASMType::F32, WASMType::F32, WASMType::I32, WASMType::I32, WASMType::I32);
+		// fused read-modify-writes, see getAddedDelta
+		addImport(writer, "LumixAPI", "addPropertyFloat", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::F32);
+		addImport(writer, "LumixAPI", "addPosition", WASMType::VOID, WASMType::I32, WASMType::F32, WASMType::F32, WASMType::F32);
+		// entity, timer id, seconds
+		addImport(writer, "LumixAPI", "scheduleTimer", WASMType::VOID, WASMType::I32, WASMType::I32, WASMType::F32);
+		addImport(writer, "LumixAPI", "setResumable", WASMType::VOID, WASMType::I32, WASMType::I32);
+
+		// host copies instance records here, as many as fit before scratch memory
+		writer.addMemory(MEMORY_PAGES);
+	}
+
+	// nodes linked, directly or not, to the export's entry node, or to any node a dispatch export dispatches to
+	// code generated for the export can not depend on other nodes
+	void getConnectedNodes(const WASMWriter::Function& func, Array<Node*>& nodes) const {
+		nodes.clear();
+		Array<bool> visited(m_allocator);
+		visited.resize(m_node_counter + 1);
+		for (bool& v : visited) v = false;
+		auto visit = [&](Node* n){
+			if (!n || n->m_id >= (u32)visited.size() || visited[n->m_id]) return;
+			visited[n->m_id] = true;
+			nodes.push(n);
+		};
+
+		const bool is_timer = func.node->getType() == Node::Type::DELAY || func.node->getType() == Node::Type::EVERY;
+		for (Node* n : m_nodes) {
+			if (n == func.node) visit(n);
+			else if (func.input_idx == DISPATCH_INPUT) {
+				const bool is_n_timer = n->getType() == Node::Type::DELAY || n->getType() == Node::Type::EVERY;
+				if (is_timer ? is_n_timer : isLatent(n)) visit(n);
+			}
+		}
+		for (u32 i = 0; i < (u32)nodes.size(); ++i) {
+			const u32 id = nodes[i]->m_id;
+			for (u32 link : getLinksFrom(id)) visit(getNode(m_links[link].getToNode()));
+			for (u32 link : getLinksTo(id)) visit(getNode(m_links[link].getFromNode()));
+		}
+		sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b){ return a->m_id < b->m_id; });
+	}
+
+	// everything code generated from `nodes` depends on, positions of nodes do not matter
+	void writeSignature(OutputMemoryStream& blob, const Array<Node*>& nodes) const {
+		blob.write(m_batch_update);
+		blob.write(m_profile_nodes);
+		blob.write(m_variables.size());
+		for (const Variable& var : m_variables) {
+			blob.writeString(var.name.c_str());
+			blob.write(var.type);
+		}
+		for (const Node* n : nodes) {
+			blob.write(n->getType());
+			blob.write(n->m_id);
+			n->serialize(blob);
+			for (u32 link : getLinksFrom(n->m_id)) {
+				blob.write(m_links[link].from);
+				blob.write(m_links[link].to);
+			}
+		}
+	}
+
+	// refreshes node errors like generate does, but generates code only for exports connected to nodes
+	// which changed since the last call, other exports keep their errors
+	void updateErrors() {
+		WASMWriter writer(m_allocator);
+		setupWriter(writer);
+		m_properties.clear();
+		m_functions.clear();
+		m_profiled_nodes.clear();
+		m_instance_local = U32_MAX;
+		inferTypes();
+
+		Array<ExportSignature> prev(static_cast<Array<ExportSignature>&&>(m_export_signatures));
+		Array<Node*> nodes(m_allocator);
+		Array<bool> connected(m_allocator);
+		connected.resize(m_node_counter + 1);
+		for (bool& c : connected) c = false;
+		OutputMemoryStream func_blob(m_allocator);
+
+		const u32 num_exports = writer.m_functions.size();
+		for (u32 i = 0; i < num_exports; ++i) {
+			getConnectedNodes(writer.m_functions[i], nodes);
+			for (Node* n : nodes) connected[n->m_id] = true;
+			ExportSignature& signature = m_export_signatures.emplace(m_allocator);
+			signature.name = writer.m_functions[i].name;
+			writeSignature(signature.signature, nodes);
+
+			const bool unchanged = prev.find([&](const ExportSignature& p){
+				return equalStrings(p.name.c_str(), signature.name.c_str())
+					&& p.signature.size() == signature.signature.size()
+					&& memcmp(p.signature.data(), signature.signature.data(), p.signature.size()) == 0;
+			}) >= 0;
+			if (unchanged) continue;
+
+			for (Node* n : nodes) n->clearError();
+			// the export and flow functions it adds
+			const u32 first_flow = writer.m_functions.size();
+			func_blob.clear();
+			generateFunction(func_blob, *this, writer, i);
+			for (u32 j = first_flow; j < (u32)writer.m_functions.size(); ++j) {
+				func_blob.clear();
+				generateFunction(func_blob, *this, writer, j);
+			}
+		}
+
+		// not generated at all, e.g. disconnected from all entry nodes
+		for (Node* n : m_nodes) {
+			if (n->m_id >= (u32)connected.size() || !connected[n->m_id]) n->clearError();
+		}
+		m_types_inferred = false;
+		m_output_types.clear();
+	}
+
+	// `native`, if not null, gets C++ equivalent of the generated bytecode, empty on failure
+	void generate(OutputMemoryStream& blob, OutputMemoryStream* native = nullptr) {
+		for (Node* node : m_nodes) {
+			node->clearError();
+		}
+
+		WASMWriter writer(m_allocator);
+		setupWriter(writer);
+
+		m_properties.clear();
+		m_functions.clear();
+		m_profiled_nodes.clear();
+		m_instance_local = U32_MAX;
+		OutputMemoryStream wasm(m_allocator);
+		inferTypes();
+		writer.write(wasm, *this);
+		m_types_inferred = false;
+		m_output_types.clear();
+		if (native && !writer.writeNative(*native, StableHash(wasm.data(), (u32)wasm.size()), m_path)) native->clear();
+
+		ScriptResource::Header header;
+		blob.write(header);
+		blob.write(writer.getStackSize());
+		blob.write(getInstanceSize());
+		blob.write(RESERVED_MEMORY);
+		blob.write(m_variables.size());
+		for (const Variable& var : m_variables) {
+			blob.writeString(var.name.c_str());
+			blob.write(var.type);
+			blob.write(getVariableOffset(u32(&var - m_variables.begin())));
+		}
+		blob.write(m_properties.size());
+		blob.write(m_properties.begin(), m_properties.byte_size());
+		blob.write(m_functions.size());
+		blob.write(m_functions.begin(), m_functions.byte_size());
+		blob.write(PROFILE_OFFSET);
+		blob.write(m_profiled_nodes.size());
+		blob.write(m_profiled_nodes.begin(), m_profiled_nodes.byte_size());
+		u32 num_timers = 0;
+		for (const Node* n : m_nodes) {
+			if (n->getType() == Node::Type::EVERY) ++num_timers;
+		}
+		blob.write(num_timers);
+		for (Node* n : m_nodes) {
+			if (n->getType() != Node::Type::EVERY) continue;
+			ScriptResource::Timer timer;
+			timer.id = n->m_id;
+			timer.interval = getTimerInterval(n);
+			blob.write(timer);
+		}
+		blob.write(m_update_policy);
+		blob.write(m_update_interval);
+		blob.write(wasm.data(), wasm.size());
+	}
+
+	// index of property in the compiled resource's property table, adds the property if it's not there yet
+	u32 getPropertyIndex(ComponentType cmp_type, const char* prop) const {
+		const StableHash hash = reflection::getPropertyHash(cmp_type, prop);
+		const i32 idx = m_properties.indexOf(hash);
+		if (idx >= 0) return idx;
+		m_properties.push(hash);
+		return m_properties.size() - 1;
+	}
+
+	// index of function in the compiled resource's function table, adds the function if it's not there yet
+	u32 getFunctionIndex(const reflection::ComponentBase& cmp, const reflection::FunctionBase& function) const {
+		const StableHash hash = getScriptFunctionHash(cmp.name, function.name);
+		const i32 idx = m_functions.indexOf(hash);
+		if (idx >= 0) return idx;
+		m_functions.push(hash);
+		return m_functions.size() - 1;
+	}
+
+	void clear() {
+		for (Node* n : m_nodes) {
+			LUMIX_DELETE(m_allocator, n);
+		}
+		m_nodes.clear();
+		m_links.clear();
+		invalidateIndex();
+		// nodes are created again and have no errors
+		m_export_signatures.clear();
+		m_variables.clear();
+		m_batch_update = false;
+		m_profile_nodes = false;
+		m_update_policy = ScriptUpdatePolicy::INTERVAL;
+		m_update_interval = 1;
+	}
+
+	bool deserialize(InputMemoryStream& blob) {
+		const u32 magic = blob.read<u32>();
+		if (magic != MAGIC) return false;
+		const Version version = blob.read<Version>();
+		if (version > Version::LAST) return false;
+		
+		blob.read(m_node_counter);
+		if (version > Version::BATCH_UPDATE) blob.read(m_batch_update);
+		if (version > Version::PROFILE_NODES) blob.read(m_profile_nodes);
+		if (version > Version::UPDATE_POLICY) {
+			blob.read(m_update_policy);
+			blob.read(m_update_interval);
+		}
+		const u32 var_count = blob.read<u32>();
+		m_variables.reserve(var_count);
+		for (u32 i = 0; i < var_count; ++i) {
+			Variable& var = m_variables.emplace(m_allocator);
+			var.name = blob.readString();
+			blob.read(var.type);
+		}
+
+		const u32 link_count = blob.read<u32>();
+		m_links.reserve(link_count);
+		for (u32 i = 0; i < link_count; ++i) {
+			NodeEditorLink& link = m_links.emplace();
+			blob.read(link);
+		}
+
+		const u32 node_count = blob.read<u32>();
+		m_nodes.reserve(node_count);
+		for (u32 i = 0; i < node_count; ++i) {
+			const Node::Type type = blob.read<Node::Type>();
+			Node* n = createNode(type);
+			blob.read(n->m_id);
+			blob.read(n->m_pos);
+			n->deserialize(blob);
+		}
+		invalidateIndex();
+		return true;
+	}
+
+	Node* createNode(Node::Type type);
+	static float getTimerInterval(Node* every_node);
+
+	void serialize(OutputMemoryStream& blob) {
+		blob.write(MAGIC);
+		blob.write(Version::LAST);
+		blob.write(m_node_counter);
+		blob.write(m_batch_update);
+		blob.write(m_profile_nodes);
+		blob.write(m_update_policy);
+		blob.write(m_update_interval);
+		
+		blob.write(m_variables.size());
+		for (const Variable& var : m_variables) {
+			blob.writeString(var.name.c_str());
+			blob.write(var.type);
+		}
+
+		blob.write(m_links.size());
+		for (const NodeEditorLink& link : m_links) {
+			blob.write(link);
 		}
 
 		blob.write(m_nodes.size());
@@ -594,6 +1926,7 @@ struct Graph {
 		Node* n = LUMIX_NEW(m_allocator, T)(static_cast<Args&&>(args)...);
 		n->m_id = ++m_node_counter;
 		m_nodes.push(n);
+		invalidateIndex();
 		return n;
 	}
 
@@ -605,490 +1938,1690 @@ struct Graph {
 			}	
 		}
 		m_nodes.erase(node);
+		invalidateIndex();
 	}
 
 	void removeLink(u32 link) {
 		m_links.erase(link);
+		invalidateIndex();
 	}
 
 	Node* getNode(u32 id) const {
-		const i32 idx = m_nodes.find([&](const Node* node){ return node->m_id == id; });
-		return idx < 0 ? nullptr : m_nodes[idx];
+		updateIndex();
+		auto iter = m_node_map.find(id);
+		return iter.isValid() ? iter.value() : nullptr;
+	}
+
+	// must be called when m_nodes or m_links change, the index is rebuilt on the next lookup
+	// adding or removing them is also detected by the index itself, since the node editor edits links directly
+	void invalidateIndex() const { m_index_dirty = true; }
+
+	// indices of links leaving the node, sorted by pin
+	Span<const u32> getLinksFrom(u32 node_id) const {
+		updateIndex();
+		auto iter = m_from_ranges.find(node_id);
+		if (!iter.isValid()) return Span<const u32>();
+		return Span<const u32>(m_links_by_from.begin() + iter.value().offset, iter.value().count);
+	}
+
+	// indices of links entering the node, sorted by pin
+	Span<const u32> getLinksTo(u32 node_id) const {
+		updateIndex();
+		auto iter = m_to_ranges.find(node_id);
+		if (!iter.isValid()) return Span<const u32>();
+		return Span<const u32>(m_links_by_to.begin() + iter.value().offset, iter.value().count);
+	}
+
+	struct LinkRange {
+		u32 offset;
+		u32 count;
+	};
+
+	void updateIndex() const {
+		if (!m_index_dirty && m_indexed_links == (u32)m_links.size() && m_indexed_nodes == (u32)m_nodes.size()) return;
+		m_index_dirty = false;
+		m_indexed_links = m_links.size();
+		m_indexed_nodes = m_nodes.size();
+
+		m_node_map.clear();
+		for (Node* n : m_nodes) m_node_map.insert(n->m_id, n);
+
+		// `key` maps a link to (node << 16) | pin, ties keep the order of m_links, so lookups find the same link as a linear scan
+		auto build = [&](Array<u32>& sorted, HashMap<u32, LinkRange>& ranges, auto key) {
+			sorted.resize(m_links.size());
+			for (u32 i = 0; i < (u32)sorted.size(); ++i) sorted[i] = i;
+			sort(sorted.begin(), sorted.end(), [&](u32 a, u32 b){
+				const u32 ka = key(m_links[a]);
+				const u32 kb = key(m_links[b]);
+				return ka != kb ? ka < kb : a < b;
+			});
+			ranges.clear();
+			for (u32 i = 0; i < (u32)sorted.size();) {
+				const u32 node = key(m_links[sorted[i]]) >> 16;
+				u32 end = i + 1;
+				while (end < (u32)sorted.size() && key(m_links[sorted[end]]) >> 16 == node) ++end;
+				ranges.insert(node, LinkRange{i, end - i});
+				i = end;
+			}
+		};
+		build(m_links_by_from, m_from_ranges, [](const NodeEditorLink& l){ return (l.getFromNode() << 16) | l.getFromPin(); });
+		build(m_links_by_to, m_to_ranges, [](const NodeEditorLink& l){ return (l.getToNode() << 16) | (l.to >> 16); });
 	}
 
 	IAllocator& m_allocator;
 	Array<Node*> m_nodes;
 	Array<NodeEditorLink> m_links;
 	Array<Variable> m_variables;
+	// filled during generate
+	mutable Array<StableHash> m_properties;
+	mutable Array<StableHash> m_functions;
+	// ids of nodes with execution counters, counter of m_profiled_nodes[i] is at PROFILE_OFFSET + i * 4
+	mutable Array<u32> m_profiled_nodes;
+	struct CachedOutput {
+		Node* node;
+		u32 output_idx;
+		u32 local;
+		bool valid = true;
+		Reads reads;
+	};
+
+	// local with the address of current instance record during generate, U32_MAX if the record is at 0
+	mutable u32 m_instance_local = U32_MAX;
+	// state of currently generated function
+	mutable u32 m_num_params = 0;
+	mutable Array<WASMType> m_locals;
+	mutable Array<CachedOutput> m_cache;
+	// resolved types of outputs while m_types_inferred, key is node id | (output index << 16)
+	mutable HashMap<u32, ScriptValueType> m_output_types;
+	mutable bool m_types_inferred = false;
+	// adjacency index, see updateIndex
+	mutable Array<u32> m_links_by_from;
+	mutable Array<u32> m_links_by_to;
+	mutable HashMap<u32, LinkRange> m_from_ranges;
+	mutable HashMap<u32, LinkRange> m_to_ranges;
+	mutable HashMap<u32, Node*> m_node_map;
+	mutable bool m_index_dirty = true;
+	mutable u32 m_indexed_links = 0;
+	mutable u32 m_indexed_nodes = 0;
+	// what exports depended on when updateErrors generated them last time
+	struct ExportSignature {
+		ExportSignature(IAllocator& allocator) : name(allocator), signature(allocator) {}
+		String name;
+		OutputMemoryStream signature;
+	};
+	Array<ExportSignature> m_export_signatures;
+	// everything written so far in current branch
+	mutable Reads m_written;
+	mutable u32 m_loop_depth = 0;
+	// writer and index of the function being generated
+	mutable WASMWriter* m_writer = nullptr;
+	mutable u32 m_function = 0;
+	// generate updateBatch instead of update
+	bool m_batch_update = false;
+	// flow nodes count their executions, see ScriptResource::m_profiled_nodes
+	bool m_profile_nodes = false;
+	// default for instances, see ScriptModule::setUpdatePolicy
+	ScriptUpdatePolicy m_update_policy = ScriptUpdatePolicy::INTERVAL;
+	u32 m_update_interval = 1;
 	Path m_path;
 
 	u32 m_node_counter = 0;
 };
 
 Node::NodeInput Node::getOutputNode(u32 idx, const Graph& graph) {
-	const i32 i = graph.m_links.find([&](NodeEditorLink& l){
-		return l.getFromNode() == m_id && l.getFromPin() == idx;
-	});
-	if (i == -1) return {nullptr, 0};
+	for (u32 i : graph.getLinksFrom(m_id)) {
+		if (graph.m_links[i].getFromPin() != idx) continue;
+		const u32 to = graph.m_links[i].to;
+		return { graph.getNode(to & 0x7fFF), to >> 16 };
+	}
+	return {nullptr, 0};
+}
 
-	const u32 to = graph.m_links[i].to;
-	return { graph.getNode(to & 0x7fFF), to >> 16 };
+static void writeConst(OutputMemoryStream& blob, const ConstValue& value) {
+	if (value.type == ScriptValueType::FLOAT) {
+		blob.write(WasmOp::F32_CONST);
+		blob.write(value.f);
+	}
+	else {
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, value.i);
+	}
 }
 
-Node::NodeOutput Node::getInputNode(u32 idx, const Graph& graph) {
-	const i32 i = graph.m_links.find([&](NodeEditorLink& l){
-		return l.to == (m_id | (idx << 16));
-	});
-	if (i == -1) return {nullptr, 0};
+// converts constants to their common type, see Graph::getCommonType, false if there is none
+static bool promoteConsts(ConstValue& a, ConstValue& b) {
+	ScriptValueType common;
+	if (!Graph::getCommonType(a.type, b.type, common)) return false;
+	if (common == ScriptValueType::FLOAT) {
+		if (a.type != ScriptValueType::FLOAT) a.f = (float)a.i;
+		if (b.type != ScriptValueType::FLOAT) b.f = (float)b.i;
+	}
+	a.type = b.type = common;
+	return true;
+}
 
-	const u32 from = graph.m_links[i].from;
-	return { graph.getNode(from & 0x7fFF), from >> 16 };
+// vec3 if any operand is vec3, otherwise common type of the operands
+static ScriptValueType getArithmeticType(Node& node, const Graph& graph) {
+	Node::NodeOutput n0 = node.getInputNode(0, graph);
+	Node::NodeOutput n1 = node.getInputNode(1, graph);
+	if (!n0) return ScriptValueType::I32;
+	const ScriptValueType t0 = graph.getType(n0);
+	if (!n1) return t0;
+	const ScriptValueType t1 = graph.getType(n1);
+	if (t0 == ScriptValueType::VEC3 || t1 == ScriptValueType::VEC3) return ScriptValueType::VEC3;
+	ScriptValueType common;
+	return Graph::getCommonType(t0, t1, common) ? common : t0;
 }
 
-template <auto T>
-struct CompareNode : Node {
-	CompareNode(IAllocator& allocator)
-		: Node(allocator)
-	{}
-	
-	Type getType() const override { return T; }
-	bool hasInputPins() const override { return true; }
-	bool hasOutputPins() const override { return true; }
+void Node::NodeInput::generate(OutputMemoryStream& blob, const Graph& graph) {
+	graph.generateFlow(blob, node, input_idx);
+}
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override {
-		NodeOutput n0 = getInputNode(0, graph);
-		if (n0) return n0.node->getOutputType(n0.output_idx, graph);
-		return ScriptValueType::I32;
+void Node::NodeOutput::generate(OutputMemoryStream& blob, const Graph& graph) {
+	ConstValue value;
+	if (node->evalConst(output_idx, graph, value)) {
+		writeConst(blob, value);
+		return;
+	}
+	graph.generateCached(blob, node, output_idx);
+}
+
+void Node::getReads(u32 output_idx, const Graph& graph, Reads& reads) {
+	for (u32 i : graph.getLinksTo(m_id)) {
+		const NodeEditorLink& link = graph.m_links[i];
+		Node* from = graph.getNode(link.from & 0x7fFF);
+		if (from) from->getReads(link.from >> 16, graph, reads);
+	}
+}
+
+u32 Graph::generateToLocals(OutputMemoryStream& blob, Node::NodeOutput output) const {
+	const ScriptValueType type = getType(output);
+	output.generate(blob, *this);
+	const u32 local = allocLocals(type);
+	generateSpill(blob, local, getComponentCount(type));
+	return local;
+}
+
+static void generateFunction(OutputMemoryStream& blob, const Graph& graph, WASMWriter& writer, u32 function_idx) {
+	const WASMWriter::Function& func = writer.m_functions[function_idx];
+	Node* node = func.node;
+	const u32 input_idx = func.input_idx;
+	const bool is_exported = func.is_exported;
+	graph.beginFunction(func.num_args);
+	graph.m_writer = &writer;
+	graph.m_function = function_idx;
+	graph.m_instance_local = func.instance_local;
+	
+	OutputMemoryStream body(graph.m_allocator);
+	// `func` can be invalidated from here, generated code can add functions
+	// dispatchers count the nodes they dispatch to
+	if (input_idx != DISPATCH_INPUT) graph.generateNodeCounter(body, node);
+	node->generate(body, graph, input_idx);
+	// entry nodes end their functions themselves
+	if (!is_exported) body.write(WasmOp::END);
+
+	writeLEB128(blob, graph.m_locals.size());
+	for (WASMType type : graph.m_locals) {
+		blob.write(u8(1));
+		blob.write(type);
+	}
+	blob.write(body.data(), body.size());
+}
+
+bool Node::evalInputConst(u32 idx, const Graph& graph, ConstValue& value) {
+	NodeOutput n = getInputNode(idx, graph);
+	return n && n.node->evalConst(n.output_idx, graph, value);
+}
+
+Node::NodeOutput Node::getInputNode(u32 idx, const Graph& graph) {
+	for (u32 i : graph.getLinksTo(m_id)) {
+		if (graph.m_links[i].to != (m_id | (idx << 16))) continue;
+		const u32 from = graph.m_links[i].from;
+		return { graph.getNode(from & 0x7fFF), from >> 16 };
+	}
+	return {nullptr, 0};
+}
+
+template <auto T>
+struct CompareNode : Node {
+	CompareNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	
+	Type getType() const override { return T; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	// the result is a boolean, whatever the operands are
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::I32; }
+
+	bool onGUI() override {
+		switch (T) {
+			case Type::GT: nodeTitle(">", false, false); break;
+			case Type::LT: nodeTitle("<", false, false); break;
+			case Type::GTE: nodeTitle(">=", false, false); break;
+			case Type::LTE: nodeTitle(">=", false, false); break;
+			case Type::EQ: nodeTitle("=", false, false); break;
+			case Type::NEQ: nodeTitle("<>", false, false); break;
+			default: ASSERT(false); break;
+		}
+		outputPin();
+		inputPin(); ImGui::TextUnformatted("A");
+		inputPin(); ImGui::TextUnformatted("B");
+		return false;
+	}
+
+	template <typename V>
+	static bool compare(V a, V b) {
+		switch (T) {
+			case Type::EQ: return a == b;
+			case Type::NEQ: return a != b;
+			case Type::LT: return a < b;
+			case Type::GT: return a > b;
+			case Type::GTE: return a >= b;
+			case Type::LTE: return a <= b;
+			default: ASSERT(false); return false;
+		}
+	}
+
+	bool evalConst(u32, const Graph& graph, ConstValue& value) override {
+		ConstValue a, b;
+		if (!evalInputConst(0, graph, a) || !evalInputConst(1, graph, b) || !promoteConsts(a, b)) return false;
+		value.type = ScriptValueType::I32;
+		value.i = a.type == ScriptValueType::FLOAT ? compare(a.f, b.f) : compare(a.i, b.i);
+		return true;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput a = getInputNode(0, graph);
+		NodeOutput b = getInputNode(1, graph);
+		if (!a || !b) {
+			m_error = "Missing input";
+			return;
+		}
+
+		ScriptValueType type;
+		if (!Graph::getCommonType(graph.getType(a), graph.getType(b), type) || getComponentCount(type) != 1) {
+			m_error = "Types do not match";
+			return;
+		}
+
+		graph.generateAs(blob, a, type);
+		graph.generateAs(blob, b, type);
+
+		if (type == ScriptValueType::FLOAT) {
+			switch (T) {
+				case Type::EQ: blob.write(WasmOp::F32_EQ); break;
+				case Type::NEQ: blob.write(WasmOp::F32_NEQ); break;
+				case Type::LT: blob.write(WasmOp::F32_LT); break;
+				case Type::GT: blob.write(WasmOp::F32_GT); break;
+				case Type::GTE: blob.write(WasmOp::F32_GE); break;
+				case Type::LTE: blob.write(WasmOp::F32_LE); break;
+				default: ASSERT(false); return;
+			}
+		}
+		else {
+			switch (T) {
+				case Type::EQ: blob.write(WasmOp::I32_EQ); break;
+				case Type::NEQ: blob.write(WasmOp::I32_NEQ); break;
+				case Type::LT: blob.write(WasmOp::I32_LT_S); break;
+				case Type::GT: blob.write(WasmOp::I32_GT_S); break;
+				case Type::GTE: blob.write(WasmOp::I32_GE_S); break;
+				case Type::LTE: blob.write(WasmOp::I32_LE_S); break;
+				default: ASSERT(false); break;
+			}
+		}
+	}
+};
+
+struct IfNode : Node {
+	IfNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	
+	Type getType() const override { return Type::IF; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	bool onGUI() override {
+		nodeTitle("If", false, false);
+		ImGui::BeginGroup();
+		flowInput(); ImGui::TextUnformatted(" ");
+		inputPin(); ImGui::TextUnformatted("Condition");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		ImGui::BeginGroup();
+		flowOutput(); ImGui::TextUnformatted("True");
+		flowOutput(); ImGui::TextUnformatted("False");
+		ImGui::EndGroup();
+		return false;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeInput true_branch = getOutputNode(0, graph);
+		NodeInput false_branch = getOutputNode(1, graph);
+		NodeOutput cond = getInputNode(1, graph);
+		if (!true_branch.node || !false_branch.node) {
+			m_error = "Missing outputs";
+			return;
+		}
+		if (!cond) {
+			m_error = "Missing condition";
+			return;
+		}
+
+		ConstValue const_cond;
+		if (cond.node->evalConst(cond.output_idx, graph, const_cond)) {
+			// only the taken branch is emitted
+			const bool is_true = const_cond.type == ScriptValueType::FLOAT ? const_cond.f != 0 : const_cond.i != 0;
+			if (is_true) true_branch.generate(blob, graph);
+			else false_branch.generate(blob, graph);
+			return;
+		}
+		
+		cond.generate(blob, graph);
+		blob.write(WasmOp::IF);
+		blob.write(u8(0x40)); // block type
+		graph.generateBranches(
+			[&](){ true_branch.generate(blob, graph); },
+			[&](){
+				blob.write(WasmOp::ELSE);
+				false_branch.generate(blob, graph);
+			});
+		blob.write(WasmOp::END);
+	}
+};
+
+struct SequenceNode : Node {
+	SequenceNode(Graph& graph)
+		: Node(graph.m_allocator)
+		, m_graph(graph) {}
+	Type getType() const override { return Type::SEQUENCE; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	bool onGUI() override {
+		flowInput(); ImGui::TextUnformatted(ICON_FA_LIST_OL);
+		ImGui::SameLine();
+		u32 count = 0;
+		for (u32 i : m_graph.getLinksFrom(m_id)) count = maximum(count, m_graph.m_links[i].getFromPin() + 1);
+		for (u32 i = 0; i < count; ++i) {
+			flowOutput();ImGui::NewLine();
+		}
+		flowOutput();ImGui::NewLine();
+		return false;
+	}
+	
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		for (u32 i = 0; ; ++i) {
+			NodeInput n = getOutputNode(i, graph);
+			if (!n.node) return;
+			n.generate(blob, graph);
+		}
+	}
+	Graph& m_graph;
+};
+
+struct SelfNode : Node {
+	SelfNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	Type getType() const override { return Type::SELF; }
+	bool hasInputPins() const override { return false; }
+	bool hasOutputPins() const override { return true; }
+	bool onGUI() override {
+		outputPin();
+		ImGui::TextUnformatted("Self");
+		return false;
+	}
+	
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::ENTITY; }
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		graph.generateSelf(blob);
+	}
+};
+
+struct CallNode : Node {
+	CallNode(IAllocator& allocator) : Node(allocator) {}
+	CallNode(reflection::ComponentBase* component, reflection::FunctionBase* function, IAllocator& allocator)
+		: Node(allocator)
+		, component(component)
+		, function(function)
+	{}
+
+	void deserialize(InputMemoryStream& blob) override {
+		const RuntimeHash cmp_name_hash = blob.read<RuntimeHash>();
+		const char* func_name = blob.readString();
+		const ComponentType cmp_type = reflection::getComponentTypeFromHash(cmp_name_hash);
+		component = reflection::getComponent(cmp_type);
+		if (component) {
+			const i32 fi = component->functions.find([&](reflection::FunctionBase* func){
+				return equalStrings(func->name, func_name);
+			});
+			if (fi < 0) {
+				logError("Function not found"); // TODO proper error
+			}
+			else {
+				function = component->functions[fi];
+			}
+		}
+		else {
+			logError("Component not found"); // TODO proper error
+		}
+	}
+
+	void serialize(OutputMemoryStream& blob) const override {
+		blob.write(RuntimeHash(component->name));
+		blob.writeString(function->name);
+	}
+
+
+	Type getType() const override { return Type::CALL; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	bool onGUI() override {
+		flowInput();
+		ImGui::Text("%s.%s", component->name, function->name);
+		ImGui::SameLine();
+		flowOutput();
+		ImGui::NewLine();
+		ScriptFunctionSignature signature;
+		getScriptFunctionSignature(*function, signature);
+		if (signature.takes_entity) {
+			inputPin(); ImGui::TextUnformatted("Entity");
+		}
+		for (u32 i = 0; i < signature.num_args; ++i) {
+			inputPin(); ImGui::Text("Input %d", i);
+		}
+		return false;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		if (!component || !function) {
+			m_error = "Function not found";
+			return;
+		}
+		ScriptFunctionSignature signature;
+		if (!getScriptFunctionSignature(*function, signature)) {
+			m_error = "Function has unsupported arguments";
+			return;
+		}
+		// pins match the function's parameters, the entity pin exists only if the function takes the entity
+		const u32 first_arg_pin = signature.takes_entity ? 2 : 1;
+		NodeOutput entity = signature.takes_entity ? getInputNode(1, graph) : NodeOutput{nullptr, 0};
+		if (signature.takes_entity && !entity) {
+			m_error = "Missing entity input";
+			return;
+		}
+
+		// arguments are marshalled through scratch memory, the host reads them according to the function's signature
+		u32 offset = Graph::SCRATCH_OFFSET;
+		for (u32 i = 0; i < signature.num_args; ++i) {
+			NodeOutput arg = getInputNode(i + first_arg_pin, graph);
+			if (!arg) {
+				m_error = "Missing inputs";
+				return;
+			}
+			if (!Graph::isConvertible(graph.getType(arg), signature.args[i])) {
+				m_error = "Input does not match function's argument type";
+				return;
+			}
+			graph.generateStore(blob, signature.args[i], offset
+				, [&](){
+					blob.write(WasmOp::I32_CONST);
+					writeLEB128(blob, 0);
+				}
+				, [&](){ graph.generateAs(blob, arg, signature.args[i]); });
+			offset += getComponentCount(signature.args[i]) * sizeof(i32);
+		}
+
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, graph.getFunctionIndex(*component, *function));
+		if (entity) {
+			entity.generate(blob, graph);
+		}
+		else {
+			// ignored by the host
+			blob.write(WasmOp::I32_CONST);
+			writeLEB128(blob, 0);
+		}
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, Graph::SCRATCH_OFFSET);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::CALL_FUNCTION);
+		// functions can change any property or transform
+		Reads written;
+		written.properties = ~u64(0);
+		written.transforms = true;
+		graph.invalidateCache(written);
+		generateNext(blob, graph);
+	}
+
+	const reflection::ComponentBase* component = nullptr;
+	const reflection::FunctionBase* function = nullptr;
+};
+
+struct SetYawNode : Node {
+	SetYawNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	Type getType() const override { return Type::SET_YAW; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	bool onGUI() override {
+		nodeTitle("Set entity yaw", true, true);
+		inputPin(); ImGui::TextUnformatted("Entity");
+		inputPin(); ImGui::TextUnformatted("Yaw");
+		return false;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput o1 = getInputNode(1, graph);
+		NodeOutput o2 = getInputNode(2, graph);
+		if (!o1 || !o2) {
+			m_error = "Missing inputs";
+			return;
+		}
+		
+		o1.generate(blob, graph);
+		o2.generate(blob, graph);
+
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::SET_YAW);
+		Reads written;
+		written.transforms = true;
+		graph.invalidateCache(written);
+		generateNext(blob, graph);
+	}
+};
+
+struct ConstNode : Node {
+	ConstNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	Type getType() const override { return Type::CONST; }
+	bool hasInputPins() const override { return false; }
+	bool hasOutputPins() const override { return true; }
+
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
+
+	void serialize(OutputMemoryStream& blob) const override { blob.write(m_value); }
+	void deserialize(InputMemoryStream& blob) override { blob.read(m_value); }
+
+	bool onGUI() override {
+		outputPin();
+		return ImGui::DragFloat("##v", &m_value);
+	}
+
+	bool evalConst(u32, const Graph&, ConstValue& value) override {
+		value.type = ScriptValueType::FLOAT;
+		value.f = m_value;
+		return true;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
+		blob.write(WasmOp::F32_CONST);
+		blob.write(m_value);
+	}
+
+	float m_value = 0;
+};
+
+struct SwitchNode : Node {
+	SwitchNode(IAllocator& allocator) : Node(allocator) {}
+	Type getType() const override { return Type::SWITCH; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	void serialize(OutputMemoryStream& blob) const override { blob.write(m_is_on); }
+	void deserialize(InputMemoryStream& blob) override { blob.read(m_is_on); }
+
+	bool onGUI() override {
+		nodeTitle("Switch", true, false);
+		flowOutput(); ImGui::TextUnformatted("On");
+		flowOutput(); ImGui::TextUnformatted("Off");
+		return ImGui::Checkbox("Is On", &m_is_on);
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
+		if (m_is_on) {
+			NodeInput n = getOutputNode(0, graph);
+			if (!n.node) return;
+			n.generate(blob, graph);
+		}
+		else {
+			NodeInput n = getOutputNode(1, graph);
+			if (!n.node) return;
+			n.generate(blob, graph);
+		}
+	}
+
+	bool m_is_on = true;
+};
+
+// repeats body for index in [from, to)
+struct ForNode : Node {
+	ForNode(IAllocator& allocator) : Node(allocator) {}
+	Type getType() const override { return Type::FOR; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::I32; }
+
+	bool onGUI() override {
+		nodeTitle("For", false, false);
+		ImGui::BeginGroup();
+		flowInput(); ImGui::TextUnformatted(" ");
+		inputPin(); ImGui::TextUnformatted("From");
+		inputPin(); ImGui::TextUnformatted("To");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		ImGui::BeginGroup();
+		flowOutput(); ImGui::TextUnformatted("Done");
+		flowOutput(); ImGui::TextUnformatted("Body");
+		outputPin(); ImGui::TextUnformatted("Index");
+		ImGui::EndGroup();
+		return false;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 pin_idx) override {
+		if (pin_idx != 0) {
+			if (m_index_local == U32_MAX) {
+				m_error = "Index is available only in the loop body";
+				return;
+			}
+			blob.write(WasmOp::LOCAL_GET);
+			writeLEB128(blob, m_index_local);
+			return;
+		}
+
+		NodeOutput from = getInputNode(1, graph);
+		NodeOutput to = getInputNode(2, graph);
+		if (!from || !to) {
+			m_error = "Missing inputs";
+			return;
+		}
+
+		if (!Graph::isNumber(graph.getType(from)) || !Graph::isNumber(graph.getType(to))) {
+			m_error = "From and to must be numbers";
+			return;
+		}
+
+		const u32 end = graph.allocLocal(WASMType::I32);
+		m_index_local = graph.allocLocal(WASMType::I32);
+		graph.generateAs(blob, from, ScriptValueType::I32);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, m_index_local);
+		graph.generateAs(blob, to, ScriptValueType::I32);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, end);
+
+		blob.write(WasmOp::BLOCK);
+		blob.write(u8(0x40)); // block type
+		blob.write(WasmOp::LOOP);
+		blob.write(u8(0x40)); // block type
+
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, m_index_local);
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, end);
+		blob.write(WasmOp::I32_GE_S);
+		blob.write(WasmOp::BR_IF);
+		blob.write(u8(1)); // block
+
+		graph.generateLoopBody(blob, [&](OutputMemoryStream& body){
+			NodeInput n = getOutputNode(1, graph);
+			if (n.node) n.generate(body, graph);
+		});
+
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, m_index_local);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, 1);
+		blob.write(WasmOp::I32_ADD);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, m_index_local);
+		blob.write(WasmOp::BR);
+		blob.write(u8(0)); // loop
+
+		blob.write(WasmOp::END); // loop
+		blob.write(WasmOp::END); // block
+		m_index_local = U32_MAX;
+
+		generateNext(blob, graph);
+	}
+
+	// local with the index while the loop body is generated
+	u32 m_index_local = U32_MAX;
+};
+
+// repeats body while condition is true, condition is evaluated before each iteration
+struct WhileNode : Node {
+	WhileNode(IAllocator& allocator) : Node(allocator) {}
+	Type getType() const override { return Type::WHILE; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	bool onGUI() override {
+		nodeTitle("While", false, false);
+		ImGui::BeginGroup();
+		flowInput(); ImGui::TextUnformatted(" ");
+		inputPin(); ImGui::TextUnformatted("Condition");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		ImGui::BeginGroup();
+		flowOutput(); ImGui::TextUnformatted("Done");
+		flowOutput(); ImGui::TextUnformatted("Body");
+		ImGui::EndGroup();
+		return false;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput cond = getInputNode(1, graph);
+		if (!cond) {
+			m_error = "Missing condition";
+			return;
+		}
+		if (!Graph::isNumber(graph.getType(cond))) {
+			m_error = "Condition must be a number";
+			return;
+		}
+
+		blob.write(WasmOp::BLOCK);
+		blob.write(u8(0x40)); // block type
+		blob.write(WasmOp::LOOP);
+		blob.write(u8(0x40)); // block type
+
+		// condition is a part of the body, since it reads what the body writes
+		graph.generateLoopBody(blob, [&](OutputMemoryStream& body){
+			graph.generateCondition(body, cond);
+			body.write(WasmOp::I32_EQZ);
+			body.write(WasmOp::BR_IF);
+			body.write(u8(1)); // block
+
+			NodeInput n = getOutputNode(1, graph);
+			if (n.node) n.generate(body, graph);
+		});
+
+		blob.write(WasmOp::BR);
+		blob.write(u8(0)); // loop
+		blob.write(WasmOp::END); // loop
+		blob.write(WasmOp::END); // block
+
+		generateNext(blob, graph);
+	}
+};
+
+// entry of flow started when a timer expires, timer id is node's id
+// all timers of a graph share single onTimer(timer id) export, generated by the first timer node
+struct TimerNode : Node {
+	TimerNode(IAllocator& allocator) : Node(allocator) {}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 pin_idx) override {
+		if (pin_idx == DISPATCH_INPUT) generateDispatch(blob, graph);
+		else schedule(blob, graph);
+	}
+
+	// code run when flow enters the node
+	virtual void schedule(OutputMemoryStream& blob, const Graph& graph) {}
+
+	static void generateDispatch(OutputMemoryStream& blob, const Graph& graph) {
+		for (Node* n : graph.m_nodes) {
+			if (n->getType() != Type::DELAY && n->getType() != Type::EVERY) continue;
+			TimerNode* timer = (TimerNode*)n;
+			NodeInput flow = timer->getOutputNode(0, graph);
+			if (!flow.node) continue;
+
+			blob.write(WasmOp::LOCAL_GET);
+			blob.write(u8(0));
+			blob.write(WasmOp::I32_CONST);
+			writeLEB128(blob, timer->m_id);
+			blob.write(WasmOp::I32_EQ);
+			blob.write(WasmOp::IF);
+			blob.write(u8(0x40)); // block type
+			graph.generateBranches(
+				[&](){
+					graph.generateNodeCounter(blob, timer);
+					flow.generate(blob, graph);
+				},
+				[](){});
+			blob.write(WasmOp::END);
+		}
+		blob.write(WasmOp::END);
+	}
+};
+
+// continues the flow after given number of seconds, each entry schedules a new timer
+struct DelayNode : TimerNode {
+	DelayNode(IAllocator& allocator) : TimerNode(allocator) {}
+	Type getType() const override { return Type::DELAY; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	bool onGUI() override {
+		nodeTitle("Delay", true, true);
+		inputPin(); ImGui::TextUnformatted("Seconds");
+		return false;
+	}
+
+	void schedule(OutputMemoryStream& blob, const Graph& graph) override {
+		NodeOutput seconds = getInputNode(1, graph);
+		if (!seconds) {
+			m_error = "Missing seconds";
+			return;
+		}
+		ScriptValueType type;
+		if (!Graph::getCommonType(graph.getType(seconds), ScriptValueType::FLOAT, type) || type != ScriptValueType::FLOAT) {
+			m_error = "Seconds must be a number";
+			return;
+		}
+
+		graph.generateSelf(blob);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, m_id);
+		graph.generateAs(blob, seconds, ScriptValueType::FLOAT);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::SCHEDULE_TIMER);
+	}
+};
+
+// runs the flow periodically, the timer is started by the host when the script is instantiated
+struct EveryNode : TimerNode {
+	EveryNode(IAllocator& allocator) : TimerNode(allocator) {}
+	Type getType() const override { return Type::EVERY; }
+	bool hasInputPins() const override { return false; }
+	bool hasOutputPins() const override { return true; }
+
+	void serialize(OutputMemoryStream& blob) const override { blob.write(m_interval); }
+	void deserialize(InputMemoryStream& blob) override { blob.read(m_interval); }
+
+	bool onGUI() override {
+		nodeTitle("Every", false, true);
+		ImGui::SetNextItemWidth(60);
+		return ImGui::DragFloat("seconds", &m_interval, 0.01f, 0.01f, 3600.f);
+	}
+
+	float m_interval = 1;
+};
+
+float Graph::getTimerInterval(Node* every_node) {
+	return ((EveryNode*)every_node)->m_interval;
+}
+
+// flow waits in the node until resume() reports the wait is over, the graph is not run again from its entry meanwhile
+// entering the node sets its state to waiting and makes the host call resume(time delta) each frame,
+// all latent nodes share single resume export, generated by the first latent node
+struct LatentNode : Node {
+	LatentNode(IAllocator& allocator) : Node(allocator) {}
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 pin_idx) override {
+		if (pin_idx == DISPATCH_INPUT) {
+			generateDispatch(blob, graph);
+			return;
+		}
+		if (!enter(blob, graph)) return;
+
+		graph.generateInstanceAddress(blob);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, 1);
+		blob.write(WasmOp::I32_STORE);
+		Graph::generateMemArg(blob, graph.getLatentOffset(this));
+		
+		generateSetResumable(blob, graph, true);
+	}
+
+	// stores live values the node needs while waiting, at getStateOffset, returns false on error
+	virtual bool enter(OutputMemoryStream& blob, const Graph& graph) { return true; }
+	// leaves nonzero i32 on the stack if the wait is over, time delta is local 0
+	virtual void resume(OutputMemoryStream& blob, const Graph& graph) = 0;
+
+	// offset of live values in the instance record
+	u32 getStateOffset(const Graph& graph, u32 component) const {
+		return graph.getLatentOffset(this) + (1 + component) * sizeof(i32);
+	}
+
+	static void generateSetResumable(OutputMemoryStream& blob, const Graph& graph, bool resumable) {
+		graph.generateSelf(blob);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, resumable ? 1 : 0);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::SET_RESUMABLE);
+	}
+
+	static void generateDispatch(OutputMemoryStream& blob, const Graph& graph) {
+		for (Node* n : graph.m_nodes) {
+			if (!Graph::isLatent(n)) continue;
+			LatentNode* node = (LatentNode*)n;
+			const u32 offset = graph.getLatentOffset(node);
+
+			graph.generateInstanceAddress(blob);
+			blob.write(WasmOp::I32_LOAD);
+			Graph::generateMemArg(blob, offset);
+			blob.write(WasmOp::IF);
+			blob.write(u8(0x40)); // block type
+			graph.generateBranches(
+				[&](){
+					node->resume(blob, graph);
+					blob.write(WasmOp::IF);
+					blob.write(u8(0x40)); // block type
+					graph.generateBranches(
+						[&](){
+							graph.generateInstanceAddress(blob);
+							blob.write(WasmOp::I32_CONST);
+							writeLEB128(blob, 0);
+							blob.write(WasmOp::I32_STORE);
+							Graph::generateMemArg(blob, offset);
+
+							graph.generateNodeCounter(blob, node);
+							node->generateNext(blob, graph);
+						},
+						[](){});
+					blob.write(WasmOp::END);
+				},
+				[](){});
+			blob.write(WasmOp::END);
+		}
+
+		// nothing waits anymore, flow continued from a latent node may have entered one again
+		bool first = true;
+		for (Node* n : graph.m_nodes) {
+			if (!Graph::isLatent(n)) continue;
+			graph.generateInstanceAddress(blob);
+			blob.write(WasmOp::I32_LOAD);
+			Graph::generateMemArg(blob, graph.getLatentOffset(n));
+			if (!first) blob.write(WasmOp::I32_OR);
+			first = false;
+		}
+		blob.write(WasmOp::I32_EQZ);
+		blob.write(WasmOp::IF);
+		blob.write(u8(0x40)); // block type
+		generateSetResumable(blob, graph, false);
+		blob.write(WasmOp::END);
+		blob.write(WasmOp::END);
+	}
+};
+
+// continues the flow once the condition is true, the condition is evaluated each frame
+struct WaitUntilNode : LatentNode {
+	WaitUntilNode(IAllocator& allocator) : LatentNode(allocator) {}
+	Type getType() const override { return Type::WAIT_UNTIL; }
+
+	bool onGUI() override {
+		nodeTitle("Wait until", true, true);
+		inputPin(); ImGui::TextUnformatted("Condition");
+		return false;
+	}
+
+	bool enter(OutputMemoryStream& blob, const Graph& graph) override {
+		if (getInputNode(1, graph)) return true;
+		m_error = "Missing condition";
+		return false;
+	}
+
+	void resume(OutputMemoryStream& blob, const Graph& graph) override {
+		NodeOutput cond = getInputNode(1, graph);
+		if (!cond) {
+			m_error = "Missing condition";
+			blob.write(WasmOp::I32_CONST);
+			writeLEB128(blob, 0);
+			return;
+		}
+		cond.generate(blob, graph);
 	}
+};
+
+// moves self to the target with constant speed, continues the flow once it's there
+// target and speed are evaluated when the flow enters the node
+struct MoveToNode : LatentNode {
+	MoveToNode(IAllocator& allocator) : LatentNode(allocator) {}
+	Type getType() const override { return Type::MOVE_TO; }
 
 	bool onGUI() override {
-		switch (T) {
-			case Type::GT: nodeTitle(">", false, false); break;
-			case Type::LT: nodeTitle("<", false, false); break;
-			case Type::GTE: nodeTitle(">=", false, false); break;
-			case Type::LTE: nodeTitle(">=", false, false); break;
-			case Type::EQ: nodeTitle("=", false, false); break;
-			case Type::NEQ: nodeTitle("<>", false, false); break;
-			default: ASSERT(false); break;
-		}
-		outputPin();
-		inputPin(); ImGui::TextUnformatted("A");
-		inputPin(); ImGui::TextUnformatted("B");
+		nodeTitle("Move to", true, true);
+		inputPin(); ImGui::TextUnformatted("Target");
+		inputPin(); ImGui::TextUnformatted("Speed");
 		return false;
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-		NodeOutput a = getInputNode(0, graph);
-		NodeOutput b = getInputNode(1, graph);
-		if (!a || !b) {
-			m_error = "Missing input";
-			return;
+	enum { TARGET = 0, SPEED = 3 };
+
+	bool enter(OutputMemoryStream& blob, const Graph& graph) override {
+		NodeOutput target = getInputNode(1, graph);
+		NodeOutput speed = getInputNode(2, graph);
+		if (!target || !speed) {
+			m_error = "Missing inputs";
+			return false;
+		}
+		if (graph.getType(target) != ScriptValueType::VEC3
+			|| graph.getType(speed) != ScriptValueType::FLOAT)
+		{
+			m_error = "Target must be vec3 and speed float";
+			return false;
 		}
 
-		a.generate(blob, graph);
-		b.generate(blob, graph);
+		auto address = [&](){ graph.generateInstanceAddress(blob); };
+		graph.generateStore(blob, ScriptValueType::VEC3, getStateOffset(graph, TARGET), address, [&](){ target.generate(blob, graph); });
+		graph.generateStore(blob, ScriptValueType::FLOAT, getStateOffset(graph, SPEED), address, [&](){ speed.generate(blob, graph); });
+		return true;
+	}
 
-		const ScriptValueType typeA = a.node->getOutputType(a.output_idx, graph);
-		const ScriptValueType typeB = b.node->getOutputType(b.output_idx, graph);
+	void generateLoadState(OutputMemoryStream& blob, const Graph& graph, u32 component) {
+		graph.generateInstanceAddress(blob);
+		blob.write(WasmOp::F32_LOAD);
+		Graph::generateMemArg(blob, getStateOffset(graph, component));
+	}
 
-		if (typeA != typeB) {
-			m_error = "Types do not match";
-			return;
+	void resume(OutputMemoryStream& blob, const Graph& graph) override {
+		// delta = target - position
+		graph.generateSelf(blob);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::GET_POSITION);
+		const u32 pos = graph.allocLocals(ScriptValueType::VEC3);
+		Graph::generateSpill(blob, pos, 3);
+		const u32 delta = graph.allocLocals(ScriptValueType::VEC3);
+		for (u32 i = 0; i < 3; ++i) {
+			generateLoadState(blob, graph, TARGET + i);
+			Graph::generateFill(blob, pos + i, 1);
+			blob.write(WasmOp::F32_SUB);
+			blob.write(WasmOp::LOCAL_SET);
+			writeLEB128(blob, delta + i);
 		}
 
-		if (typeA == ScriptValueType::FLOAT) {
-			switch (T) {
-				case Type::EQ: blob.write(WasmOp::F32_EQ); break;
-				case Type::NEQ: blob.write(WasmOp::F32_NEQ); break;
-				case Type::LT: blob.write(WasmOp::F32_LT); break;
-				case Type::GT: blob.write(WasmOp::F32_GT); break;
-				case Type::GTE: blob.write(WasmOp::F32_GE); break;
-				case Type::LTE: blob.write(WasmOp::F32_LE); break;
-				default: ASSERT(false); return;
-			}
+		const u32 dist = graph.allocLocal(WASMType::F32);
+		for (u32 i = 0; i < 3; ++i) {
+			Graph::generateFill(blob, delta + i, 1);
+			Graph::generateFill(blob, delta + i, 1);
+			blob.write(WasmOp::F32_MUL);
+			if (i > 0) blob.write(WasmOp::F32_ADD);
 		}
-		else {
-			switch (T) {
-				case Type::EQ: blob.write(WasmOp::I32_EQ); break;
-				case Type::NEQ: blob.write(WasmOp::I32_NEQ); break;
-				case Type::LT: blob.write(WasmOp::I32_LT_S); break;
-				case Type::GT: blob.write(WasmOp::I32_GT_S); break;
-				case Type::GTE: blob.write(WasmOp::I32_GE_S); break;
-				case Type::LTE: blob.write(WasmOp::I32_LE_S); break;
-				default: ASSERT(false); break;
-			}
+		blob.write(WasmOp::F32_SQRT);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, dist);
+
+		// step = speed * time delta
+		const u32 step = graph.allocLocal(WASMType::F32);
+		generateLoadState(blob, graph, SPEED);
+		blob.write(WasmOp::LOCAL_GET);
+		blob.write(u8(0));
+		blob.write(WasmOp::F32_MUL);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, step);
+
+		// the last step goes exactly to the target, also when it's already there and dist is 0
+		const u32 arrived = graph.allocLocal(WASMType::I32);
+		Graph::generateFill(blob, dist, 1);
+		Graph::generateFill(blob, step, 1);
+		blob.write(WasmOp::F32_LE);
+		blob.write(WasmOp::LOCAL_TEE);
+		writeLEB128(blob, arrived);
+		blob.write(WasmOp::IF);
+		blob.write(WASMType::F32); // block type
+		blob.write(WasmOp::F32_CONST);
+		blob.write(1.f);
+		blob.write(WasmOp::ELSE);
+		Graph::generateFill(blob, step, 1);
+		Graph::generateFill(blob, dist, 1);
+		blob.write(WasmOp::F32_DIV);
+		blob.write(WasmOp::END);
+		const u32 t = graph.allocLocal(WASMType::F32);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, t);
+
+		// position + delta * t
+		graph.generateSelf(blob);
+		for (u32 i = 0; i < 3; ++i) {
+			Graph::generateFill(blob, pos + i, 1);
+			Graph::generateFill(blob, delta + i, 1);
+			Graph::generateFill(blob, t, 1);
+			blob.write(WasmOp::F32_MUL);
+			blob.write(WasmOp::F32_ADD);
 		}
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::SET_POSITION);
+		Reads written;
+		written.transforms = true;
+		graph.invalidateCache(written);
+
+		Graph::generateFill(blob, arrived, 1);
 	}
 };
 
-struct IfNode : Node {
-	IfNode(IAllocator& allocator)
+struct KeyInputNode : Node {
+	KeyInputNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	
-	Type getType() const override { return Type::IF; }
-	bool hasInputPins() const override { return true; }
+	Type getType() const override { return Type::KEY_INPUT; }
+	bool hasInputPins() const override { return false; }
 	bool hasOutputPins() const override { return true; }
 
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::I32; }
+
 	bool onGUI() override {
-		nodeTitle("If", false, false);
-		ImGui::BeginGroup();
-		flowInput(); ImGui::TextUnformatted(" ");
-		inputPin(); ImGui::TextUnformatted("Condition");
-		ImGui::EndGroup();
-		ImGui::SameLine();
-		ImGui::BeginGroup();
-		flowOutput(); ImGui::TextUnformatted("True");
-		flowOutput(); ImGui::TextUnformatted("False");
-		ImGui::EndGroup();
+		nodeTitle(ICON_FA_KEY " Key input", false, true);
+		outputPin(); ImGui::TextUnformatted("Key");
 		return false;
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-		NodeInput true_branch = getOutputNode(0, graph);
-		NodeInput false_branch = getOutputNode(1, graph);
-		NodeOutput cond = getInputNode(1, graph);
-		if (!true_branch.node || !false_branch.node) {
-			m_error = "Missing outputs";
-			return;
-		}
-		if (!cond) {
-			m_error = "Missing condition";
-			return;
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
+		switch (output_idx) {
+			case 0: {
+				NodeInput o = getOutputNode(0, graph);
+				if(o.node) o.generate(blob, graph);
+				blob.write(WasmOp::END);
+				break;
+			}
+			case 1:
+				blob.write(WasmOp::LOCAL_GET);
+				blob.write(u8(0));
+				break;
+			default:
+				ASSERT(false);
+				break;
 		}
-		
-		cond.generate(blob, graph);
-		blob.write(WasmOp::IF);
-		blob.write(u8(0x40)); // block type
-		true_branch.generate(blob, graph);
-		blob.write(WasmOp::ELSE);
-		false_branch.generate(blob, graph);
-		blob.write(WasmOp::END);
 	}
 };
 
-struct SequenceNode : Node {
-	SequenceNode(Graph& graph)
-		: Node(graph.m_allocator)
-		, m_graph(graph) {}
-	Type getType() const override { return Type::SEQUENCE; }
-	bool hasInputPins() const override { return true; }
+struct MouseMoveNode : Node {
+	MouseMoveNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	Type getType() const override { return Type::MOUSE_MOVE; }
+	bool hasInputPins() const override { return false; }
 	bool hasOutputPins() const override { return true; }
 
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
+
+
 	bool onGUI() override {
-		flowInput(); ImGui::TextUnformatted(ICON_FA_LIST_OL);
-		ImGui::SameLine();
-		u32 count = 0;
-		for (const NodeEditorLink& link : m_graph.m_links) {
-			if (link.getFromNode() == m_id) count = maximum(count, link.getFromPin() + 1);
-		}
-		for (u32 i = 0; i < count; ++i) {
-			flowOutput();ImGui::NewLine();
-		}
-		flowOutput();ImGui::NewLine();
+		nodeTitle(ICON_FA_MOUSE " Mouse move", false, true);
+		outputPin(); ImGui::TextUnformatted("Delta X");
+		outputPin(); ImGui::TextUnformatted("Delta Y");
 		return false;
 	}
 	
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-		for (u32 i = 0; ; ++i) {
-			NodeInput n = getOutputNode(i, graph);
-			if (!n.node) return;
-			n.node->generate(blob, graph, 0);
+	
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
+		switch (output_idx) {
+			case 0: {
+				NodeInput o = getOutputNode(0, graph);
+				if(o.node) o.generate(blob, graph);
+				blob.write(WasmOp::END);
+				break;
+			}
+			case 1:
+				blob.write(WasmOp::LOCAL_GET);
+				blob.write(u8(0));
+				break;
+			case 2:
+				blob.write(WasmOp::LOCAL_GET);
+				blob.write(u8(1));
+				break;
+			default:
+				ASSERT(false);
+				break;
 		}
 	}
-	Graph& m_graph;
 };
 
-struct SelfNode : Node {
-	SelfNode(IAllocator& allocator)
+struct MouseButtonNode : Node {
+	MouseButtonNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::SELF; }
+	Type getType() const override { return Type::MOUSE_BUTTON; }
 	bool hasInputPins() const override { return false; }
 	bool hasOutputPins() const override { return true; }
+
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::I32; }
+
 	bool onGUI() override {
-		outputPin();
-		ImGui::TextUnformatted("Self");
+		nodeTitle(ICON_FA_MOUSE " Mouse button", false, true);
+		outputPin(); ImGui::TextUnformatted("Button");
+		outputPin(); ImGui::TextUnformatted("Is down");
 		return false;
 	}
-	
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::ENTITY; }
 
-	void generate(OutputMemoryStream& blob, const Graph&, u32) override {
-		blob.write(WasmOp::GLOBAL_GET);
-		writeLEB128(blob, (u32)WASMGlobals::SELF);
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
+		switch (output_idx) {
+			case 0: {
+				NodeInput o = getOutputNode(0, graph);
+				if(o.node) o.generate(blob, graph);
+				blob.write(WasmOp::END);
+				break;
+			}
+			case 1:
+				blob.write(WasmOp::LOCAL_GET);
+				blob.write(u8(0));
+				break;
+			case 2:
+				blob.write(WasmOp::LOCAL_GET);
+				blob.write(u8(1));
+				break;
+			default:
+				ASSERT(false);
+				break;
+		}
 	}
 };
 
-struct CallNode : Node {
-	CallNode(IAllocator& allocator) : Node(allocator) {}
-	CallNode(reflection::ComponentBase* component, reflection::FunctionBase* function, IAllocator& allocator)
+struct Vec3Node : Node {
+	Vec3Node(IAllocator& allocator)
 		: Node(allocator)
-		, component(component)
-		, function(function)
 	{}
+	Type getType() const override { return Type::VEC3; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
 
-	void deserialize(InputMemoryStream& blob) override {
-		const RuntimeHash cmp_name_hash = blob.read<RuntimeHash>();
-		const char* func_name = blob.readString();
-		const ComponentType cmp_type = reflection::getComponentTypeFromHash(cmp_name_hash);
-		component = reflection::getComponent(cmp_type);
-		if (component) {
-			const i32 fi = component->functions.find([&](reflection::FunctionBase* func){
-				return equalStrings(func->name, func_name);
-			});
-			if (fi < 0) {
-				logError("Function not found"); // TODO proper error
-			}
-			else {
-				function = component->functions[fi];
-			}
-		}
-		else {
-			logError("Component not found"); // TODO proper error
-		}
-	}
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::VEC3; }
 
-	void serialize(OutputMemoryStream& blob) const override {
-		blob.write(RuntimeHash(component->name));
-		blob.writeString(function->name);
+	bool onGUI() override {
+		ImGui::BeginGroup();
+		inputPin(); ImGui::TextUnformatted("X");
+		inputPin(); ImGui::TextUnformatted("Y");
+		inputPin(); ImGui::TextUnformatted("Z");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		outputPin();
+		return false;
 	}
 
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput x = getInputNode(0, graph);
+		NodeOutput y = getInputNode(1, graph);
+		NodeOutput z = getInputNode(2, graph);
+		if (!x || !y || !z) {
+			m_error = "Missing inputs";
+			return;
+		}
+		x.generate(blob, graph);
+		y.generate(blob, graph);
+		z.generate(blob, graph);
+	}
+};
 
-	Type getType() const override { return Type::CALL; }
+struct SplitVec3Node : Node {
+	SplitVec3Node(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	Type getType() const override { return Type::SPLIT_VEC3; }
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
+
+	// each connected output evaluates the input
+	u32 getInputUses(u32 input_idx, const Graph& graph) override {
+		return maximum(graph.getLinksFrom(m_id).length(), 1u);
+	}
+
 	bool onGUI() override {
-		flowInput();
-		ImGui::Text("%s.%s", component->name, function->name);
-		ImGui::SameLine();
-		flowOutput();
-		ImGui::NewLine();
-		for (u32 i = 0; i < function->getArgCount(); ++i) {
-			inputPin(); ImGui::Text("Input %d", i);
-		}
+		inputPin();
+		ImGui::SameLine();
+		ImGui::BeginGroup();
+		outputPin(); ImGui::TextUnformatted("X");
+		outputPin(); ImGui::TextUnformatted("Y");
+		outputPin(); ImGui::TextUnformatted("Z");
+		ImGui::EndGroup();
 		return false;
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-#if 0 // TODO
-		kvm_bc_const(&blob, (kvm_u32)ScriptSyscalls::CALL_CMP_METHOD);
-		kvm_bc_const64(&blob, RuntimeHash(component->name).getHashValue());
-		kvm_bc_const64(&blob, RuntimeHash(function->name).getHashValue());
-		ASSERT(function->getArgCount() == 0);
-		kvm_bc_syscall(&blob, 5);
-#endif
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
+		NodeOutput v = getInputNode(0, graph);
+		if (!v) {
+			m_error = "Missing inputs";
+			return;
+		}
+		const u32 local = graph.generateToLocals(blob, v);
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, local + output_idx);
 	}
-
-	const reflection::ComponentBase* component = nullptr;
-	const reflection::FunctionBase* function = nullptr;
 };
 
-struct SetYawNode : Node {
-	SetYawNode(IAllocator& allocator)
+struct YawToDirNode : Node {
+	YawToDirNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::SET_YAW; }
+	Type getType() const override { return Type::YAW_TO_DIR; }
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::VEC3; }
+
 	bool onGUI() override {
-		nodeTitle("Set entity yaw", true, true);
-		inputPin(); ImGui::TextUnformatted("Entity");
-		inputPin(); ImGui::TextUnformatted("Yaw");
+		inputPin(); ImGui::TextUnformatted("Yaw to dir");
+		ImGui::SameLine();
+		outputPin();
 		return false;
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-		NodeOutput o1 = getInputNode(1, graph);
-		NodeOutput o2 = getInputNode(2, graph);
-		if (!o1 || !o2) {
+		NodeOutput yaw = getInputNode(0, graph);
+		if (!yaw) {
 			m_error = "Missing inputs";
 			return;
 		}
-		
-		o1.generate(blob, graph);
-		o2.generate(blob, graph);
-
+		yaw.generate(blob, graph);
 		blob.write(WasmOp::CALL);
-		writeLEB128(blob, (u32)WASMLumixAPI::SET_YAW);
-		generateNext(blob, graph);
+		writeLEB128(blob, (u32)WASMLumixAPI::YAW_TO_DIR);
 	}
 };
 
-struct ConstNode : Node {
-	ConstNode(IAllocator& allocator)
+// pushes components of cross product of two vec3 stored in locals
+static void generateCross(OutputMemoryStream& blob, u32 a, u32 b) {
+	auto mulSub = [&](u32 i, u32 j){
+		// a[i] * b[j] - a[j] * b[i]
+		Graph::generateFill(blob, a + i, 1);
+		Graph::generateFill(blob, b + j, 1);
+		blob.write(WasmOp::F32_MUL);
+		Graph::generateFill(blob, a + j, 1);
+		Graph::generateFill(blob, b + i, 1);
+		blob.write(WasmOp::F32_MUL);
+		blob.write(WasmOp::F32_SUB);
+	};
+	mulSub(1, 2);
+	mulSub(2, 0);
+	mulSub(0, 1);
+}
+
+static void generateDot(OutputMemoryStream& blob, u32 a, u32 b) {
+	for (u32 i = 0; i < 3; ++i) {
+		Graph::generateFill(blob, a + i, 1);
+		Graph::generateFill(blob, b + i, 1);
+		blob.write(WasmOp::F32_MUL);
+		if (i > 0) blob.write(WasmOp::F32_ADD);
+	}
+}
+
+// vector math nodes with two vec3 inputs
+template <Node::Type T>
+struct Vec3BinaryNode : Node {
+	Vec3BinaryNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::CONST; }
-	bool hasInputPins() const override { return false; }
+	Type getType() const override { return T; }
+	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override {
+		return T == Type::DOT ? ScriptValueType::FLOAT : ScriptValueType::VEC3;
+	}
 
-	void serialize(OutputMemoryStream& blob) const override { blob.write(m_value); }
-	void deserialize(InputMemoryStream& blob) override { blob.read(m_value); }
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput n0 = getInputNode(0, graph);
+		NodeOutput n1 = getInputNode(1, graph);
+		if (!n0 || !n1) {
+			m_error = "Missing inputs";
+			return;
+		}
 
-	bool onGUI() override {
-		outputPin();
-		return ImGui::DragFloat("##v", &m_value);
+		const u32 a = graph.generateToLocals(blob, n0);
+		const u32 b = graph.generateToLocals(blob, n1);
+		if (T == Type::DOT) generateDot(blob, a, b);
+		else generateCross(blob, a, b);
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
-		blob.write(WasmOp::F32_CONST);
-		blob.write(m_value);
-	}
+	bool onGUI() override {
+		ImGui::BeginGroup();
+		inputPin(); ImGui::NewLine();
+		inputPin(); ImGui::NewLine();
+		ImGui::EndGroup();
 
-	float m_value = 0;
+		ImGui::SameLine();
+		ImGui::TextUnformatted(T == Type::DOT ? "Dot" : "Cross");
+
+		ImGui::SameLine();
+		outputPin();
+		return false;
+	}
 };
 
-struct SwitchNode : Node {
-	SwitchNode(IAllocator& allocator) : Node(allocator) {}
-	Type getType() const override { return Type::SWITCH; }
+struct NormalizeNode : Node {
+	NormalizeNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+	Type getType() const override { return Type::NORMALIZE; }
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
-	void serialize(OutputMemoryStream& blob) const override { blob.write(m_is_on); }
-	void deserialize(InputMemoryStream& blob) override { blob.read(m_is_on); }
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::VEC3; }
 
 	bool onGUI() override {
-		nodeTitle("Switch", true, false);
-		flowOutput(); ImGui::TextUnformatted("On");
-		flowOutput(); ImGui::TextUnformatted("Off");
-		return ImGui::Checkbox("Is On", &m_is_on);
+		inputPin(); ImGui::TextUnformatted("Normalize");
+		ImGui::SameLine();
+		outputPin();
+		return false;
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
-		if (m_is_on) {
-			NodeInput n = getOutputNode(0, graph);
-			if (!n.node) return;
-			n.node->generate(blob, graph, n.input_idx);
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput n0 = getInputNode(0, graph);
+		if (!n0) {
+			m_error = "Missing inputs";
+			return;
 		}
-		else {
-			NodeInput n = getOutputNode(1, graph);
-			if (!n.node) return;
-			n.node->generate(blob, graph, n.input_idx);
+
+		const u32 v = graph.generateToLocals(blob, n0);
+		// one division, zero vector ends up as NaNs like Vec3::normalized
+		blob.write(WasmOp::F32_CONST);
+		blob.write(1.f);
+		generateDot(blob, v, v);
+		blob.write(WasmOp::F32_SQRT);
+		blob.write(WasmOp::F32_DIV);
+		const u32 inv_len = graph.allocLocal(WASMType::F32);
+		Graph::generateSpill(blob, inv_len, 1);
+		for (u32 i = 0; i < 3; ++i) {
+			Graph::generateFill(blob, v + i, 1);
+			Graph::generateFill(blob, inv_len, 1);
+			blob.write(WasmOp::F32_MUL);
 		}
 	}
-
-	bool m_is_on = true;
 };
 
-struct KeyInputNode : Node {
-	KeyInputNode(IAllocator& allocator)
+struct LerpNode : Node {
+	LerpNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::KEY_INPUT; }
-	bool hasInputPins() const override { return false; }
+	Type getType() const override { return Type::LERP; }
+	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::I32; }
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::VEC3; }
 
 	bool onGUI() override {
-		nodeTitle(ICON_FA_KEY " Key input", false, true);
-		outputPin(); ImGui::TextUnformatted("Key");
+		ImGui::BeginGroup();
+		inputPin(); ImGui::TextUnformatted("A");
+		inputPin(); ImGui::TextUnformatted("B");
+		inputPin(); ImGui::TextUnformatted("T");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		ImGui::TextUnformatted("Lerp");
+		ImGui::SameLine();
+		outputPin();
 		return false;
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
-		switch (output_idx) {
-			case 0: {
-				blob.write(u8(0)); // num locals
-				NodeInput o = getOutputNode(0, graph);
-				if(o.node) o.node->generate(blob, graph, o.input_idx);
-				blob.write(WasmOp::END);
-			}
-			case 1:
-				blob.write(WasmOp::LOCAL_GET);
-				blob.write(u8(0));
-				break;
-			default:
-				ASSERT(false);
-				break;
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput n0 = getInputNode(0, graph);
+		NodeOutput n1 = getInputNode(1, graph);
+		NodeOutput n2 = getInputNode(2, graph);
+		if (!n0 || !n1 || !n2) {
+			m_error = "Missing inputs";
+			return;
+		}
+
+		const u32 a = graph.generateToLocals(blob, n0);
+		const u32 b = graph.generateToLocals(blob, n1);
+		const u32 t = graph.generateToLocals(blob, n2);
+		// a + (b - a) * t
+		for (u32 i = 0; i < 3; ++i) {
+			Graph::generateFill(blob, a + i, 1);
+			Graph::generateFill(blob, b + i, 1);
+			Graph::generateFill(blob, a + i, 1);
+			blob.write(WasmOp::F32_SUB);
+			Graph::generateFill(blob, t, 1);
+			blob.write(WasmOp::F32_MUL);
+			blob.write(WasmOp::F32_ADD);
 		}
 	}
 };
 
-struct MouseMoveNode : Node {
-	MouseMoveNode(IAllocator& allocator)
+// rotates vector by quaternion
+struct RotateNode : Node {
+	RotateNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::MOUSE_MOVE; }
-	bool hasInputPins() const override { return false; }
+	Type getType() const override { return Type::ROTATE; }
+	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
-
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::VEC3; }
 
 	bool onGUI() override {
-		nodeTitle(ICON_FA_MOUSE " Mouse move", false, true);
-		outputPin(); ImGui::TextUnformatted("Delta X");
-		outputPin(); ImGui::TextUnformatted("Delta Y");
+		ImGui::BeginGroup();
+		inputPin(); ImGui::TextUnformatted("Rotation");
+		inputPin(); ImGui::TextUnformatted("Vector");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		outputPin();
 		return false;
 	}
-	
-	
-	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
-		switch (output_idx) {
-			case 0: {
-				blob.write(u8(0)); // num locals
-				NodeInput o = getOutputNode(0, graph);
-				if(o.node) o.node->generate(blob, graph, o.input_idx);
-				blob.write(WasmOp::END);
-			}
-			case 1:
-				blob.write(WasmOp::LOCAL_GET);
-				blob.write(u8(0));
-				break;
-			case 2:
-				blob.write(WasmOp::LOCAL_GET);
-				blob.write(u8(1));
-				break;
-			default:
-				ASSERT(false);
-				break;
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput n0 = getInputNode(0, graph);
+		NodeOutput n1 = getInputNode(1, graph);
+		if (!n0 || !n1) {
+			m_error = "Missing inputs";
+			return;
+		}
+
+		// t = 2 * cross(q.xyz, v); v + q.w * t + cross(q.xyz, t)
+		const u32 q = graph.generateToLocals(blob, n0);
+		const u32 v = graph.generateToLocals(blob, n1);
+		generateCross(blob, q, v);
+		const u32 t = graph.allocLocals(ScriptValueType::VEC3);
+		Graph::generateSpill(blob, t, 3);
+		for (u32 i = 0; i < 3; ++i) {
+			Graph::generateFill(blob, t + i, 1);
+			Graph::generateFill(blob, t + i, 1);
+			blob.write(WasmOp::F32_ADD);
+			blob.write(WasmOp::LOCAL_SET);
+			writeLEB128(blob, t + i);
+		}
+		generateCross(blob, q, t);
+		const u32 c = graph.allocLocals(ScriptValueType::VEC3);
+		Graph::generateSpill(blob, c, 3);
+		for (u32 i = 0; i < 3; ++i) {
+			Graph::generateFill(blob, v + i, 1);
+			Graph::generateFill(blob, q + 3, 1);
+			Graph::generateFill(blob, t + i, 1);
+			blob.write(WasmOp::F32_MUL);
+			blob.write(WasmOp::F32_ADD);
+			Graph::generateFill(blob, c + i, 1);
+			blob.write(WasmOp::F32_ADD);
 		}
 	}
 };
 
-struct Vec3Node : Node {
-	Vec3Node(IAllocator& allocator)
+// returns `delta` if `value` is `read + delta` and `read` is accepted by `is_read` and reads from `entity`,
+// so the node writing `value` to `entity` can emit a single fused host call instead of the read and the write
+template <typename F>
+static Node::NodeOutput getAddedDelta(Node::NodeOutput value, Node::NodeOutput entity, const Graph& graph, F is_read) {
+	if (!value || !entity || value.node->getType() != Node::Type::ADD) return {nullptr, 0};
+	for (u32 i = 0; i < 2; ++i) {
+		const Node::NodeOutput read = value.node->getInputNode(i, graph);
+		if (!read || !is_read(read.node)) continue;
+		const Node::NodeOutput read_entity = read.node->getInputNode(0, graph);
+		if (read_entity.node != entity.node || read_entity.output_idx != entity.output_idx) continue;
+		return value.node->getInputNode(1 - i, graph);
+	}
+	return {nullptr, 0};
+}
+
+// position or rotation of an entity, moved in one host call
+template <bool IS_POSITION>
+struct GetTransformNode : Node {
+	GetTransformNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::VEC3; }
+	Type getType() const override { return IS_POSITION ? Type::GET_POSITION : Type::GET_ROTATION; }
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override {
+		return IS_POSITION ? ScriptValueType::VEC3 : ScriptValueType::QUAT;
+	}
+
+	void getReads(u32 output_idx, const Graph& graph, Reads& reads) override {
+		Node::getReads(output_idx, graph, reads);
+		reads.transforms = true;
+	}
+
 	bool onGUI() override {
-		ImGui::BeginGroup();
-		inputPin(); ImGui::TextUnformatted("X");
-		inputPin(); ImGui::TextUnformatted("Y");
-		inputPin(); ImGui::TextUnformatted("Z");
-		ImGui::EndGroup();
+		inputPin(); ImGui::TextUnformatted(IS_POSITION ? "Get position" : "Get rotation");
 		ImGui::SameLine();
 		outputPin();
 		return false;
 	}
-	void generate(OutputMemoryStream& blob, const Graph&, u32) override {}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput entity = getInputNode(0, graph);
+		if (!entity) {
+			m_error = "Missing inputs";
+			return;
+		}
+		entity.generate(blob, graph);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, u32(IS_POSITION ? WASMLumixAPI::GET_POSITION : WASMLumixAPI::GET_ROTATION));
+	}
 };
 
-struct YawToDirNode : Node {
-	YawToDirNode(IAllocator& allocator)
+template <bool IS_POSITION>
+struct SetTransformNode : Node {
+	SetTransformNode(IAllocator& allocator)
 		: Node(allocator)
 	{}
-	Type getType() const override { return Type::YAW_TO_DIR; }
+	Type getType() const override { return IS_POSITION ? Type::SET_POSITION : Type::SET_ROTATION; }
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
 	bool onGUI() override {
-		inputPin(); ImGui::TextUnformatted("Yaw to dir");
-		ImGui::SameLine();
-		outputPin();
+		nodeTitle(IS_POSITION ? "Set position" : "Set rotation", true, true);
+		inputPin(); ImGui::TextUnformatted("Entity");
+		inputPin(); ImGui::TextUnformatted(IS_POSITION ? "Position" : "Rotation");
 		return false;
 	}
 
-	void generate(OutputMemoryStream& blob, const Graph&, u32) override {}
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
+		NodeOutput entity = getInputNode(1, graph);
+		NodeOutput value = getInputNode(2, graph);
+		if (!entity || !value) {
+			m_error = "Missing inputs";
+			return;
+		}
+		
+		entity.generate(blob, graph);
+		NodeOutput delta = {nullptr, 0};
+		if (IS_POSITION) {
+			delta = getAddedDelta(value, entity, graph, [](Node* n){ return n->getType() == Type::GET_POSITION; });
+			if (delta && graph.getType(delta) != ScriptValueType::VEC3) delta = {nullptr, 0};
+		}
+		if (delta) {
+			delta.generate(blob, graph);
+			blob.write(WasmOp::CALL);
+			writeLEB128(blob, u32(WASMLumixAPI::ADD_POSITION));
+		}
+		else {
+			value.generate(blob, graph);
+			blob.write(WasmOp::CALL);
+			writeLEB128(blob, u32(IS_POSITION ? WASMLumixAPI::SET_POSITION : WASMLumixAPI::SET_ROTATION));
+		}
+		Reads written;
+		written.transforms = true;
+		graph.invalidateCache(written);
+		generateNext(blob, graph);
+	}
 };
 
 struct StartNode : Node {
@@ -1106,9 +3639,8 @@ struct StartNode : Node {
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32 pin_idx) override {
-		blob.write(u8(0)); // num locals
 		NodeInput o = getOutputNode(0, graph);
-		if(o.node) o.node->generate(blob, graph, o.input_idx);
+		if(o.node) o.generate(blob, graph);
 		blob.write(WasmOp::END);
 	}
 };
@@ -1131,18 +3663,92 @@ struct UpdateNode : Node {
 	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32 pin_idx) override {
-		if (pin_idx == 0) {
-			blob.write(u8(0)); // num locals
-			NodeInput o = getOutputNode(0, graph);
-			if(o.node) o.node->generate(blob, graph, o.input_idx);
-			blob.write(WasmOp::END);
-		}
-		else {
+		if (pin_idx != 0) {
 			blob.write(WasmOp::LOCAL_GET);
 			blob.write(u8(0));
+			return;
 		}
+
+		if (graph.m_batch_update) {
+			generateBatch(blob, graph);
+			return;
+		}
+
+		NodeInput o = getOutputNode(0, graph);
+		if(o.node) o.generate(blob, graph);
+		blob.write(WasmOp::END);
+	}
+
+	// updateBatch(time_delta, ptr, count) runs the update flow for `count` instance records starting at `ptr`
+	void generateBatch(OutputMemoryStream& blob, const Graph& graph) {
+		enum : u8 { TIME_DELTA, PTR, COUNT };
+		const u32 record_size = graph.getInstanceSize();
+		const u32 end_ptr = graph.allocLocal(WASMType::I32);
+		
+		blob.write(WasmOp::LOCAL_GET);
+		blob.write(PTR);
+		blob.write(WasmOp::LOCAL_GET);
+		blob.write(COUNT);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, record_size);
+		blob.write(WasmOp::I32_MUL);
+		blob.write(WasmOp::I32_ADD);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, end_ptr);
+
+		blob.write(WasmOp::BLOCK);
+		blob.write(u8(0x40)); // block type
+		blob.write(WasmOp::LOOP);
+		blob.write(u8(0x40)); // block type
+		
+		blob.write(WasmOp::LOCAL_GET);
+		blob.write(PTR);
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, end_ptr);
+		blob.write(WasmOp::I32_GE_U);
+		blob.write(WasmOp::BR_IF);
+		blob.write(u8(1)); // out of block
+
+		graph.m_instance_local = PTR;
+		NodeInput o = getOutputNode(0, graph);
+		if(o.node) o.generate(blob, graph);
+		graph.m_instance_local = U32_MAX;
+
+		blob.write(WasmOp::LOCAL_GET);
+		blob.write(PTR);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, record_size);
+		blob.write(WasmOp::I32_ADD);
+		blob.write(WasmOp::LOCAL_SET);
+		blob.write(PTR);
+		blob.write(WasmOp::BR);
+		blob.write(u8(0)); // loop
+		
+		blob.write(WasmOp::END); // loop
+		blob.write(WasmOp::END); // block
+		blob.write(WasmOp::END);
+	}
+};
+
+// `op` applied to each component of vec3 `a` and vec3 `b`, or scalar `b` if `scalar_b`
+// scalar `b` is converted to f32, i32 is the only other type it can have
+static void generateComponentwise(OutputMemoryStream& blob, const Graph& graph, Node::NodeOutput a, Node::NodeOutput b, WasmOp op, bool scalar_b) {
+	const u32 la = graph.generateToLocals(blob, a);
+	u32 lb;
+	if (scalar_b) {
+		graph.generateAs(blob, b, ScriptValueType::FLOAT);
+		lb = graph.allocLocals(ScriptValueType::FLOAT);
+		Graph::generateSpill(blob, lb, 1);
+	}
+	else {
+		lb = graph.generateToLocals(blob, b);
+	}
+	for (u32 i = 0; i < 3; ++i) {
+		Graph::generateFill(blob, la + i, 1);
+		Graph::generateFill(blob, scalar_b ? lb : lb + i, 1);
+		blob.write(op);
 	}
-};
+}
 
 struct MulNode : Node {
 	MulNode(IAllocator& allocator)
@@ -1152,10 +3758,18 @@ struct MulNode : Node {
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override{ 
-		NodeOutput n0 = getInputNode(0, graph);
-		if (!n0) return ScriptValueType::I32;
-		return n0.node->getOutputType(n0.output_idx, graph);
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return getArithmeticType(*this, graph); }
+
+	bool evalConst(u32, const Graph& graph, ConstValue& value) override {
+		// vec3 results are not constants, even if the scalar operand is
+		if (getArithmeticType(*this, graph) == ScriptValueType::VEC3) return false;
+		ConstValue a, b;
+		if (!evalInputConst(0, graph, a) || !evalInputConst(1, graph, b) || !promoteConsts(a, b)) return false;
+		value.type = a.type;
+		// wraps around like i32.mul
+		if (a.type == ScriptValueType::FLOAT) value.f = a.f * b.f;
+		else value.i = i32(u32(a.i) * u32(b.i));
+		return true;
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
@@ -1166,12 +3780,24 @@ struct MulNode : Node {
 			return;
 		}
 
-		n0.generate(blob, graph);
-		n1.generate(blob, graph);
-		if (n0.node->getOutputType(n0.output_idx, graph) == ScriptValueType::FLOAT)
-			blob.write(WasmOp::F32_MUL);
-		else
-			blob.write(WasmOp::I32_MUL);
+		const ScriptValueType type = graph.getType({this, 0});
+		if (type == ScriptValueType::VEC3) {
+			// vector times scalar scales, two vectors are multiplied per component
+			const bool is_vec0 = graph.getType(n0) == ScriptValueType::VEC3;
+			const bool is_scale = !is_vec0 || graph.getType(n1) != ScriptValueType::VEC3;
+			const ScriptValueType scalar_type = graph.getType(is_vec0 ? n1 : n0);
+			if (is_scale && scalar_type != ScriptValueType::FLOAT && scalar_type != ScriptValueType::I32) {
+				m_error = "Vector can be multiplied only by a number";
+				return;
+			}
+			if (is_vec0) generateComponentwise(blob, graph, n0, n1, WasmOp::F32_MUL, is_scale);
+			else generateComponentwise(blob, graph, n1, n0, WasmOp::F32_MUL, is_scale);
+			return;
+		}
+
+		graph.generateAs(blob, n0, type);
+		graph.generateAs(blob, n1, type);
+		blob.write(type == ScriptValueType::FLOAT ? WasmOp::F32_MUL : WasmOp::I32_MUL);
 	}
 
 	bool onGUI() override {
@@ -1198,10 +3824,16 @@ struct AddNode : Node {
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override {
-		NodeOutput n0 = getInputNode(0, graph);
-		if (n0) return n0.node->getOutputType(n0.output_idx, graph);
-		return ScriptValueType::I32;
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return getArithmeticType(*this, graph); }
+
+	bool evalConst(u32, const Graph& graph, ConstValue& value) override {
+		ConstValue a, b;
+		if (!evalInputConst(0, graph, a) || !evalInputConst(1, graph, b) || !promoteConsts(a, b)) return false;
+		value.type = a.type;
+		// wraps around like i32.add
+		if (a.type == ScriptValueType::FLOAT) value.f = a.f + b.f;
+		else value.i = i32(u32(a.i) + u32(b.i));
+		return true;
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
@@ -1212,12 +3844,19 @@ struct AddNode : Node {
 			return;
 		}
 
-		n0.generate(blob, graph);
-		n1.generate(blob, graph);
-		if (n0.node->getOutputType(n0.output_idx, graph) == ScriptValueType::FLOAT)
-			blob.write(WasmOp::F32_ADD);
-		else
-			blob.write(WasmOp::I32_ADD);
+		const ScriptValueType type = graph.getType({this, 0});
+		if (type == ScriptValueType::VEC3) {
+			if (graph.getType(n0) != graph.getType(n1)) {
+				m_error = "Types do not match";
+				return;
+			}
+			generateComponentwise(blob, graph, n0, n1, WasmOp::F32_ADD, false);
+			return;
+		}
+
+		graph.generateAs(blob, n0, type);
+		graph.generateAs(blob, n1, type);
+		blob.write(type == ScriptValueType::FLOAT ? WasmOp::F32_ADD : WasmOp::I32_ADD);
 	}
 
 	bool onGUI() override {
@@ -1265,9 +3904,8 @@ struct SetVariableNode : Node {
 			m_error = "Missing input";
 			return;
 		}
-		n.generate(blob, graph);
-		blob.write(WasmOp::GLOBAL_SET);
-		writeLEB128(blob, m_var + (u32)WASMGlobals::USER);
+		const ScriptValueType type = graph.m_variables[m_var].type;
+		graph.generateVariableSet(blob, m_var, [&](){ graph.generateAs(blob, n, type); });
 		generateNext(blob, graph);
 	}
 
@@ -1314,8 +3952,11 @@ struct GetVariableNode : Node {
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-		blob.write(WasmOp::GLOBAL_GET);
-		writeLEB128(blob, m_var + (u32)WASMGlobals::USER);
+		graph.generateVariableGet(blob, m_var);
+	}
+
+	void getReads(u32 output_idx, const Graph& graph, Reads& reads) override {
+		reads.variables |= Reads::bit(m_var);
 	}
 
 	bool onGUI() override {
@@ -1329,6 +3970,40 @@ struct GetVariableNode : Node {
 	u32 m_var = 0;
 };
 
+// type of script values a reflected property is accessed with, false if scripts can not access properties of its type
+static bool getPropertyScriptType(const reflection::PropertyBase& prop, ScriptValueType& type) {
+	struct : reflection::IEmptyPropertyVisitor {
+		void visit(const reflection::Property<float>& prop) override { set(ScriptValueType::FLOAT); }
+		void visit(const reflection::Property<i32>& prop) override { set(ScriptValueType::I32); }
+		void visit(const reflection::Property<u32>& prop) override { set(ScriptValueType::I32); }
+		void visit(const reflection::Property<bool>& prop) override { set(ScriptValueType::I32); }
+		void visit(const reflection::Property<EntityPtr>& prop) override { set(ScriptValueType::ENTITY); }
+		void visit(const reflection::Property<Vec3>& prop) override { set(ScriptValueType::VEC3); }
+		void visit(const reflection::Property<Vec4>& prop) override { set(ScriptValueType::VEC4); }
+		void set(ScriptValueType t) { type = t; valid = true; }
+		ScriptValueType type = ScriptValueType::FLOAT;
+		bool valid = false;
+	} visitor;
+	prop.visit(visitor);
+	type = visitor.type;
+	return visitor.valid;
+}
+
+static bool getPropertyScriptType(ComponentType cmp_type, const char* prop_name, ScriptValueType& type) {
+	const reflection::PropertyBase* prop = reflection::getPropertyFromHash(reflection::getPropertyHash(cmp_type, prop_name));
+	return prop && getPropertyScriptType(*prop, type);
+}
+
+// typed property imports, entities use i32 family
+static WASMLumixAPI getPropertyImport(ScriptValueType type, bool setter) {
+	switch (type) {
+		case ScriptValueType::FLOAT: return setter ? WASMLumixAPI::SET_PROPERTY_FLOAT : WASMLumixAPI::GET_PROPERTY_FLOAT;
+		case ScriptValueType::VEC3: return setter ? WASMLumixAPI::SET_PROPERTY_VEC3 : WASMLumixAPI::GET_PROPERTY_VEC3;
+		case ScriptValueType::VEC4: return setter ? WASMLumixAPI::SET_PROPERTY_VEC4 : WASMLumixAPI::GET_PROPERTY_VEC4;
+		default: return setter ? WASMLumixAPI::SET_PROPERTY_I32 : WASMLumixAPI::GET_PROPERTY_I32;
+	}
+}
+
 struct GetPropertyNode : Node {
 	GetPropertyNode(ComponentType cmp_type, const char* property_name, IAllocator& allocator)
 		: Node(allocator)
@@ -1341,7 +4016,10 @@ struct GetPropertyNode : Node {
 		: Node(allocator)
 	{}
 
-	ScriptValueType getOutputType(u32 idx, const Graph& graph) override { return ScriptValueType::FLOAT; }
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override {
+		ScriptValueType type;
+		return getPropertyScriptType(cmp_type, prop, type) ? type : ScriptValueType::FLOAT;
+	}
 
 	bool hasInputPins() const override { return true; }
 	bool hasOutputPins() const override { return true; }
@@ -1354,7 +4032,7 @@ struct GetPropertyNode : Node {
 
 	void deserialize(InputMemoryStream& blob) override {
 		copyString(prop, blob.readString());
-		cmp_type = reflection::getComponentType(blob.readString());
+		cmp_type = findComponentType(blob.readString());
 	}
 
 	bool onGUI() override {
@@ -1371,21 +4049,30 @@ struct GetPropertyNode : Node {
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) override {
-		// TODO handle other types than float
 		NodeOutput o = getInputNode(0, graph);
 		if (!o) {
 			m_error = "Missing entity input";
 			return;
 		}
 
+		ScriptValueType type;
+		if (!getPropertyScriptType(cmp_type, prop, type)) {
+			m_error = "Unsupported property type";
+			return;
+		}
+
 		o.generate(blob, graph);
 		
-		const StableHash prop_hash = reflection::getPropertyHash(cmp_type, prop);
-		blob.write(WasmOp::I64_CONST);
-		writeLEB128(blob, prop_hash.getHashValue());
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, graph.getPropertyIndex(cmp_type, prop));
 
 		blob.write(WasmOp::CALL);
-		writeLEB128(blob, (u32)WASMLumixAPI::GET_PROPERTY_FLOAT);
+		writeLEB128(blob, (u32)getPropertyImport(type, false));
+	}
+
+	void getReads(u32 output_idx, const Graph& graph, Reads& reads) override {
+		Node::getReads(output_idx, graph, reads);
+		reads.properties |= Reads::bit(graph.getPropertyIndex(cmp_type, prop));
 	}
 
 	char prop[64] = {};
@@ -1417,11 +4104,10 @@ struct SetPropertyNode : Node {
 	void deserialize(InputMemoryStream& blob) override {
 		copyString(prop, blob.readString());
 		copyString(value, blob.readString());
-		cmp_type = reflection::getComponentType(blob.readString());
+		cmp_type = findComponentType(blob.readString());
 	}
 
 	void generate(OutputMemoryStream& blob, const Graph& graph, u32) override {
-		// TODO handle other types than float
 		NodeOutput o1 = getInputNode(1, graph);
 		NodeOutput o2 = getInputNode(2, graph);
 		if (!o1) {
@@ -1429,23 +4115,57 @@ struct SetPropertyNode : Node {
 			return;
 		}
 
+		ScriptValueType type;
+		if (!getPropertyScriptType(cmp_type, prop, type)) {
+			m_error = "Unsupported property type";
+			return;
+		}
+		// only scalars can be typed in the node
+		if (!o2.node && getComponentCount(type) > 1) {
+			m_error = "Missing value input";
+			return;
+		}
+		if (o2.node && !Graph::isConvertible(graph.getType(o2), type)) {
+			m_error = "Value does not match property type";
+			return;
+		}
+
 		o1.generate(blob, graph);
 		
-		const StableHash prop_hash = reflection::getPropertyHash(cmp_type, prop);
-		blob.write(WasmOp::I64_CONST);
-		writeLEB128(blob, prop_hash.getHashValue());
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, graph.getPropertyIndex(cmp_type, prop));
+
+		NodeOutput delta = {nullptr, 0};
+		if (type == ScriptValueType::FLOAT) {
+			delta = getAddedDelta(o2, o1, graph, [&](Node* n){
+				if (n->getType() != Type::GET_PROPERTY) return false;
+				const GetPropertyNode* get = (const GetPropertyNode*)n;
+				return get->cmp_type == cmp_type && equalStrings(get->prop, prop);
+			});
+			if (delta && graph.getType(delta) != ScriptValueType::FLOAT) delta = {nullptr, 0};
+		}
 
-		if (o2.node) {
-			o2.generate(blob, graph);
+		if (delta) {
+			delta.generate(blob, graph);
 		}
-		else {
+		else if (o2.node) {
+			graph.generateAs(blob, o2, type);
+		}
+		else if (type == ScriptValueType::FLOAT) {
 			blob.write(WasmOp::F32_CONST);
 			const float v = (float)atof(value);
 			blob.write(v);
 		}
+		else {
+			blob.write(WasmOp::I32_CONST);
+			writeLEB128(blob, atoi(value));
+		}
 
 		blob.write(WasmOp::CALL);
-		writeLEB128(blob, (u32)WASMLumixAPI::SET_PROPERTY_FLOAT);
+		writeLEB128(blob, delta ? (u32)WASMLumixAPI::ADD_PROPERTY_FLOAT : (u32)getPropertyImport(type, true));
+		Reads written;
+		written.properties = Reads::bit(graph.getPropertyIndex(cmp_type, prop));
+		graph.invalidateCache(written);
 		generateNext(blob, graph);
 	}
 
@@ -1465,6 +4185,440 @@ struct SetPropertyNode : Node {
 	ComponentType cmp_type = INVALID_COMPONENT_TYPE;
 };
 
+// iterates entities within radius, all of them are fetched by one host call to a buffer in linear memory
+// optionally only entities with a scalar property, the property's value is fetched too
+struct ForEachInRadiusNode : Node {
+	ForEachInRadiusNode(ComponentType cmp_type, const char* property_name, IAllocator& allocator)
+		: Node(allocator)
+		, cmp_type(cmp_type)
+	{
+		copyString(prop, property_name);
+	}
+
+	ForEachInRadiusNode(IAllocator& allocator)
+		: Node(allocator)
+	{}
+
+	Type getType() const override { return Type::FOR_EACH_IN_RADIUS; }
+	bool hasInputPins() const override { return true; }
+	bool hasOutputPins() const override { return true; }
+	bool hasProperty() const { return cmp_type != INVALID_COMPONENT_TYPE; }
+
+	void serialize(OutputMemoryStream& blob) const override {
+		blob.writeString(prop);
+		blob.writeString(hasProperty() ? reflection::getComponent(cmp_type)->name : "");
+	}
+
+	void deserialize(InputMemoryStream& blob) override {
+		copyString(prop, blob.readString());
+		const char* cmp_name = blob.readString();
+		cmp_type = cmp_name[0] ? findComponentType(cmp_name) : INVALID_COMPONENT_TYPE;
+	}
+
+	ScriptValueType getOutputType(u32 idx, const Graph& graph) override {
+		switch (idx) {
+			case ENTITY_OUTPUT: return ScriptValueType::ENTITY;
+			case POSITION_OUTPUT: return ScriptValueType::VEC3;
+			default: {
+				ScriptValueType type;
+				return getPropertyScriptType(cmp_type, prop, type) ? type : ScriptValueType::FLOAT;
+			}
+		}
+	}
+
+	bool onGUI() override {
+		nodeTitle("For each in radius", false, false);
+		ImGui::BeginGroup();
+		flowInput(); ImGui::TextUnformatted(" ");
+		inputPin(); ImGui::TextUnformatted("Center");
+		inputPin(); ImGui::TextUnformatted("Radius");
+		ImGui::EndGroup();
+		ImGui::SameLine();
+		ImGui::BeginGroup();
+		flowOutput(); ImGui::TextUnformatted("Done");
+		flowOutput(); ImGui::TextUnformatted("Body");
+		outputPin(); ImGui::TextUnformatted("Entity");
+		outputPin(); ImGui::TextUnformatted("Position");
+		if (hasProperty()) {
+			outputPin(); ImGui::Text("%s.%s", reflection::getComponent(cmp_type)->name, prop);
+		}
+		ImGui::EndGroup();
+		return false;
+	}
+
+	void generate(OutputMemoryStream& blob, const Graph& graph, u32 pin_idx) override {
+		if (pin_idx != 0) {
+			generateOutput(blob, graph, pin_idx);
+			return;
+		}
+
+		NodeOutput center = getInputNode(1, graph);
+		NodeOutput radius = getInputNode(2, graph);
+		if (!center || !radius) {
+			m_error = "Missing inputs";
+			return;
+		}
+		if (graph.getType(center) != ScriptValueType::VEC3) {
+			m_error = "Center must be a vector";
+			return;
+		}
+		if (!Graph::isNumber(graph.getType(radius))) {
+			m_error = "Radius must be a number";
+			return;
+		}
+
+		i32 prop_idx = -1;
+		if (hasProperty()) {
+			ScriptValueType type;
+			if (!getPropertyScriptType(cmp_type, prop, type) || getComponentCount(type) != 1) {
+				m_error = "Unsupported property type";
+				return;
+			}
+			prop_idx = graph.getPropertyIndex(cmp_type, prop);
+		}
+
+		u32 buffer, capacity;
+		graph.getQueryBuffer(this, buffer, capacity);
+		const u32 end = graph.allocLocal(WASMType::I32);
+		m_record_local = graph.allocLocal(WASMType::I32);
+
+		// end = buffer + queryRadius(...) * record size
+		center.generate(blob, graph);
+		graph.generateAs(blob, radius, ScriptValueType::FLOAT);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, prop_idx);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, buffer);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, capacity);
+		blob.write(WasmOp::CALL);
+		writeLEB128(blob, (u32)WASMLumixAPI::QUERY_RADIUS);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, sizeof(ScriptQueryRecord));
+		blob.write(WasmOp::I32_MUL);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, buffer);
+		blob.write(WasmOp::I32_ADD);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, end);
+
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, buffer);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, m_record_local);
+
+		blob.write(WasmOp::BLOCK);
+		blob.write(u8(0x40)); // block type
+		blob.write(WasmOp::LOOP);
+		blob.write(u8(0x40)); // block type
+		
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, m_record_local);
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, end);
+		blob.write(WasmOp::I32_GE_U);
+		blob.write(WasmOp::BR_IF);
+		blob.write(u8(1)); // block
+		
+		graph.generateLoopBody(blob, [&](OutputMemoryStream& body){
+			NodeInput n = getOutputNode(BODY_OUTPUT, graph);
+			if (n.node) n.generate(body, graph);
+		});
+
+		blob.write(WasmOp::LOCAL_GET);
+		writeLEB128(blob, m_record_local);
+		blob.write(WasmOp::I32_CONST);
+		writeLEB128(blob, sizeof(ScriptQueryRecord));
+		blob.write(WasmOp::I32_ADD);
+		blob.write(WasmOp::LOCAL_SET);
+		writeLEB128(blob, m_record_local);
+		blob.write(WasmOp::BR);
+		blob.write(u8(0)); // loop
+		
+		blob.write(WasmOp::END); // loop
+		blob.write(WasmOp::END); // block
+		m_record_local = U32_MAX;
+		
+		generateNext(blob, graph);
+	}
+
+	void generateOutput(OutputMemoryStream& blob, const Graph& graph, u32 output_idx) {
+		if (m_record_local == U32_MAX) {
+			m_error = "Outputs are available only in the loop body";
+			return;
+		}
+
+		auto load = [&](WasmOp op, u32 offset){
+			blob.write(WasmOp::LOCAL_GET);
+			writeLEB128(blob, m_record_local);
+			blob.write(op);
+			Graph::generateMemArg(blob, offset);
+		};
+		switch (output_idx) {
+			case ENTITY_OUTPUT:
+				load(WasmOp::I32_LOAD, offsetof(ScriptQueryRecord, entity));
+				break;
+			case POSITION_OUTPUT:
+				for (u32 i = 0; i < 3; ++i) load(WasmOp::F32_LOAD, offsetof(ScriptQueryRecord, pos) + i * sizeof(float));
+				break;
+			default:
+				load(getComponentType(getOutputType(output_idx, graph)) == WASMType::F32 ? WasmOp::F32_LOAD : WasmOp::I32_LOAD, offsetof(ScriptQueryRecord, value));
+				break;
+		}
+	}
+
+	enum { DONE_OUTPUT, BODY_OUTPUT, ENTITY_OUTPUT, POSITION_OUTPUT, VALUE_OUTPUT };
+
+	char prop[64] = {};
+	ComponentType cmp_type = INVALID_COMPONENT_TYPE;
+	// address of current record while the loop body is generated
+	u32 m_record_local = U32_MAX;
+};
+
+static void addLink(Graph& graph, const Node* from, u32 from_pin, const Node* to, u32 to_pin) {
+	NodeEditorLink& link = graph.m_links.emplace();
+	link.from = from->m_id | (from_pin << 16);
+	link.to = to->m_id | (to_pin << 16);
+}
+
+static Node* addConst(Graph& graph, float value) {
+	ConstNode* node = (ConstNode*)graph.addNode<ConstNode>(graph.m_allocator);
+	node->m_value = value;
+	return node;
+}
+
+static void addFloatVariable(Graph& graph, const char* name) {
+	Variable& var = graph.m_variables.emplace(graph.m_allocator);
+	var.name = name;
+	var.type = ScriptValueType::FLOAT;
+}
+
+// each step moves the entity, by an offset if `fused` (compiled to a single addPosition host call),
+// otherwise by scaling the position, which needs separate getPosition and setPosition host calls
+static void buildMoveGraph(Graph& graph, u32 steps, bool fused) {
+	Node* update = graph.addNode<UpdateNode>(graph.m_allocator);
+	Node* self = graph.addNode<SelfNode>(graph.m_allocator);
+	Node* c = addConst(graph, 0.001f);
+	Node* offset = graph.addNode<Vec3Node>(graph.m_allocator);
+	for (u32 i = 0; i < 3; ++i) addLink(graph, c, 0, offset, i);
+	Node* scale = addConst(graph, 1.0001f);
+
+	Node* prev = update;
+	for (u32 i = 0; i < steps; ++i) {
+		Node* get = graph.addNode<GetTransformNode<true>>(graph.m_allocator);
+		Node* op = fused ? graph.addNode<AddNode>(graph.m_allocator) : graph.addNode<MulNode>(graph.m_allocator);
+		Node* set = graph.addNode<SetTransformNode<true>>(graph.m_allocator);
+		addLink(graph, self, 0, get, 0);
+		addLink(graph, get, 0, op, 0);
+		addLink(graph, fused ? offset : scale, 0, op, 1);
+		addLink(graph, prev, 0, set, 0);
+		addLink(graph, self, 0, set, 1);
+		addLink(graph, op, 0, set, 2);
+		prev = set;
+	}
+}
+
+static void buildHostCallGraph(Graph& graph, u32 steps) { buildMoveGraph(graph, steps, false); }
+static void buildFusedHostCallGraph(Graph& graph, u32 steps) { buildMoveGraph(graph, steps, true); }
+
+// chain of ifs on a variable each branch changes, both branches of a step continue to the next step
+static void buildBranchGraph(Graph& graph, u32 steps) {
+	addFloatVariable(graph, "counter");
+	Node* update = graph.addNode<UpdateNode>(graph.m_allocator);
+	Node* prev_true = update;
+	Node* prev_false = nullptr;
+	for (u32 i = 0; i < steps; ++i) {
+		Node* get = graph.addNode<GetVariableNode>(graph, 0);
+		Node* cmp = graph.addNode<CompareNode<Node::Type::GT>>(graph.m_allocator);
+		Node* branch = graph.addNode<IfNode>(graph.m_allocator);
+		addLink(graph, get, 0, cmp, 0);
+		addLink(graph, addConst(graph, (float)(i % 4)), 0, cmp, 1);
+		addLink(graph, cmp, 0, branch, 1);
+		addLink(graph, prev_true, 0, branch, 0);
+		if (prev_false) addLink(graph, prev_false, 0, branch, 0);
+
+		Node* branches[2];
+		for (u32 j = 0; j < 2; ++j) {
+			Node* add = graph.addNode<AddNode>(graph.m_allocator);
+			Node* set = graph.addNode<SetVariableNode>(graph, 0);
+			addLink(graph, get, 0, add, 0);
+			addLink(graph, addConst(graph, j == 0 ? -1.f : 1.f), 0, add, 1);
+			addLink(graph, branch, j, set, 0);
+			addLink(graph, add, 0, set, 1);
+			branches[j] = set;
+		}
+		prev_true = branches[0];
+		prev_false = branches[1];
+	}
+}
+
+// a single variable updated by a long arithmetic expression, no host calls
+static void buildMathGraph(Graph& graph, u32 steps) {
+	addFloatVariable(graph, "value");
+	Node* update = graph.addNode<UpdateNode>(graph.m_allocator);
+	Node* value = graph.addNode<GetVariableNode>(graph, 0);
+	for (u32 i = 0; i < steps; ++i) {
+		Node* mul = graph.addNode<MulNode>(graph.m_allocator);
+		Node* add = graph.addNode<AddNode>(graph.m_allocator);
+		addLink(graph, value, 0, mul, 0);
+		addLink(graph, addConst(graph, 0.5f), 0, mul, 1);
+		addLink(graph, mul, 0, add, 0);
+		addLink(graph, addConst(graph, 1.f), 0, add, 1);
+		value = add;
+	}
+	Node* set = graph.addNode<SetVariableNode>(graph, 0);
+	addLink(graph, update, 0, set, 0);
+	addLink(graph, value, 0, set, 1);
+}
+
+// runs synthetic graphs on many entities in a headless world and writes timings to REPORT_PATH
+// graphs are saved as regular .lvs files, so they are compiled by the asset compiler like any other script,
+// but in the engine's cache directory, so they do not pollute project's assets
+struct ScriptBenchmark {
+	static constexpr const char* DIR = ".lumix/benchmark/visualscript/";
+	static constexpr const char* REPORT_PATH = ".lumix/benchmark/visualscript/report.csv";
+	static constexpr u32 GRAPH_STEPS = 16;
+	static constexpr u32 NUM_FRAMES = 100;
+	static constexpr float TIME_DELTA = 1 / 60.f;
+
+	struct Case {
+		const char* name;
+		void (*build)(Graph& graph, u32 steps);
+		bool batch_update;
+	};
+
+	static constexpr Case CASES[] = {
+		{ "host_calls", &buildHostCallGraph, false },
+		{ "host_calls_fused", &buildFusedHostCallGraph, false },
+		{ "branches", &buildBranchGraph, false },
+		{ "math", &buildMathGraph, false },
+		{ "math_batch", &buildMathGraph, true },
+	};
+
+	ScriptBenchmark(StudioApp& app, IAllocator& allocator)
+		: m_app(app)
+		, m_allocator(allocator)
+		, m_resources(allocator)
+	{}
+
+	~ScriptBenchmark() { releaseResources(); }
+
+	bool isRunning() const { return !m_resources.empty(); }
+
+	void start(u32 num_entities) {
+		if (isRunning()) return;
+
+		m_num_entities = num_entities;
+		Engine& engine = m_app.getEngine();
+		FileSystem& fs = engine.getFileSystem();
+		const StaticString<MAX_PATH> dir(fs.getBasePath(), DIR);
+		if (!os::dirExists(dir) && !os::makePath(dir)) {
+			logError("Failed to create ", dir);
+			return;
+		}
+		for (const Case& c : CASES) {
+			Graph graph(Path(), m_allocator);
+			c.build(graph, GRAPH_STEPS);
+			graph.m_batch_update = c.batch_update;
+			OutputMemoryStream blob(m_allocator);
+			graph.serialize(blob);
+			const Path path(DIR, c.name, ".lvs");
+			if (!fs.saveContentSync(path, blob)) {
+				logError("Failed to save ", path);
+				releaseResources();
+				return;
+			}
+			m_resources.push(engine.getResourceManager().load<ScriptResource>(path));
+		}
+	}
+
+	// waits until all graphs are compiled, then runs all cases at once
+	void update() {
+		if (!isRunning()) return;
+		for (ScriptResource* res : m_resources) {
+			if (res->isFailure()) {
+				logError("Benchmark failed, ", res->getPath(), " could not be loaded");
+				releaseResources();
+				return;
+			}
+			if (!res->isReady()) return;
+		}
+
+		OutputMemoryStream report(m_allocator);
+		report << "case,backend,entities,instantiate_ms,frame_ms,bytes_per_instance,host_calls_per_frame,ns_per_host_call\n";
+		for (u32 i = 0; i < lengthOf(CASES); ++i) run(CASES[i], *m_resources[i], report);
+
+		FileSystem& fs = m_app.getEngine().getFileSystem();
+		if (!fs.saveContentSync(Path(REPORT_PATH), report)) logError("Failed to save ", REPORT_PATH);
+		logInfo("Visual script benchmark finished, see ", REPORT_PATH);
+		releaseResources();
+	}
+
+private:
+	void run(const Case& c, ScriptResource& resource, OutputMemoryStream& report) {
+		Engine& engine = m_app.getEngine();
+		World& world = engine.createWorld();
+		ScriptModule* module = (ScriptModule*)world.getModule(SCRIPT_TYPE);
+		Array<EntityRef> entities(m_allocator);
+		entities.reserve(m_num_entities);
+		for (u32 i = 0; i < m_num_entities; ++i) {
+			const EntityRef e = world.createEntity(DVec3(i, 0, 0), Quat::IDENTITY);
+			world.createComponent(SCRIPT_TYPE, e);
+			module->setScriptResource(e, resource.getPath());
+			entities.push(e);
+		}
+
+		module->startGame();
+		// the first update compiles the resource, instantiates all scripts and runs their first update
+		os::Timer timer;
+		module->update(TIME_DELTA);
+		const float instantiate_time = timer.getTimeSinceStart();
+
+		u32 bytes = 0;
+		for (EntityRef e : entities) {
+			const Script& script = module->getScript(e);
+			bytes += sizeof(Script) + script.m_instance.size() + script.m_globals.size() * sizeof(u64);
+		}
+
+		timer.tick();
+		for (u32 i = 0; i < NUM_FRAMES; ++i) module->update(TIME_DELTA);
+		const float frame_time = timer.getTimeSinceTick() / NUM_FRAMES;
+
+		// separate run, so counting does not skew frame time
+		module->resetStats();
+		module->setCollectStats(true);
+		for (u32 i = 0; i < NUM_FRAMES; ++i) module->update(TIME_DELTA);
+		module->setCollectStats(false);
+		ScriptStats stats;
+		u64 host_calls = 0;
+		if (module->getStats(resource, stats)) {
+			for (u64 count : stats.import_calls) host_calls += count;
+		}
+		const u32 host_calls_per_frame = u32(host_calls / NUM_FRAMES);
+		// upper bound, includes the script's own code
+		const float ns_per_host_call = host_calls_per_frame ? frame_time * 1e9f / host_calls_per_frame : 0;
+
+		module->stopGame();
+		engine.destroyWorld(world);
+
+		const StaticString<256> line(c.name, ",", module->getBackend().getName(), ",", m_num_entities, ",", instantiate_time * 1000, ",", frame_time * 1000, ","
+			, bytes / maximum(m_num_entities, 1u), ",", host_calls_per_frame, ",", ns_per_host_call, "\n");
+		report << line.data;
+		logInfo("Benchmark ", line.data);
+	}
+
+	void releaseResources() {
+		for (ScriptResource* res : m_resources) res->decRefCount();
+		m_resources.clear();
+	}
+
+	StudioApp& m_app;
+	IAllocator& m_allocator;
+	// indexed as CASES, empty if not running
+	Array<ScriptResource*> m_resources;
+	u32 m_num_entities = 0;
+};
+
 struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 	VisualScriptEditorWindow(const Path& path, struct VisualScriptEditor& editor, StudioApp& app, IAllocator& allocator) 
 		: NodeEditor(allocator)
@@ -1473,15 +4627,23 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 		, m_allocator(allocator)
 		, m_editor(editor)
 		, m_graph(path, m_allocator)
+		, m_counters(m_allocator)
+		, m_benchmark(app, m_allocator)
 	{
 		m_graph.load(path, app.getEngine().getFileSystem());
 		pushUndo(NO_MERGE_UNDO);
 		m_dirty = false;
 	}
 
+	~VisualScriptEditorWindow() {
+		if (m_profiled_resource) m_profiled_resource->decRefCount();
+	}
+
 	void pushUndo(u32 tag) override {
+		m_graph.invalidateIndex();
 		SimpleUndoRedo::pushUndo(tag);
 		m_dirty = true;
+		m_errors_dirty = true;
 	}
 
 	void deleteSelectedNodes() {
@@ -1562,25 +4724,21 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 				if (cmp.cmp->props.empty()) continue;
 
 				if (visitor.beginCategory(cmp.cmp->name)) {
-					struct : reflection::IEmptyPropertyVisitor {
-						void visit(const reflection::Property<float>& prop) override {
-							struct : INodeTypeVisitor::ICreator {
-								Node* create(Graph& graph) override {
-									return graph.addNode<GetPropertyNode>(cmp->cmp->component_type, prop->name, graph.m_allocator);
-								}
-								const reflection::RegisteredComponent* cmp;
-								const reflection::Property<float>* prop;
-							} creator;
-							creator.cmp = cmp;
-							creator.prop = &prop;
-							type_visitor->visit(prop.name, creator);
-						}
-						const reflection::RegisteredComponent* cmp;
-						INodeTypeVisitor* type_visitor;
-					} prop_visitor;
-					prop_visitor.type_visitor = &visitor;
-					prop_visitor.cmp = &cmp;
-					cmp.cmp->visit(prop_visitor);
+					for (const reflection::PropertyBase* prop : cmp.cmp->props) {
+						ScriptValueType type;
+						if (!getPropertyScriptType(*prop, type)) continue;
+
+						struct : INodeTypeVisitor::ICreator {
+							Node* create(Graph& graph) override {
+								return graph.addNode<GetPropertyNode>(cmp->cmp->component_type, prop->name, graph.m_allocator);
+							}
+							const reflection::RegisteredComponent* cmp;
+							const reflection::PropertyBase* prop;
+						} creator;
+						creator.cmp = &cmp;
+						creator.prop = prop;
+						visitor.visit(prop->name, creator);
+					}
 					visitor.endCategory();
 				}
 			}	
@@ -1593,25 +4751,21 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 				if (cmp.cmp->props.empty()) continue;
 
 				if (visitor.beginCategory(cmp.cmp->name)) {
-					struct : reflection::IEmptyPropertyVisitor {
-						void visit(const reflection::Property<float>& prop) override {
-							struct : INodeTypeVisitor::ICreator {
-								Node* create(Graph& graph) override {
-									return graph.addNode<SetPropertyNode>(cmp->cmp->component_type, prop->name, graph.m_allocator);
-								}
-								const reflection::RegisteredComponent* cmp;
-								const reflection::Property<float>* prop;
-							} creator;
-							creator.cmp = cmp;
-							creator.prop = &prop;
-							type_visitor->visit(prop.name, creator);
-						}
-						const reflection::RegisteredComponent* cmp;
-						INodeTypeVisitor* type_visitor;
-					} prop_visitor;
-					prop_visitor.type_visitor = &visitor;
-					prop_visitor.cmp = &cmp;
-					cmp.cmp->visit(prop_visitor);
+					for (const reflection::PropertyBase* prop : cmp.cmp->props) {
+						ScriptValueType type;
+						if (!getPropertyScriptType(*prop, type)) continue;
+
+						struct : INodeTypeVisitor::ICreator {
+							Node* create(Graph& graph) override {
+								return graph.addNode<SetPropertyNode>(cmp->cmp->component_type, prop->name, graph.m_allocator);
+							}
+							const reflection::RegisteredComponent* cmp;
+							const reflection::PropertyBase* prop;
+						} creator;
+						creator.cmp = &cmp;
+						creator.prop = prop;
+						visitor.visit(prop->name, creator);
+					}
 					visitor.endCategory();
 				}
 			}	
@@ -1631,6 +4785,8 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 				creator.cmp = rcmp.cmp;
 				if (!rcmp.cmp->functions.empty() && visitor.beginCategory(rcmp.cmp->name)) {
 					for (reflection::FunctionBase* f : rcmp.cmp->functions) {
+						ScriptFunctionSignature signature;
+						if (!getScriptFunctionSignature(*f, signature)) continue;
 						creator.f = f;
 						visitor.visit(f->name, creator);
 					}
@@ -1640,19 +4796,66 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 			visitor.endCategory();
 		}
 
+		if (visitor.beginCategory("For each in radius")) {
+			struct : INodeTypeVisitor::ICreator {
+				Node* create(Graph& graph) override {
+					return graph.addNode<ForEachInRadiusNode>(cmp_type, prop ? prop->name : "", graph.m_allocator);
+				}
+				ComponentType cmp_type = INVALID_COMPONENT_TYPE;
+				const reflection::PropertyBase* prop = nullptr;
+			} creator;
+			visitor.visit("Any entity", creator);
+			for (const reflection::RegisteredComponent& cmp : reflection::getComponents()) {
+				if (cmp.cmp->props.empty()) continue;
+
+				if (visitor.beginCategory(cmp.cmp->name)) {
+					for (const reflection::PropertyBase* prop : cmp.cmp->props) {
+						ScriptValueType type;
+						if (!getPropertyScriptType(*prop, type) || getComponentCount(type) != 1) continue;
+						creator.cmp_type = cmp.cmp->component_type;
+						creator.prop = prop;
+						visitor.visit(prop->name, creator);
+					}
+					visitor.endCategory();
+				}
+			}
+			visitor.endCategory();
+		}
+
+		if (visitor.beginCategory("Vector")) {
+			visitor.visit("Cross", Node::Type::CROSS)
+				.visit("Dot", Node::Type::DOT)
+				.visit("Lerp", Node::Type::LERP)
+				.visit("Normalize", Node::Type::NORMALIZE)
+				.visit("Rotate", Node::Type::ROTATE)
+				.visit("Split", Node::Type::SPLIT_VEC3);
+			visitor.endCategory();
+		}
+
 		visitor.visit("Add", Node::Type::ADD, 'A')
 			.visit("Constant", Node::Type::CONST, '1')
+			.visit("Delay", Node::Type::DELAY)
+			.visit("Every", Node::Type::EVERY)
+			.visit("For", Node::Type::FOR)
+			.visit("Get position", Node::Type::GET_POSITION)
+			.visit("Get rotation", Node::Type::GET_ROTATION)
 			.visit("If", Node::Type::IF, 'I')
 			.visit("Key Input", Node::Type::KEY_INPUT)
+			.visit("Mouse button", Node::Type::MOUSE_BUTTON)
 			.visit("Mouse move", Node::Type::MOUSE_MOVE)
+			.visit("Move to", Node::Type::MOVE_TO)
 			.visit("Multiply", Node::Type::MUL, 'M')
 			.visit("Self", Node::Type::SELF, 'S')
 			.visit("Sequence", Node::Type::SEQUENCE)
+			.visit("Set position", Node::Type::SET_POSITION)
+			.visit("Set rotation", Node::Type::SET_ROTATION)
 			.visit("Set yaw", Node::Type::SET_YAW)
 			.visit("Start", Node::Type::START)
 			.visit("Switch", Node::Type::SWITCH)
 			.visit("Update", Node::Type::UPDATE)
 			.visit("Vector 3", Node::Type::VEC3, '3')
+			.visit("Wait until", Node::Type::WAIT_UNTIL)
+			.visit("While", Node::Type::WHILE)
 			.visit("Yaw to direction", Node::Type::YAW_TO_DIR);
 	}
 
@@ -1681,6 +4884,7 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 	void deserialize(InputMemoryStream& blob) override {
 		m_graph.clear();
 		m_graph.deserialize(blob);
+		m_errors_dirty = true;
 	}
 
 	void serialize(OutputMemoryStream& blob) override {
@@ -1688,8 +4892,7 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 	}
 
 	void saveAs(const Path& path) {
-		OutputMemoryStream tmp(m_allocator);
-		m_graph.generate(tmp); // to update errors
+		m_graph.updateErrors();
 		OutputMemoryStream blob(m_allocator);
 		m_graph.serialize(blob);
 		FileSystem& fs = m_app.getEngine().getFileSystem();
@@ -1702,6 +4905,20 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 		}
 	}
 
+	// C++ of the saved graph, to be built into the game, see ScriptNative
+	void exportNative() {
+		saveAs(m_graph.m_path);
+		OutputMemoryStream compiled(m_allocator);
+		OutputMemoryStream native(m_allocator);
+		m_graph.generate(compiled, &native);
+		if (native.empty()) return;
+
+		const Path path(m_graph.m_path.c_str(), ".cpp");
+		FileSystem& fs = m_app.getEngine().getFileSystem();
+		if (!fs.saveContentSync(path, native)) logError("Failed to save ", path);
+		else logInfo("Native code of ", m_graph.m_path, " saved to ", path);
+	}
+
 	void menu() {
 		CommonActions& actions = m_app.getCommonActions();
 
@@ -1714,6 +4931,7 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 			if (ImGui::BeginMenu("File")) {
 				if (menuItem(actions.save, true)) saveAs(m_graph.m_path);
 				if (ImGui::MenuItem("Save as")) m_show_save_as = true;
+				if (ImGui::MenuItem("Export C++", nullptr, false, !m_graph.m_path.isEmpty())) exportNative();
 				ImGui::EndMenu();
 			}
 			if (ImGui::BeginMenu("Edit")) {
@@ -1721,6 +4939,13 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 				if (menuItem(actions.redo, canRedo())) redo();
 				ImGui::EndMenu();
 			}
+			if (ImGui::BeginMenu("Benchmark")) {
+				ImGui::SetNextItemWidth(100);
+				ImGui::InputInt("Entities", &m_benchmark_entities);
+				m_benchmark_entities = maximum(m_benchmark_entities, 1);
+				if (ImGui::MenuItem("Run", nullptr, false, !m_benchmark.isRunning())) m_benchmark.start(m_benchmark_entities);
+				ImGui::EndMenu();
+			}
 			if (ImGuiEx::IconButton(ICON_FA_SAVE, "Save")) saveAs(m_graph.m_path);
 			if (ImGuiEx::IconButton(ICON_FA_UNDO, "Undo", canUndo())) undo();
 			if (ImGuiEx::IconButton(ICON_FA_REDO, "Redo", canRedo())) redo();
@@ -1733,10 +4958,58 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 
 	const Path& getPath() override { return m_graph.m_path; }
 
+	// heat of nodes from counters of the compiled resource running in the editor's world
+	void updateHeat() {
+		for (Node* n : m_graph.m_nodes) n->m_heat = -1;
+		if (!m_graph.m_profile_nodes) {
+			if (m_profiled_resource) {
+				m_profiled_resource->decRefCount();
+				m_profiled_resource = nullptr;
+			}
+			return;
+		}
+		
+		if (!m_profiled_resource) m_profiled_resource = m_app.getEngine().getResourceManager().load<ScriptResource>(m_graph.m_path);
+		if (!m_profiled_resource->isReady()) return;
+		World* world = m_app.getWorldEditor().getWorld();
+		ScriptModule* module = world ? (ScriptModule*)world->getModule(SCRIPT_TYPE) : nullptr;
+		if (!module) return;
+
+		const Array<u32>& nodes = m_profiled_resource->m_profiled_nodes;
+		m_counters.resize(nodes.size());
+		if (!module->getNodeCounters(*m_profiled_resource, Span(m_counters.begin(), (u32)m_counters.size()))) return;
+		
+		u32 max_count = 1;
+		for (u32 c : m_counters) max_count = maximum(max_count, c);
+		for (u32 i = 0; i < (u32)nodes.size(); ++i) {
+			Node* n = m_graph.getNode(nodes[i]);
+			if (!n) continue;
+			n->m_execution_count = m_counters[i];
+			n->m_heat = m_counters[i] / (float)max_count;
+		}
+	}
+
 	void windowGUI() override {
 		menu();
+		m_benchmark.update();
+		// errors are live, only exports affected by the edit are generated again
+		if (m_errors_dirty) {
+			m_graph.updateErrors();
+			m_errors_dirty = false;
+		}
 		ImGui::Columns(2);
 		static bool once = [](){ ImGui::SetColumnWidth(-1, 150); return true; }();
+		if (ImGui::Checkbox("Batch update", &m_graph.m_batch_update)) pushUndo(NO_MERGE_UNDO);
+		if (ImGui::Checkbox("Profile nodes", &m_graph.m_profile_nodes)) pushUndo(NO_MERGE_UNDO);
+		if (ImGui::Combo("Update", (int*)&m_graph.m_update_policy, "Interval\0Distance\0None\0")) pushUndo(NO_MERGE_UNDO);
+		if (m_graph.m_update_policy == ScriptUpdatePolicy::INTERVAL) {
+			i32 interval = m_graph.m_update_interval;
+			if (ImGui::InputInt("Interval", &interval)) {
+				m_graph.m_update_interval = maximum(interval, 1);
+				pushUndo(NO_MERGE_UNDO);
+			}
+		}
+		updateHeat();
 		for (Variable& var : m_graph.m_variables) {
 			ImGui::PushID(&var);
 			if (ImGuiEx::IconButton(ICON_FA_TRASH, "Delete")) {
@@ -1746,7 +5019,7 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 			}
 			ImGui::SameLine();
 			ImGui::SetNextItemWidth(75);
-			ImGui::Combo("##type", (i32*)&var.type, "u32\0i32\0float\0entity\0");
+			ImGui::Combo("##type", (i32*)&var.type, "u32\0i32\0float\0entity\0vec3\0quat\0vec4\0");
 			ImGui::SameLine();
 			char buf[128];
 			copyString(buf, var.name.c_str());
@@ -1867,6 +5140,12 @@ struct VisualScriptEditorWindow : AssetEditorWindow, NodeEditor {
 	VisualScriptEditor& m_editor;
 	Graph m_graph;
 	bool m_show_save_as = false;
+	// compiled m_graph, loaded while nodes are profiled
+	ScriptResource* m_profiled_resource = nullptr;
+	Array<u32> m_counters;
+	ScriptBenchmark m_benchmark;
+	i32 m_benchmark_entities = 1000;
+	bool m_errors_dirty = true;
 };
 
 Node* Graph::createNode(Node::Type type) {
@@ -1885,6 +5164,7 @@ Node* Graph::createNode(Node::Type type) {
 		case Node::Type::SET_YAW: return addNode<SetYawNode>(m_allocator);
 		case Node::Type::CONST: return addNode<ConstNode>(m_allocator);
 		case Node::Type::MOUSE_MOVE: return addNode<MouseMoveNode>(m_allocator);
+		case Node::Type::MOUSE_BUTTON: return addNode<MouseButtonNode>(m_allocator);
 		case Node::Type::KEY_INPUT: return addNode<KeyInputNode>(m_allocator);
 		case Node::Type::START: return addNode<StartNode>(m_allocator);
 		case Node::Type::UPDATE: return addNode<UpdateNode>(m_allocator);
@@ -1896,6 +5176,23 @@ Node* Graph::createNode(Node::Type type) {
 		case Node::Type::YAW_TO_DIR: return addNode<YawToDirNode>(m_allocator);
 		case Node::Type::GET_PROPERTY: return addNode<GetPropertyNode>(m_allocator);
 		case Node::Type::SWITCH: return addNode<SwitchNode>(m_allocator);
+		case Node::Type::FOR: return addNode<ForNode>(m_allocator);
+		case Node::Type::WHILE: return addNode<WhileNode>(m_allocator);
+		case Node::Type::DELAY: return addNode<DelayNode>(m_allocator);
+		case Node::Type::EVERY: return addNode<EveryNode>(m_allocator);
+		case Node::Type::WAIT_UNTIL: return addNode<WaitUntilNode>(m_allocator);
+		case Node::Type::MOVE_TO: return addNode<MoveToNode>(m_allocator);
+		case Node::Type::SPLIT_VEC3: return addNode<SplitVec3Node>(m_allocator);
+		case Node::Type::DOT: return addNode<Vec3BinaryNode<Node::Type::DOT>>(m_allocator);
+		case Node::Type::CROSS: return addNode<Vec3BinaryNode<Node::Type::CROSS>>(m_allocator);
+		case Node::Type::NORMALIZE: return addNode<NormalizeNode>(m_allocator);
+		case Node::Type::LERP: return addNode<LerpNode>(m_allocator);
+		case Node::Type::ROTATE: return addNode<RotateNode>(m_allocator);
+		case Node::Type::GET_POSITION: return addNode<GetTransformNode<true>>(m_allocator);
+		case Node::Type::SET_POSITION: return addNode<SetTransformNode<true>>(m_allocator);
+		case Node::Type::GET_ROTATION: return addNode<GetTransformNode<false>>(m_allocator);
+		case Node::Type::SET_ROTATION: return addNode<SetTransformNode<false>>(m_allocator);
+		case Node::Type::FOR_EACH_IN_RADIUS: return addNode<ForEachInRadiusNode>(m_allocator);
 	}
 	return nullptr;
 }
@@ -1931,27 +5228,97 @@ struct VisualScriptEditor : StudioApp::IPlugin, PropertyGrid::IPlugin {
 		if (!script.m_resource->isReady()) return;
 		if (!script.m_module) return;
 
-		for (i32 i = 0; i < m3l_getGlobalCount(script.m_module); ++i) {
-			const char* name = m3l_getGlobalName(script.m_module, i);
+		// module is shared by all instances, values of this instance are in its record or m_globals
+		for (const ScriptResource::Variable& var : script.m_resource->m_variables) {
+			if (var.offset + getComponentCount(var.type) * sizeof(u32) > (u32)script.m_instance.size()) continue;
+			const u8* value = script.m_instance.begin() + var.offset;
+			switch (var.type) {
+				case ScriptValueType::U32_DEPRECATED:
+					ASSERT(false);
+					break;
+				case ScriptValueType::I32:
+				case ScriptValueType::ENTITY: {
+					i32 v;
+					memcpy(&v, value, sizeof(v));
+					ImGui::LabelText(var.name.c_str(), "%d", v);
+					break;
+				}
+				case ScriptValueType::FLOAT: {
+					float v;
+					memcpy(&v, value, sizeof(v));
+					ImGui::LabelText(var.name.c_str(), "%f", v);
+					break;
+				}
+				case ScriptValueType::VEC3: {
+					Vec3 v;
+					memcpy(&v, value, sizeof(v));
+					ImGui::LabelText(var.name.c_str(), "%f %f %f", v.x, v.y, v.z);
+					break;
+				}
+				case ScriptValueType::QUAT: {
+					Quat v;
+					memcpy(&v, value, sizeof(v));
+					ImGui::LabelText(var.name.c_str(), "%f %f %f %f", v.x, v.y, v.z, v.w);
+					break;
+				}
+				case ScriptValueType::VEC4: {
+					Vec4 v;
+					memcpy(&v, value, sizeof(v));
+					ImGui::LabelText(var.name.c_str(), "%f %f %f %f", v.x, v.y, v.z, v.w);
+					break;
+				}
+			}
+		}
+
+		ScriptBackend& backend = module->getBackend();
+		for (u32 i = 0, c = backend.getGlobalCount(script.m_module); i < c; ++i) {
+			const char* name = backend.getGlobalName(script.m_module, i);
 			if (!name) continue;
-			IM3Global global = m3_FindGlobal(script.m_module, name);
-			M3TaggedValue val;
-			m3_GetGlobal(global, &val);
-			switch (val.type) {
-				case M3ValueType::c_m3Type_none:
-				case M3ValueType::c_m3Type_unknown:
-				case M3ValueType::c_m3Type_i64:
-				case M3ValueType::c_m3Type_f64:
+			const u64 raw = script.m_globals[i];
+			switch (backend.getGlobalType(script.m_module, i)) {
+				case ScriptBackend::ValueType::NONE:
+				case ScriptBackend::ValueType::I64:
+				case ScriptBackend::ValueType::F64:
 					ASSERT(false); // TODO
 					break;
-				case M3ValueType::c_m3Type_i32:
-					ImGui::LabelText(name, "%d", val.value.i32);
+				case ScriptBackend::ValueType::I32: {
+					i32 v;
+					memcpy(&v, &raw, sizeof(v));
+					ImGui::LabelText(name, "%d", v);
 					break;
-				case M3ValueType::c_m3Type_f32:
-					ImGui::LabelText(name, "%f", val.value.f32);
+				}
+				case ScriptBackend::ValueType::F32: {
+					float v;
+					memcpy(&v, &raw, sizeof(v));
+					ImGui::LabelText(name, "%f", v);
 					break;
+				}
+			}
+		}
+
+		statsGUI(*module, *script.m_resource);
+	}
+
+	// stats are per resource, shared by all its instances
+	void statsGUI(ScriptModule& module, ScriptResource& resource) {
+		if (!ImGui::TreeNode("Stats")) return;
+
+		bool collect = module.isCollectingStats();
+		if (ImGui::Checkbox("Collect", &collect)) module.setCollectStats(collect);
+		ImGui::SameLine();
+		if (ImGui::Button("Reset")) module.resetStats();
+
+		ScriptStats stats;
+		if (module.getStats(resource, stats)) {
+			ImGui::LabelText("Calls", "%u", (u32)stats.calls);
+			ImGui::LabelText("Total time", "%.3f ms", stats.call_time * 1000);
+			if (stats.calls > 0) ImGui::LabelText("Time per call", "%.3f us", stats.call_time * 1e6 / stats.calls);
+			for (u32 i = 0; i < (u32)ScriptImport::COUNT; ++i) {
+				if (stats.import_calls[i] == 0) continue;
+				ImGui::LabelText(getScriptImportName((ScriptImport)i), "%u", (u32)stats.import_calls[i]);
 			}
 		}
+		ImGui::TreePop();
 	}
 
 	void open(const Path& path) {
@@ -1967,6 +5334,7 @@ struct VisualScriptEditor : StudioApp::IPlugin, PropertyGrid::IPlugin {
 		AssetPlugin(VisualScriptEditor& editor)
 			: EditorAssetPlugin("Visual script", "lvs", ScriptResource::TYPE, editor.m_app, editor.m_allocator)
 			, m_editor(editor)
+			, m_compiled_hashes(editor.m_allocator)
 		{}
 
 		void openEditor(const Path& path) override { m_editor.open(path); }
@@ -1977,13 +5345,24 @@ struct VisualScriptEditor : StudioApp::IPlugin, PropertyGrid::IPlugin {
 				ScriptResource::Header header;
 				OutputMemoryStream compiled(m_editor.m_allocator);
 				compiled.write(header);
+				compiled.write(u32(0)); // stack size, unknown
+				compiled.write(u32(0)); // instance size, state is in globals
+				compiled.write(ScriptResource::SCRATCH_SIZE); // reserved memory
+				compiled.write(u32(0)); // variable count
+				compiled.write(u32(0)); // property count
+				compiled.write(u32(0)); // function count
+				compiled.write(u32(0)); // profile offset
+				compiled.write(u32(0)); // profiled node count
+				compiled.write(u32(0)); // timer count
+				compiled.write(ScriptUpdatePolicy::INTERVAL);
+				compiled.write(u32(1)); // update interval
 				OutputMemoryStream wasm(m_editor.m_allocator);
 				if (!fs.getContentSync(src, wasm)) {
 					logError("Failed to read ", src);
 					return false;
 				}
 				compiled.write(wasm.data(), wasm.size());
-				return m_editor.m_app.getAssetCompiler().writeCompiledResource(src, Span(compiled.data(), (u32)compiled.size()));
+				return writeCompiledResource(src, compiled);
 			}
 			else {
 				Graph graph(Path(), m_editor.m_allocator);
@@ -2001,10 +5380,27 @@ struct VisualScriptEditor : StudioApp::IPlugin, PropertyGrid::IPlugin {
 
 				OutputMemoryStream compiled(m_editor.m_allocator);
 				graph.generate(compiled);
-				return m_editor.m_app.getAssetCompiler().writeCompiledResource(src, Span(compiled.data(), (u32)compiled.size()));
+				return writeCompiledResource(src, compiled);
 			}
 		}
 
+		// skips writing output identical to the last one written in this session, e.g. when only layout of a graph changed
+		bool writeCompiledResource(const Path& src, const OutputMemoryStream& compiled) {
+			const StableHash hash(compiled.data(), (u32)compiled.size());
+			{
+				MutexGuard guard(m_mutex);
+				auto iter = m_compiled_hashes.find(src.getHash());
+				if (iter.isValid() && iter.value() == hash) return true;
+			}
+			if (!m_editor.m_app.getAssetCompiler().writeCompiledResource(src, Span(compiled.data(), (u32)compiled.size()))) return false;
+
+			MutexGuard guard(m_mutex);
+			auto iter = m_compiled_hashes.find(src.getHash());
+			if (iter.isValid()) iter.value() = hash;
+			else m_compiled_hashes.insert(src.getHash(), hash);
+			return true;
+		}
+
 		void createResource(OutputMemoryStream& blob) override {
 			Graph graph(Path(), m_editor.m_allocator);
 			graph.addNode<UpdateNode>(graph.m_allocator);
@@ -2012,6 +5408,10 @@ struct VisualScriptEditor : StudioApp::IPlugin, PropertyGrid::IPlugin {
 		}
 
 		VisualScriptEditor& m_editor;
+		// compile runs on asset compiler's worker threads, guards m_compiled_hashes
+		Mutex m_mutex;
+		// hash of the last output written for each source
+		HashMap<FilePathHash, StableHash> m_compiled_hashes;
 	};
 
 	TagAllocator m_allocator;
@@ -8,3 +8,51 @@ int m3l_getGlobalCount(IM3Module module) {
 const char* m3l_getGlobalName(IM3Module module, int idx) {
 	return module->globals[idx].name;
 }
+
+void m3l_getGlobals(IM3Module module, uint64_t* values) {
+	for (u32 i = 0; i < module->numGlobals; ++i) {
+		values[i] = module->globals[i].i64Value;
+	}
+}
+
+void m3l_setGlobals(IM3Module module, const uint64_t* values) {
+	for (u32 i = 0; i < module->numGlobals; ++i) {
+		module->globals[i].i64Value = values[i];
+	}
+}
+
+// wasm3 reads up to 4 slots past the end of stack, keep them out of the usable part
+#define M3L_STACK_PADDING_SLOTS 4
+
+IM3Runtime m3l_newRuntime(IM3Environment env, void* stack, uint32_t stack_size, void* userdata) {
+	IM3Runtime runtime = m3_NewRuntime(env, 0, userdata);
+	if (!runtime) return NULL;
+	m3_Free(runtime->stack);
+	m3l_setStack(runtime, stack, stack_size);
+	return runtime;
+}
+
+void m3l_freeRuntime(IM3Runtime runtime) {
+	if (!runtime) return;
+	runtime->stack = NULL;
+	m3_FreeRuntime(runtime);
+}
+
+void m3l_setStack(IM3Runtime runtime, void* stack, uint32_t stack_size) {
+	const u32 num_slots = stack_size / sizeof(m3slot_t);
+	runtime->stack = stack;
+	runtime->numStackSlots = num_slots > M3L_STACK_PADDING_SLOTS ? num_slots - M3L_STACK_PADDING_SLOTS : 0;
+	if (runtime->memory.mallocated) {
+		runtime->memory.mallocated->maxStack = (m3slot_t*)runtime->stack + runtime->numStackSlots;
+	}
+}
+
+uint32_t m3l_getRequiredStackSize(IM3Module module) {
+	// sum of all frames, so any chain of calls fits since scripts can not recurse
+	u32 num_slots = M3L_STACK_PADDING_SLOTS;
+	for (u32 i = 0; i < module->numFunctions; ++i) {
+		const M3Function* fn = &module->functions[i];
+		num_slots += fn->compiled ? fn->maxStackSlots : fn->numRetAndArgSlots;
+	}
+	return num_slots * sizeof(m3slot_t);
+}
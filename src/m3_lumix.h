@@ -8,7 +8,17 @@ extern "C" {
 
 int m3l_getGlobalCount(IM3Module module);
 const char* m3l_getGlobalName(IM3Module module, int idx);
+// copy raw values of all module's globals to/from `values`, which must have m3l_getGlobalCount elements
+void m3l_getGlobals(IM3Module module, uint64_t* values);
+void m3l_setGlobals(IM3Module module, const uint64_t* values);
+// runtime using caller-owned `stack` of `stack_size` bytes, it's not freed with the runtime
+IM3Runtime m3l_newRuntime(IM3Environment env, void* stack, uint32_t stack_size, void* userdata);
+void m3l_freeRuntime(IM3Runtime runtime);
+// replace runtime's stack, runtime must not be executing
+void m3l_setStack(IM3Runtime runtime, void* stack, uint32_t stack_size);
+// stack size in bytes which is enough to call any function in compiled module, including nested calls
+uint32_t m3l_getRequiredStackSize(IM3Module module);
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
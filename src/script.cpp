@@ -1,7 +1,15 @@
+#include "core/atomic.h"
+#include "core/crt.h"
 #include "core/hash_map.h"
+#include "core/job_system.h"
 #include "core/log.h"
+#include "core/os.h"
 #include "core/profiler.h"
+#include "core/sort.h"
 #include "core/stream.h"
+#include "core/string.h"
+#include "core/sync.h"
+#include "core/tag_allocator.h"
 #include "engine/engine.h"
 #include "engine/input_system.h"
 #include "engine/plugin.h"
@@ -10,20 +18,297 @@
 #include "engine/resource_manager.h"
 #include "engine/world.h"
 #include "script.h"
+#include "m3_lumix.h"
 #include "../external/wasm3.h"
 
 namespace Lumix {
 
 ResourceType ScriptResource::TYPE("script");
 static const ComponentType SCRIPT_TYPE = reflection::getComponentType("script");
+static const char* CALLBACK_NAMES[] = { "update", "start", "onKeyEvent", "onMouseMove", "onMouseButton", "updateBatch", "onTimer", "resume" };
+static_assert(lengthOf(CALLBACK_NAMES) == (u32)ScriptCallback::COUNT);
+static const ScriptCallback EVENT_CALLBACKS[] = { ScriptCallback::ON_KEY_EVENT, ScriptCallback::ON_MOUSE_MOVE, ScriptCallback::ON_MOUSE_BUTTON };
+static_assert(lengthOf(EVENT_CALLBACKS) == (u32)ScriptEvent::COUNT);
+// names scripts import the functions by
+static const char* IMPORT_NAMES[] = {
+	"setYaw",
+	"setPropertyFloat",
+	"getPropertyFloat",
+	"setPropertyI32",
+	"getPropertyI32",
+	"setPropertyVec3",
+	"getPropertyVec3",
+	"setPropertyVec4",
+	"getPropertyVec4",
+	"getPosition",
+	"setPosition",
+	"getRotation",
+	"setRotation",
+	"yawToDir",
+	"callFunction",
+	"queryRadius",
+	"addPropertyFloat",
+	"addPosition",
+	"scheduleTimer",
+	"setResumable"
+};
+static_assert(lengthOf(IMPORT_NAMES) == (u32)ScriptImport::COUNT);
+
+// wasm3 allocates through m3_*_Impl below (d_m3ExternalAllocator), allocations go to the innermost WasmAllocatorScope
+static thread_local IAllocator* g_wasm_allocator = nullptr;
+// used for allocations outside of any scope
+static IAllocator* g_wasm_default_allocator = nullptr;
+
+struct WasmAllocatorScope {
+	WasmAllocatorScope(IAllocator& allocator)
+		: prev(g_wasm_allocator)
+	{
+		g_wasm_allocator = &allocator;
+	}
+	~WasmAllocatorScope() { g_wasm_allocator = prev; }
+
+	IAllocator* prev;
+};
+
+// prefixes each wasm3 allocation, so it can be freed or reallocated in any scope
+struct WasmAllocationHeader {
+	IAllocator* allocator;
+	size_t size;
+};
+static constexpr size_t WASM_ALLOCATION_HEADER_SIZE = 16;
+static_assert(sizeof(WasmAllocationHeader) <= WASM_ALLOCATION_HEADER_SIZE);
+
+static WasmAllocationHeader* getWasmAllocationHeader(void* ptr) {
+	return (WasmAllocationHeader*)((u8*)ptr - WASM_ALLOCATION_HEADER_SIZE);
+}
+
+static void* wasmAllocate(IAllocator& allocator, size_t size) {
+	u8* mem = (u8*)allocator.allocate(size + WASM_ALLOCATION_HEADER_SIZE, 16);
+	if (!mem) return nullptr;
+	WasmAllocationHeader* header = (WasmAllocationHeader*)mem;
+	header->allocator = &allocator;
+	header->size = size;
+	// wasm3 expects zeroed memory
+	memset(mem + WASM_ALLOCATION_HEADER_SIZE, 0, size);
+	return mem + WASM_ALLOCATION_HEADER_SIZE;
+}
+
+extern "C" {
+
+void* m3_Malloc_Impl(size_t size) {
+	IAllocator* allocator = g_wasm_allocator ? g_wasm_allocator : g_wasm_default_allocator;
+	ASSERT(allocator);
+	return wasmAllocate(*allocator, size);
+}
+
+void m3_Free_Impl(void* ptr) {
+	if (!ptr) return;
+	WasmAllocationHeader* header = getWasmAllocationHeader(ptr);
+	header->allocator->deallocate(header);
+}
+
+void* m3_Realloc_Impl(void* ptr, size_t new_size, size_t old_size) {
+	if (!ptr) return m3_Malloc_Impl(new_size);
+	WasmAllocationHeader* header = getWasmAllocationHeader(ptr);
+	if (new_size == header->size) return ptr;
+	
+	void* new_ptr = wasmAllocate(*header->allocator, new_size);
+	if (!new_ptr) return nullptr;
+	memcpy(new_ptr, ptr, minimum(header->size, new_size));
+	header->allocator->deallocate(header);
+	return new_ptr;
+}
+
+}
+
+// interpreter, the default backend, handles are wasm3's own objects
+// callers serialize access to the shared environment, see ScriptModuleImpl::m_wasm_mutex
+struct Wasm3Backend final : ScriptBackend {
+	~Wasm3Backend() {
+		if (m_environment) m3_FreeEnvironment(m_environment);
+	}
+
+	static IM3Runtime toM3(Runtime* runtime) { return (IM3Runtime)runtime; }
+	static IM3Module toM3(Module* module) { return (IM3Module)module; }
+	static IM3Function toM3(Function* function) { return (IM3Function)function; }
+
+	static ValueType toValueType(M3ValueType type) {
+		switch (type) {
+			case c_m3Type_i32: return ValueType::I32;
+			case c_m3Type_i64: return ValueType::I64;
+			case c_m3Type_f32: return ValueType::F32;
+			case c_m3Type_f64: return ValueType::F64;
+			default: return ValueType::NONE;
+		}
+	}
+
+	const char* getName() const override { return "wasm3"; }
+
+	Runtime* createRuntime(void* stack, u32 stack_size, void* userdata) override {
+		// reused by all runtimes, compiled code of cached resources lives in it
+		if (!m_environment) m_environment = m3_NewEnvironment();
+		if (!m_environment) return nullptr;
+		return (Runtime*)m3l_newRuntime(m_environment, stack, stack_size, userdata);
+	}
+
+	void destroyRuntime(Runtime* runtime) override { m3l_freeRuntime(toM3(runtime)); }
+	void setStack(Runtime* runtime, void* stack, u32 stack_size) override { m3l_setStack(toM3(runtime), stack, stack_size); }
+	void* getUserData(Runtime* runtime) override { return m3_GetUserData(toM3(runtime)); }
+
+	M3Result loadModule(Runtime* runtime, Span<const u8> bytecode, Module*& module) override {
+		IM3Module m3_module;
+		const M3Result parse_res = m3_ParseModule(m_environment, &m3_module, bytecode.begin(), bytecode.length());
+		if (parse_res != m3Err_none) return parse_res;
+
+		const M3Result load_res = m3_LoadModule(toM3(runtime), m3_module);
+		if (load_res != m3Err_none) {
+			m3_FreeModule(m3_module);
+			return load_res;
+		}
+		module = (Module*)m3_module;
+		return m3Err_none;
+	}
+
+	M3Result linkFunction(Module* module, const char* module_name, const char* name, M3RawCall function, void* userdata) override {
+		return m3_LinkRawFunctionEx(toM3(module), module_name, name, nullptr, function, userdata);
+	}
+
+	M3Result compile(Module* module) override { return m3_CompileModule(toM3(module)); }
+	u32 getRequiredStackSize(Module* module) override { return m3l_getRequiredStackSize(toM3(module)); }
+
+	M3Result findFunction(Runtime* runtime, const char* name, Function*& function) override {
+		IM3Function m3_function;
+		const M3Result res = m3_FindFunction(&m3_function, toM3(runtime), name);
+		function = res == m3Err_none ? (Function*)m3_function : nullptr;
+		return res;
+	}
+
+	const char* getFunctionName(Function* function) override { return m3_GetFunctionName(toM3(function)); }
+	u32 getArgCount(Function* function) override { return m3_GetArgCount(toM3(function)); }
+	ValueType getArgType(Function* function, u32 idx) override { return toValueType(m3_GetArgType(toM3(function), idx)); }
+	M3Result callVL(Function* function, va_list args) override { return m3_CallVL(toM3(function), args); }
+
+	u8* getMemory(Runtime* runtime, u32& size) override { return m3_GetMemory(toM3(runtime), &size, 0); }
+
+	u32 getGlobalCount(Module* module) override { return (u32)m3l_getGlobalCount(toM3(module)); }
+	const char* getGlobalName(Module* module, u32 idx) override { return m3l_getGlobalName(toM3(module), (int)idx); }
+
+	ValueType getGlobalType(Module* module, u32 idx) override {
+		const char* name = getGlobalName(module, idx);
+		if (!name) return ValueType::NONE;
+		IM3Global global = m3_FindGlobal(toM3(module), name);
+		return global ? toValueType(m3_GetGlobalType(global)) : ValueType::NONE;
+	}
+
+	void getGlobals(Module* module, u64* values) override { m3l_getGlobals(toM3(module), (uint64_t*)values); }
+	void setGlobals(Module* module, const u64* values) override { m3l_setGlobals(toM3(module), (const uint64_t*)values); }
+
+	IM3Environment m_environment = nullptr;
+};
+
+#ifdef LUMIX_PLATFORM_SCRIPT_BACKEND
+	// platforms with a faster runtime define LUMIX_PLATFORM_SCRIPT_BACKEND and implement this, e.g. with a JIT
+	ScriptBackend* createPlatformScriptBackend(IAllocator& allocator);
+#endif
+
+// wasm3 is portable, so it's the default on every platform without its own backend
+static ScriptBackend* createScriptBackend(IAllocator& allocator) {
+	#ifdef LUMIX_PLATFORM_SCRIPT_BACKEND
+		return createPlatformScriptBackend(allocator);
+	#else
+		return LUMIX_NEW(allocator, Wasm3Backend)();
+	#endif
+}
+
+bool getScriptFunctionSignature(const reflection::FunctionBase& function, ScriptFunctionSignature& signature) {
+	signature = {};
+	const u32 arg_count = function.getArgCount();
+	for (u32 i = 0; i < arg_count; ++i) {
+		ScriptValueType type;
+		switch (function.getArgType(i).type) {
+			case reflection::Variant::BOOL:
+			case reflection::Variant::I32:
+			case reflection::Variant::U32: type = ScriptValueType::I32; break;
+			case reflection::Variant::FLOAT: type = ScriptValueType::FLOAT; break;
+			case reflection::Variant::ENTITY: type = ScriptValueType::ENTITY; break;
+			case reflection::Variant::VEC3: type = ScriptValueType::VEC3; break;
+			default: return false;
+		}
+		if (i == 0 && type == ScriptValueType::ENTITY) {
+			signature.takes_entity = true;
+			continue;
+		}
+		if (signature.num_args == ScriptFunctionSignature::MAX_ARGS) return false;
+		signature.args[signature.num_args] = type;
+		++signature.num_args;
+		signature.args_size += (type == ScriptValueType::VEC3 ? 3 : 1) * sizeof(u32);
+	}
+	return signature.args_size <= ScriptResource::SCRATCH_SIZE;
+}
+
+// size in instance record
+static u32 getValueSize(ScriptValueType type) {
+	switch (type) {
+		case ScriptValueType::VEC3: return 3 * sizeof(u32);
+		case ScriptValueType::QUAT:
+		case ScriptValueType::VEC4: return 4 * sizeof(u32);
+		default: return sizeof(u32);
+	}
+}
+
+StableHash getScriptFunctionHash(const char* component_name, const char* function_name) {
+	const StaticString<128> name(component_name, ".", function_name);
+	return StableHash(name.data);
+}
+
+const char* getScriptImportName(ScriptImport import) {
+	return IMPORT_NAMES[(u32)import];
+}
+
+const char* getScriptCallbackName(ScriptCallback callback) {
+	return CALLBACK_NAMES[(u32)callback];
+}
+
+// registered before main by static initializers, so it's never written while modules read it
+static ScriptNative* g_natives = nullptr;
+
+void registerScriptNative(ScriptNative& native) {
+	native.next = g_natives;
+	g_natives = &native;
+}
+
+const ScriptNative* findScriptNative(StableHash bytecode_hash) {
+	for (const ScriptNative* native = g_natives; native; native = native->next) {
+		if (native->bytecode_hash == bytecode_hash) return native;
+	}
+	return nullptr;
+}
 
 void ScriptResource::unload() {
+	// hot reload can unload the resource while a script module compiles it in background
+	jobs::wait(&m_compile_jobs);
 	m_bytecode.clear();
+	m_properties.clear();
+	m_functions.clear();
+	m_profiled_nodes.clear();
+	m_timers.clear();
+	m_update_policy = ScriptUpdatePolicy::INTERVAL;
+	m_update_interval = 1;
+	m_profile_offset = 0;
+	m_stack_size = 0;
+	m_instance_size = 0;
+	m_reserved_memory = SCRATCH_SIZE;
+	m_variables.clear();
 }
 
 ScriptResource::ScriptResource(const Path& path, ResourceManager& resource_manager, IAllocator& allocator)
 	: Resource(path, resource_manager, allocator)
 	, m_bytecode(allocator)
+	, m_properties(allocator)
+	, m_functions(allocator)
+	, m_profiled_nodes(allocator)
+	, m_timers(allocator)
+	, m_variables(allocator)
 	, m_allocator(allocator)
 {}
 
@@ -33,31 +318,649 @@ bool ScriptResource::load(Span<const u8> mem) {
 	blob.read(header);
 	if (header.magic != Header::MAGIC) return false;
 	if (header.version > Version::LAST) return false;
+	if (header.version <= Version::PROPERTY_TABLE) {
+		logError(getPath(), ": unsupported version, recompile the script");
+		return false;
+	}
 
+	if (header.version > Version::STACK_SIZE) m_stack_size = blob.read<u32>();
+	if (header.version > Version::INSTANCE_SIZE) m_instance_size = blob.read<u32>();
+	if (header.version > Version::RESERVED_MEMORY) m_reserved_memory = blob.read<u32>();
+	if (header.version > Version::VARIABLES) {
+		const u32 num_variables = blob.read<u32>();
+		m_variables.reserve(num_variables);
+		for (u32 i = 0; i < num_variables; ++i) {
+			Variable& var = m_variables.emplace(m_allocator);
+			var.name = blob.readString();
+			blob.read(var.type);
+			blob.read(var.offset);
+		}
+	}
+	const u32 num_properties = blob.read<u32>();
+	m_properties.resize(num_properties);
+	blob.read(m_properties.begin(), m_properties.byte_size());
+	if (header.version > Version::FUNCTIONS) {
+		const u32 num_functions = blob.read<u32>();
+		m_functions.resize(num_functions);
+		blob.read(m_functions.begin(), m_functions.byte_size());
+	}
+	if (header.version > Version::PROFILED_NODES) {
+		m_profile_offset = blob.read<u32>();
+		const u32 num_nodes = blob.read<u32>();
+		m_profiled_nodes.resize(num_nodes);
+		blob.read(m_profiled_nodes.begin(), m_profiled_nodes.byte_size());
+	}
+	if (header.version > Version::TIMERS) {
+		const u32 num_timers = blob.read<u32>();
+		m_timers.resize(num_timers);
+		blob.read(m_timers.begin(), m_timers.byte_size());
+	}
+	if (header.version > Version::UPDATE_POLICY) {
+		blob.read(m_update_policy);
+		blob.read(m_update_interval);
+	}
+
+	// `mem` is owned by the file system and freed after load, so the bytecode is kept in our own buffer
 	u32 bytecode_size = u32(blob.remaining());
 	m_bytecode.resize(bytecode_size);
 	blob.read(m_bytecode.getMutableData(), bytecode_size);
+	++m_generation;
 	return true;
 }
 
+Script::Script(EntityRef entity, IAllocator& allocator)
+	: m_entity(entity)
+	, m_globals(allocator)
+	, m_instance(allocator)
+{
+	for (u32& idx : m_subscriptions) idx = U32_MAX;
+}
+
 Script::Script(Script&& script)
+	: m_entity(script.m_entity)
+	, m_globals(static_cast<Array<u64>&&>(script.m_globals))
+	, m_instance(static_cast<Array<u8>&&>(script.m_instance))
 {
+	m_resource_runtime = script.m_resource_runtime;
+	m_reload_from = script.m_reload_from;
 	m_runtime = script.m_runtime;
 	m_module = script.m_module;
 	m_resource = script.m_resource;
 	m_init_failed = script.m_init_failed;
+	m_serial_update = script.m_serial_update;
+	m_generation = script.m_generation;
+	m_update_policy = script.m_update_policy;
+	m_update_interval = script.m_update_interval;
+	m_update_policy_override = script.m_update_policy_override;
+	m_last_update_time = script.m_last_update_time;
+	m_bucket_interval = script.m_bucket_interval;
+	m_bucket_slot = script.m_bucket_slot;
+	m_resumable = script.m_resumable;
+	m_restore = script.m_restore;
+	memcpy(m_callbacks, script.m_callbacks, sizeof(m_callbacks));
+	memcpy(m_subscriptions, script.m_subscriptions, sizeof(m_subscriptions));
 
 	script.m_resource = nullptr;
 	script.m_runtime = nullptr;
 	script.m_module = nullptr;
 }
 
+Script& Script::operator=(Script&& script) {
+	if (m_resource) m_resource->decRefCount();
+	m_entity = script.m_entity;
+	m_resource_runtime = script.m_resource_runtime;
+	m_reload_from = script.m_reload_from;
+	m_runtime = script.m_runtime;
+	m_module = script.m_module;
+	m_resource = script.m_resource;
+	m_init_failed = script.m_init_failed;
+	m_serial_update = script.m_serial_update;
+	m_generation = script.m_generation;
+	m_update_policy = script.m_update_policy;
+	m_update_interval = script.m_update_interval;
+	m_update_policy_override = script.m_update_policy_override;
+	m_last_update_time = script.m_last_update_time;
+	m_bucket_interval = script.m_bucket_interval;
+	m_bucket_slot = script.m_bucket_slot;
+	m_resumable = script.m_resumable;
+	m_restore = script.m_restore;
+	m_globals = static_cast<Array<u64>&&>(script.m_globals);
+	m_instance = static_cast<Array<u8>&&>(script.m_instance);
+	memcpy(m_callbacks, script.m_callbacks, sizeof(m_callbacks));
+	memcpy(m_subscriptions, script.m_subscriptions, sizeof(m_subscriptions));
+
+	script.m_resource = nullptr;
+	script.m_runtime = nullptr;
+	script.m_module = nullptr;
+	return *this;
+}
+
 Script::~Script() {
 	if (m_resource) m_resource->decRefCount();
-	ASSERT(!m_runtime);
-	ASSERT(!m_module);
 }
 
+struct ScriptModuleImpl;
+
+// entry of ScriptResource::m_properties resolved in a world, typed accessor is picked once here instead of on each access
+struct ResolvedProperty {
+	enum class Type : u8 {
+		// the property does not exist or scripts can not access properties of its type
+		NONE,
+		FLOAT,
+		I32,
+		U32,
+		BOOL,
+		ENTITY,
+		VEC3,
+		VEC4
+	};
+
+	// type of script values, i.e. which import family can access the property
+	ScriptValueType getScriptType() const {
+		switch (type) {
+			case Type::FLOAT: return ScriptValueType::FLOAT;
+			case Type::ENTITY: return ScriptValueType::ENTITY;
+			case Type::VEC3: return ScriptValueType::VEC3;
+			case Type::VEC4: return ScriptValueType::VEC4;
+			default: return ScriptValueType::I32;
+		}
+	}
+
+	Type type = Type::NONE;
+	union {
+		const reflection::PropertyBase* base = nullptr;
+		const reflection::Property<float>* f;
+		const reflection::Property<i32>* i;
+		const reflection::Property<u32>* u;
+		const reflection::Property<bool>* b;
+		const reflection::Property<EntityPtr>* e;
+		const reflection::Property<Vec3>* v3;
+		const reflection::Property<Vec4>* v4;
+	};
+	IModule* module = nullptr;
+};
+
+// raw value passed by a script, ints are used by i32, u32, bool and entity properties 
+union PropertyValue {
+	float f[4];
+	i32 i;
+};
+
+static bool isAccessibleAs(const ResolvedProperty& prop, ScriptValueType type) {
+	if (prop.type == ResolvedProperty::Type::NONE) return false;
+	const ScriptValueType prop_type = prop.getScriptType();
+	if (prop_type == type) return true;
+	// entities are i32 in scripts
+	return prop_type == ScriptValueType::ENTITY && type == ScriptValueType::I32;
+}
+
+static void getPropertyValue(const ResolvedProperty& prop, EntityRef entity, PropertyValue& value) {
+	ComponentUID cmp;
+	cmp.entity = entity;
+	cmp.module = prop.module;
+	switch (prop.type) {
+		case ResolvedProperty::Type::NONE: break;
+		case ResolvedProperty::Type::FLOAT: value.f[0] = prop.f->get(cmp, -1); break;
+		case ResolvedProperty::Type::I32: value.i = prop.i->get(cmp, -1); break;
+		case ResolvedProperty::Type::U32: value.i = (i32)prop.u->get(cmp, -1); break;
+		case ResolvedProperty::Type::BOOL: value.i = prop.b->get(cmp, -1) ? 1 : 0; break;
+		case ResolvedProperty::Type::ENTITY: value.i = prop.e->get(cmp, -1).index; break;
+		case ResolvedProperty::Type::VEC3: {
+			const Vec3 v = prop.v3->get(cmp, -1);
+			memcpy(value.f, &v, sizeof(v));
+			break;
+		}
+		case ResolvedProperty::Type::VEC4: {
+			const Vec4 v = prop.v4->get(cmp, -1);
+			memcpy(value.f, &v, sizeof(v));
+			break;
+		}
+	}
+}
+
+static void setPropertyValue(const ResolvedProperty& prop, EntityRef entity, const PropertyValue& value) {
+	ComponentUID cmp;
+	cmp.entity = entity;
+	cmp.module = prop.module;
+	switch (prop.type) {
+		case ResolvedProperty::Type::NONE: break;
+		case ResolvedProperty::Type::FLOAT: prop.f->set(cmp, -1, value.f[0]); break;
+		case ResolvedProperty::Type::I32: prop.i->set(cmp, -1, value.i); break;
+		case ResolvedProperty::Type::U32: prop.u->set(cmp, -1, (u32)value.i); break;
+		case ResolvedProperty::Type::BOOL: prop.b->set(cmp, -1, value.i != 0); break;
+		case ResolvedProperty::Type::ENTITY: {
+			EntityPtr e;
+			e.index = value.i;
+			prop.e->set(cmp, -1, e);
+			break;
+		}
+		case ResolvedProperty::Type::VEC3: prop.v3->set(cmp, -1, Vec3(value.f[0], value.f[1], value.f[2])); break;
+		case ResolvedProperty::Type::VEC4: prop.v4->set(cmp, -1, Vec4(value.f[0], value.f[1], value.f[2], value.f[3])); break;
+	}
+}
+
+// entry of ScriptResource::m_functions resolved in a world
+struct ResolvedFunction {
+	// null if the function does not exist or scripts can not call it
+	const reflection::FunctionBase* function = nullptr;
+	IModule* module = nullptr;
+	ScriptFunctionSignature signature;
+};
+
+// reflected function call recorded by a script, functions can do anything so they are called after all scripts run
+struct DeferredCall {
+	const ResolvedFunction* function;
+	u32 num_args;
+	reflection::Variant args[ScriptFunctionSignature::MAX_ARGS + 1];
+};
+
+// world write recorded by a script, applied after all scripts run
+struct DeferredWrite {
+	enum class Type : u32 {
+		SET_PROPERTY,
+		SET_POSITION,
+		SET_ROTATION
+	};
+
+	Type type;
+	EntityRef entity;
+	const ResolvedProperty* prop;
+	// position and rotation use components of f
+	PropertyValue value;
+	// position in the frame's command buffer, so the last write wins after sorting
+	u32 order;
+
+	bool hasSameTarget(const DeferredWrite& rhs) const {
+		return type == rhs.type && prop == rhs.prop && entity == rhs.entity;
+	}
+};
+
+// timer scheduled by a script, added to ScriptModuleImpl's timing wheel after all scripts run
+struct ScheduledTimer {
+	EntityRef entity;
+	u32 id;
+	float delay;
+};
+
+struct ResumableChange {
+	EntityRef entity;
+	bool resumable;
+};
+
+// scripts updated per instance every `interval` frames, phases[i] are due when frame % interval == i
+struct UpdateBucket {
+	UpdateBucket(u32 interval, IAllocator& allocator)
+		: interval(interval)
+		, phases(allocator)
+	{
+		for (u32 i = 0; i < interval; ++i) phases.emplace(allocator);
+	}
+
+	u32 interval;
+	Array<Array<EntityRef>> phases;
+};
+
+// hierarchical timing wheel, adding a timer and expiring it are O(1) no matter how many timers are pending
+// level 0 has one slot per tick, each next level has one slot per whole lower level,
+// timers are moved to lower levels when their slot comes
+struct TimingWheel {
+	static constexpr u32 SLOT_BITS = 6;
+	static constexpr u32 NUM_SLOTS = 1 << SLOT_BITS;
+	static constexpr u32 NUM_LEVELS = 4;
+	// seconds, the wheel covers NUM_SLOTS ^ NUM_LEVELS ticks, longer timers are moved around the top level
+	static constexpr double TICK = 0.01;
+	// seconds, about 30 years
+	static constexpr double MAX_DELAY = 1e9;
+
+	struct Timer {
+		EntityRef entity;
+		u32 id;
+		// Script::m_generation of the instance which scheduled the timer
+		u32 generation;
+		// 0 for one-shot timers
+		float interval;
+		u64 expires;
+		// next timer in the same slot or free list
+		u32 next;
+	};
+
+	TimingWheel(IAllocator& allocator)
+		: m_timers(allocator)
+	{
+		clear();
+	}
+
+	void clear() {
+		m_timers.clear();
+		m_free = U32_MAX;
+		for (u32& head : m_slots) head = U32_MAX;
+		m_now = 0;
+		m_time = 0;
+	}
+
+	// fires after `delay` seconds, rounded to ticks, but never in the current tick
+	void add(EntityRef entity, u32 id, u32 generation, float delay, float interval) {
+		u32 idx = m_free;
+		if (idx == U32_MAX) {
+			idx = m_timers.size();
+			m_timers.emplace();
+		}
+		else {
+			m_free = m_timers[idx].next;
+		}
+		Timer& timer = m_timers[idx];
+		timer.entity = entity;
+		timer.id = id;
+		timer.generation = generation;
+		timer.interval = interval;
+		// scripts can pass anything, negative and NaN delays fire in the next tick, huge ones must not overflow u64
+		const double clamped = delay > 0 ? minimum((double)delay, MAX_DELAY) : 0.0;
+		timer.expires = m_now + maximum(u64(1), u64(clamped / TICK + 0.5));
+		insert(idx);
+	}
+
+	// calls `f(timer, seconds left)` for each pending timer
+	template <typename F>
+	void forEach(F f) const {
+		for (u32 head : m_slots) {
+			for (u32 idx = head; idx != U32_MAX; idx = m_timers[idx].next) {
+				const Timer& timer = m_timers[idx];
+				f(timer, float(timer.expires * TICK - m_time));
+			}
+		}
+	}
+
+	// moves time forward and puts timers which expired in `expired`
+	void advance(float time_delta, Array<Timer>& expired) {
+		expired.clear();
+		m_time += time_delta;
+		const u64 target = u64(m_time / TICK);
+		while (m_now < target) {
+			++m_now;
+			// higher levels first, so their timers can cascade all the way to level 0 slot of this tick
+			for (u32 level = NUM_LEVELS - 1; level > 0; --level) {
+				if ((m_now & ((u64(1) << (SLOT_BITS * level)) - 1)) != 0) continue;
+				cascade(level, u32(m_now >> (SLOT_BITS * level)) & (NUM_SLOTS - 1));
+			}
+			u32& head = m_slots[m_now & (NUM_SLOTS - 1)];
+			while (head != U32_MAX) {
+				const u32 idx = head;
+				head = m_timers[idx].next;
+				expired.push(m_timers[idx]);
+				m_timers[idx].next = m_free;
+				m_free = idx;
+			}
+		}
+	}
+
+private:
+	// a timer goes to the lowest level on which its expiration differs from now, i.e. into a slot which comes before it expires
+	void insert(u32 idx) {
+		Timer& timer = m_timers[idx];
+		u32 level = 0;
+		while (level < NUM_LEVELS - 1 && (timer.expires >> (SLOT_BITS * (level + 1))) != (m_now >> (SLOT_BITS * (level + 1)))) ++level;
+		const u32 shift = SLOT_BITS * level;
+		u64 slot_tick = timer.expires >> shift;
+		// beyond the wheel, waits in the last top level slot before now's one and is reinserted from there
+		if (slot_tick - (m_now >> shift) >= NUM_SLOTS) slot_tick = (m_now >> shift) - 1;
+		u32& head = m_slots[level * NUM_SLOTS + (u32(slot_tick) & (NUM_SLOTS - 1))];
+		timer.next = head;
+		head = idx;
+	}
+
+	void cascade(u32 level, u32 slot) {
+		u32 idx = m_slots[level * NUM_SLOTS + slot];
+		m_slots[level * NUM_SLOTS + slot] = U32_MAX;
+		while (idx != U32_MAX) {
+			const u32 next = m_timers[idx].next;
+			insert(idx);
+			idx = next;
+		}
+	}
+
+	Array<Timer> m_timers;
+	u32 m_free;
+	u32 m_slots[NUM_LEVELS * NUM_SLOTS];
+	// in ticks
+	u64 m_now;
+	double m_time;
+};
+
+// execution context of a lane, passed to API functions as runtime's userdata
+// lane 0 is the main thread, other lanes are used by parallel update batches
+struct ScriptLane {
+	ScriptLane(ScriptModuleImpl& module, u32 index, IAllocator& allocator)
+		: module(module)
+		, index(index)
+		, writes(allocator)
+		, calls(allocator)
+		, timers(allocator)
+		, resumables(allocator)
+	{}
+
+	ScriptModuleImpl& module;
+	u32 index;
+	// false only on lane 0 while running a script with Script::m_serial_update
+	bool deferred = true;
+	Array<DeferredWrite> writes;
+	Array<DeferredCall> calls;
+	Array<ScheduledTimer> timers;
+	Array<ResumableChange> resumables;
+};
+
+// entities bucketed by position in a uniform grid, so queryRadius visits only entities in cells near the query
+// snapshot of positions, ScriptModuleImpl rebuilds it once positions could have changed
+struct QueryGrid {
+	static constexpr double CELL_SIZE = 8;
+
+	struct Entry {
+		EntityRef entity;
+		DVec3 pos;
+	};
+
+	QueryGrid(IAllocator& allocator)
+		: m_cells(allocator)
+		, m_entries(allocator)
+		, m_next(allocator)
+	{}
+
+	static i64 getCellCoord(double v) {
+		const double c = v / CELL_SIZE;
+		const i64 i = (i64)c;
+		return c < (double)i ? i - 1 : i;
+	}
+
+	// wraps around, entities of different cells with the same key are filtered by distance anyway
+	static u64 getCellKey(i64 x, i64 y, i64 z) {
+		const u64 mask = (u64(1) << 21) - 1;
+		return (u64(x) & mask) | ((u64(y) & mask) << 21) | ((u64(z) & mask) << 42);
+	}
+
+	void build(World& world) {
+		m_cells.clear();
+		m_entries.clear();
+		m_next.clear();
+		for (EntityPtr e = world.getFirstEntity(); e.isValid(); e = world.getNextEntity((EntityRef)e)) {
+			const EntityRef entity = (EntityRef)e;
+			const DVec3 pos = world.getPosition(entity);
+			const u64 key = getCellKey(getCellCoord(pos.x), getCellCoord(pos.y), getCellCoord(pos.z));
+			const u32 idx = m_entries.size();
+			m_entries.push({entity, pos});
+			auto iter = m_cells.find(key);
+			if (iter.isValid()) {
+				m_next.push(iter.value());
+				iter.value() = idx;
+			}
+			else {
+				m_next.push(U32_MAX);
+				m_cells.insert(key, idx);
+			}
+		}
+	}
+
+	// calls `f(entry)` for entities in cells the sphere overlaps, stops when `f` returns false
+	// queries covering more cells than there are entities, and NaN or huge ones, visit all entities
+	template <typename F>
+	void forEach(const DVec3& center, double radius, F f) const {
+		const double span = 2 * radius / CELL_SIZE + 2;
+		const double max_coord = 1e15;
+		const bool use_cells = span * span * span <= (double)m_entries.size()
+			&& center.x > -max_coord && center.x < max_coord
+			&& center.y > -max_coord && center.y < max_coord
+			&& center.z > -max_coord && center.z < max_coord;
+		if (!use_cells) {
+			for (const Entry& entry : m_entries) {
+				if (!f(entry)) return;
+			}
+			return;
+		}
+
+		const DVec3 from = center - DVec3(radius);
+		const DVec3 to = center + DVec3(radius);
+		for (i64 z = getCellCoord(from.z), z_end = getCellCoord(to.z); z <= z_end; ++z) {
+			for (i64 y = getCellCoord(from.y), y_end = getCellCoord(to.y); y <= y_end; ++y) {
+				for (i64 x = getCellCoord(from.x), x_end = getCellCoord(to.x); x <= x_end; ++x) {
+					auto iter = m_cells.find(getCellKey(x, y, z));
+					if (!iter.isValid()) continue;
+					for (u32 i = iter.value(); i != U32_MAX; i = m_next[i]) {
+						if (!f(m_entries[i])) return;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	// first entry of each cell
+	HashMap<u64, u32> m_cells;
+	Array<Entry> m_entries;
+	// next entry in the same cell, parallel to m_entries
+	Array<u32> m_next;
+};
+
+// reuses memory of runtime stacks, sizes are rounded up to power of two so similar scripts can share stacks
+struct StackPool {
+	static constexpr u32 MIN_SIZE = 1024;
+
+	struct Stack {
+		void* mem = nullptr;
+		u32 size = 0;
+	};
+
+	StackPool(IAllocator& allocator)
+		: m_allocator(allocator)
+		, m_free(allocator)
+	{}
+
+	~StackPool() {
+		for (const Stack& stack : m_free) m_allocator.deallocate(stack.mem);
+	}
+
+	static u32 roundSize(u32 size) {
+		u32 res = MIN_SIZE;
+		while (res < size) res <<= 1;
+		return res;
+	}
+
+	Stack alloc(u32 size) {
+		Stack res;
+		res.size = roundSize(size);
+		for (i32 i = m_free.size() - 1; i >= 0; --i) {
+			if (m_free[i].size != res.size) continue;
+			res = m_free[i];
+			m_free.swapAndPop(i);
+			return res;
+		}
+		res.mem = m_allocator.allocate(res.size, 16);
+		return res;
+	}
+
+	void free(const Stack& stack) {
+		if (stack.mem) m_free.push(stack);
+	}
+
+	IAllocator& m_allocator;
+	Array<Stack> m_free;
+};
+
+// runtime with its own copy of the module, so each lane can call scripts without touching other lanes' state
+struct LaneRuntime {
+	ScriptBackend::Runtime* runtime = nullptr;
+	ScriptBackend::Module* module = nullptr;
+	StackPool::Stack stack;
+	ScriptBackend::Function* callbacks[(u32)ScriptCallback::COUNT] = {};
+	// written only by the lane's thread
+	ScriptStats stats;
+};
+
+// scripts subscribed to an event and the event's occurences in current frame
+struct EventQueue {
+	EventQueue(IAllocator& allocator)
+		: subscribers(allocator)
+		, events(allocator)
+	{}
+
+	Array<EntityRef> subscribers;
+	Array<InputSystem::Event> events;
+};
+
+// parsed and compiled module, shared by all instances of a resource
+struct ResourceRuntime {
+	ResourceRuntime(IAllocator& allocator)
+		: initial_globals(allocator)
+		, variables(allocator)
+		, lanes(allocator)
+		, properties(allocator)
+		, functions(allocator)
+		, batch(allocator)
+		, serial_batch(allocator)
+	{}
+
+	u32 self_global = 0;
+	// ScriptResource::m_generation the runtime was compiled from
+	u32 generation = 0;
+	// copy of the resource's variables, to migrate records of this version after the resource is reloaded
+	Array<ScriptResource::Variable> variables;
+	// max number of instance records which fit in linear memory
+	u32 max_batch_size = 0;
+	// indices of this frame's instances in m_scripts, for updateBatch
+	Array<u32> batch;
+	// same as `batch` for instances with Script::m_serial_update, each gets its own updateBatch with a single record
+	Array<u32> serial_batch;
+	Array<u64> initial_globals;
+	// indexed by ScriptLane::index, lanes other than 0 are created on first parallel update
+	Array<LaneRuntime> lanes;
+	// indexed by property index baked in the bytecode, passed to property imports as their userdata
+	Array<ResolvedProperty> properties;
+	// indexed by function index baked in the bytecode
+	Array<ResolvedFunction> functions;
+	// native code of the bytecode, if the game was built with it
+	const ScriptNative* native = nullptr;
+	// created runtimes in `lanes`, host functions find their lane through it
+	ScriptBackend* backend = nullptr;
+	// time since last updateBatch, batched instances are due together
+	float skipped_time = 0;
+	bool failed = false;
+	// nonzero while compiled by a background job, nothing but the job can touch the runtime until then
+	AtomicI32 compiling = 0;
+};
+
+enum class ScriptModuleVersion : i32 {
+	SERIAL_UPDATE,
+	INSTANCE_STATE,
+
+	LATEST
+};
+
+enum class ScriptRegion : u32 {
+	// instantiated and has update callback
+	RUNNABLE,
+	// does not need update - no resource, failed or instantiated without update callback
+	IDLE,
+	// waiting for its resource to load
+	PENDING
+};
+
 struct ScriptModuleImpl : ScriptModule {
 	ScriptModuleImpl(ISystem& system, Engine& engine, World& world, IAllocator& allocator)
 		: m_system(system)
@@ -65,34 +968,408 @@ struct ScriptModuleImpl : ScriptModule {
 		, m_engine(engine)
 		, m_allocator(allocator)
 		, m_scripts(allocator)
-		, m_mouse_move_scripts(allocator)
-		, m_key_input_scripts(allocator)
-	{}
+		, m_script_indices(allocator)
+		, m_event_queues(allocator)
+		, m_resource_runtimes(allocator)
+		, m_lanes(allocator)
+		, m_writes(allocator)
+		, m_wasm_allocator(allocator, "wasm3")
+		, m_stack_pool(m_wasm_allocator)
+		, m_prewarm_queue(allocator)
+		, m_retired_runtimes(allocator)
+		, m_timing_wheel(allocator)
+		, m_expired_timers(allocator)
+		, m_restored_timers(allocator)
+		, m_update_buckets(allocator)
+		, m_due(allocator)
+		, m_query_grid(allocator)
+	{
+		m_backend = createScriptBackend(m_allocator);
+		m_lanes.push(LUMIX_NEW(m_allocator, ScriptLane)(*this, 0, m_allocator));
+		for (u32 i = 0; i < (u32)ScriptEvent::COUNT; ++i) m_event_queues.emplace(m_allocator);
+	}
+
+	~ScriptModuleImpl() {
+		waitForCompileJobs();
+		WasmAllocatorScope allocator_scope(m_wasm_allocator);
+		for (ResourceRuntime* rt : m_retired_runtimes) LUMIX_DELETE(m_allocator, rt);
+		for (ScriptResource* resource : m_prewarm_queue) resource->decRefCount();
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			destroyResourceRuntime(*iter.key(), iter.value());
+		}
+		for (ScriptLane* lane : m_lanes) {
+			LUMIX_DELETE(m_allocator, lane);
+		}
+		LUMIX_DELETE(m_allocator, m_backend);
+	}
 
 	const char* getName() const override { return "script"; }
+	i32 getVersion() const override { return (i32)ScriptModuleVersion::LATEST; }
 
-	void tryCall(EntityRef entity, const char* function_name, ...) {
-		Script& scr = m_scripts[entity];
+	// instances share the module, so their state must be swapped in and out around each call
+	void loadInstance(ScriptBackend::Runtime* runtime, ScriptBackend::Module* module, const Script& script) {
+		m_backend->setGlobals(module, script.m_globals.begin());
+		if (script.m_instance.empty()) return;
+		u32 mem_size;
+		u8* mem = m_backend->getMemory(runtime, mem_size);
+		memcpy(mem, script.m_instance.begin(), script.m_instance.size());
+	}
+
+	void storeInstance(ScriptBackend::Runtime* runtime, ScriptBackend::Module* module, Script& script) {
+		m_backend->getGlobals(module, script.m_globals.begin());
+		if (script.m_instance.empty()) return;
+		u32 mem_size;
+		const u8* mem = m_backend->getMemory(runtime, mem_size);
+		memcpy(script.m_instance.begin(), mem, script.m_instance.size());
+	}
+
+	// lane running the host function, runtimes are created with their lane as userdata
+	static ScriptLane* getLane(IM3Runtime runtime, IM3ImportContext ctx) {
+		const ResourceRuntime* rt = (const ResourceRuntime*)ctx->userdata;
+		return (ScriptLane*)rt->backend->getUserData((ScriptBackend::Runtime*)runtime);
+	}
+
+	// m3ApiCheckMem asks wasm3 for the memory size, this asks the backend
+	static bool isInMemory(IM3Runtime runtime, IM3ImportContext ctx, const void* mem, const void* ptr, u64 size) {
+		const ResourceRuntime* rt = (const ResourceRuntime*)ctx->userdata;
+		u32 mem_size;
+		rt->backend->getMemory((ScriptBackend::Runtime*)runtime, mem_size);
+		return (const u8*)ptr >= (const u8*)mem && (u64)((const u8*)ptr - (const u8*)mem) + size <= mem_size;
+	}
+
+	// indexed by ScriptImport, linked to modules and called directly by native code
+	static const M3RawCall* getImportFunctions() {
+		#define IMPORT(F, I) &ScriptModuleImpl::API_counted<&ScriptModuleImpl::API_##F, ScriptImport::I>
+		static const M3RawCall functions[] = {
+			IMPORT(setYaw, SET_YAW),
+			IMPORT(setPropertyFloat, SET_PROPERTY_FLOAT),
+			IMPORT(getPropertyFloat, GET_PROPERTY_FLOAT),
+			IMPORT(setPropertyI32, SET_PROPERTY_I32),
+			IMPORT(getPropertyI32, GET_PROPERTY_I32),
+			IMPORT(setPropertyVec3, SET_PROPERTY_VEC3),
+			IMPORT(getPropertyVec3, GET_PROPERTY_VEC3),
+			IMPORT(setPropertyVec4, SET_PROPERTY_VEC4),
+			IMPORT(getPropertyVec4, GET_PROPERTY_VEC4),
+			IMPORT(getPosition, GET_POSITION),
+			IMPORT(setPosition, SET_POSITION),
+			IMPORT(getRotation, GET_ROTATION),
+			IMPORT(setRotation, SET_ROTATION),
+			IMPORT(yawToDir, YAW_TO_DIR),
+			IMPORT(callFunction, CALL_FUNCTION),
+			IMPORT(queryRadius, QUERY_RADIUS),
+			IMPORT(addPropertyFloat, ADD_PROPERTY_FLOAT),
+			IMPORT(addPosition, ADD_POSITION),
+			IMPORT(scheduleTimer, SCHEDULE_TIMER),
+			IMPORT(setResumable, SET_RESUMABLE)
+		};
+		#undef IMPORT
+		static_assert(lengthOf(functions) == (u32)ScriptImport::COUNT);
+		return functions;
+	}
+
+	// native code of `fn`'s callback, null if `fn` must be run by the backend
+	ScriptNativeFunction getNativeFunction(ScriptBackend::Runtime* runtime, const ResourceRuntime& rt, ScriptBackend::Function* fn) {
+		if (!rt.native) return nullptr;
+		const ScriptLane* lane = (ScriptLane*)m_backend->getUserData(runtime);
+		if (lane->index >= (u32)rt.lanes.size()) return nullptr;
+		const LaneRuntime& lane_rt = rt.lanes[lane->index];
+		for (u32 i = 0; i < (u32)ScriptCallback::COUNT; ++i) {
+			if (lane_rt.callbacks[i] == fn) return rt.native->callbacks[i];
+		}
+		return nullptr;
+	}
+
+	// runs `fn` natively if the game was built with native code of `rt`'s bytecode, by the backend otherwise
+	// native code works on the same linear memory, so callers swap instances in and out the same way for both
+	// every path running script code (update, batches, events, timers, lane jobs) ends here, so wasm3's allocations
+	// during a call (e.g. memory.grow) go to m_wasm_allocator whichever thread runs it
+	M3Result invokeVL(ScriptBackend::Runtime* runtime, ResourceRuntime& rt, ScriptBackend::Function* fn, va_list args) {
+		WasmAllocatorScope allocator_scope(m_wasm_allocator);
+		const ScriptNativeFunction native_fn = getNativeFunction(runtime, rt, fn);
+		if (!native_fn) return m_backend->callVL(fn, args);
+
+		u64 slots[8] = {};
+		const u32 num_args = m_backend->getArgCount(fn);
+		if (num_args > lengthOf(slots)) return m3Err_argumentCountMismatch;
+		for (u32 i = 0; i < num_args; ++i) {
+			switch (m_backend->getArgType(fn, i)) {
+				case ScriptBackend::ValueType::I32: slots[i] = (u32)va_arg(args, i32); break;
+				case ScriptBackend::ValueType::I64: slots[i] = va_arg(args, u64); break;
+				case ScriptBackend::ValueType::F32: {
+					const float f = (float)va_arg(args, double);
+					memcpy(&slots[i], &f, sizeof(f));
+					break;
+				}
+				case ScriptBackend::ValueType::F64: {
+					const double d = va_arg(args, double);
+					memcpy(&slots[i], &d, sizeof(d));
+					break;
+				}
+				default: return m3Err_argumentTypeMismatch;
+			}
+		}
+
+		// raw functions get the same userdata they are linked with
+		M3ImportContext import_context = { &rt, nullptr };
+		ScriptNativeContext ctx;
+		ctx.runtime = runtime;
+		ctx.import_context = &import_context;
+		u32 mem_size;
+		ctx.memory = m_backend->getMemory(runtime, mem_size);
+		ctx.imports = getImportFunctions();
+		return native_fn(ctx, slots);
+	}
+
+	M3Result invoke(ScriptBackend::Runtime* runtime, ResourceRuntime& rt, ScriptBackend::Function* fn, ...) {
 		va_list ap;
-		va_start(ap, function_name);
-		IM3Function fn;
-		M3Result find_res = m3_FindFunction(&fn, scr.m_runtime, function_name);
-		if (find_res == m3Err_none) {
-			PROFILE_BLOCK("tryCall");
-			m3_CallVL(fn, ap);
+		va_start(ap, fn);
+		const M3Result res = invokeVL(runtime, rt, fn, ap);
+		va_end(ap);
+		return res;
+	}
+
+	// calls `fn` of an instance already loaded in `runtime`, in a profiler block and counted in stats
+	M3Result invokeInstanceVL(ScriptBackend::Runtime* runtime, Script& script, ScriptBackend::Function* fn, va_list args) {
+		// block names must be static, resource and callback are copied to the profiler's buffer instead
+		profiler::beginBlock("script call");
+		profiler::pushString(script.m_resource->getPath().c_str());
+		profiler::pushString(m_backend->getFunctionName(fn));
+		ScriptLane* lane = (ScriptLane*)m_backend->getUserData(runtime);
+		M3Result res;
+		if (m_collect_stats) {
+			os::Timer timer;
+			res = invokeVL(runtime, *script.m_resource_runtime, fn, args);
+			ScriptStats& stats = script.m_resource_runtime->lanes[lane->index].stats;
+			stats.call_time += timer.getTimeSinceStart();
+			++stats.calls;
 		}
-		else if (find_res != m3Err_functionLookupFailed) {
-			logError(scr.m_resource->getPath(), ": ", find_res);
+		else {
+			res = invokeVL(runtime, *script.m_resource_runtime, fn, args);
 		}
+		profiler::endBlock();
+		return res;
+	}
+
+	M3Result invokeInstance(ScriptBackend::Runtime* runtime, Script& script, ScriptBackend::Function* fn, ...) {
+		va_list ap;
+		va_start(ap, fn);
+		const M3Result res = invokeInstanceVL(runtime, script, fn, ap);
+		va_end(ap);
+		return res;
+	}
+
+	M3Result callVL(ScriptBackend::Runtime* runtime, ScriptBackend::Module* module, Script& script, ScriptBackend::Function* fn, va_list args) {
+		loadInstance(runtime, module, script);
+		const M3Result res = invokeInstanceVL(runtime, script, fn, args);
+		storeInstance(runtime, module, script);
+		return res;
+	}
+
+	M3Result callVL(Script& script, ScriptBackend::Function* fn, va_list args) {
+		ScriptLane* lane = (ScriptLane*)m_backend->getUserData(script.m_runtime);
+		lane->deferred = !script.m_serial_update;
+		return callVL(script.m_runtime, script.m_module, script, fn, args);
+	}
+
+	M3Result call(Script& script, ScriptBackend::Function* fn, ...) {
+		va_list ap;
+		va_start(ap, fn);
+		const M3Result res = callVL(script, fn, ap);
+		va_end(ap);
+		return res;
+	}
+
+	M3Result call(const LaneRuntime& lane, Script& script, ScriptBackend::Function* fn, ...) {
+		va_list ap;
+		va_start(ap, fn);
+		const M3Result res = callVL(lane.runtime, lane.module, script, fn, ap);
 		va_end(ap);
+		return res;
+	}
+
+	void subscribe(Script& script, ScriptEvent event) {
+		Array<EntityRef>& subscribers = m_event_queues[(u32)event].subscribers;
+		script.m_subscriptions[(u32)event] = subscribers.size();
+		subscribers.push(script.m_entity);
+	}
+
+	void unsubscribe(Script& script) {
+		for (u32 i = 0; i < (u32)ScriptEvent::COUNT; ++i) {
+			const u32 idx = script.m_subscriptions[i];
+			if (idx == U32_MAX) continue;
+
+			Array<EntityRef>& subscribers = m_event_queues[i].subscribers;
+			subscribers.swapAndPop(idx);
+			if (idx < (u32)subscribers.size()) getScript(subscribers[idx]).m_subscriptions[i] = idx;
+			script.m_subscriptions[i] = U32_MAX;
+		}
+	}
+
+	// the instance must be loaded, see dispatchEvents
+	M3Result callEvent(Script& script, ScriptEvent event, ScriptBackend::Function* fn, const InputSystem::Event& e) {
+		switch (event) {
+			case ScriptEvent::KEY: return invokeInstance(script.m_runtime, script, fn, e.data.button.key_id);
+			case ScriptEvent::MOUSE_MOVE: return invokeInstance(script.m_runtime, script, fn, e.data.axis.x, e.data.axis.y);
+			case ScriptEvent::MOUSE_BUTTON: return invokeInstance(script.m_runtime, script, fn, e.data.button.key_id, (i32)e.data.button.down);
+			case ScriptEvent::COUNT: break;
+		}
+		ASSERT(false);
+		return m3Err_none;
+	}
+
+	// each subscriber gets all of the frame's events of a kind, with its globals swapped in only once
+	void dispatchEvents() {
+		PROFILE_FUNCTION();
+		for (u32 i = 0; i < (u32)ScriptEvent::COUNT; ++i) {
+			const EventQueue& queue = m_event_queues[i];
+			if (queue.events.empty()) continue;
+
+			const ScriptEvent event = (ScriptEvent)i;
+			for (EntityRef e : queue.subscribers) {
+				Script& script = getScript(e);
+				ScriptBackend::Function* fn = script.m_callbacks[(u32)EVENT_CALLBACKS[i]];
+				ScriptLane* lane = (ScriptLane*)m_backend->getUserData(script.m_runtime);
+				lane->deferred = !script.m_serial_update;
+				loadInstance(script.m_runtime, script.m_module, script);
+				for (const InputSystem::Event& input_event : queue.events) {
+					const M3Result res = callEvent(script, event, fn, input_event);
+					if (res != m3Err_none) {
+						logError(script.m_resource->getPath(), ": ", res);
+						break;
+					}
+				}
+				storeInstance(script.m_runtime, script.m_module, script);
+			}
+		}
 	}
 
 	void serialize(OutputMemoryStream& blob) override {
 		blob.write(m_scripts.size());
-		for (auto iter = m_scripts.begin(), end = m_scripts.end(); iter != end; ++iter) {
-			blob.write(iter.key());
-			ScriptResource* res = iter.value().m_resource;
+		for (const Script& script : m_scripts) {
+			blob.write(script.m_entity);
+			ScriptResource* res = script.m_resource;
 			blob.writeString(res ? res->getPath().c_str() : "");
+			blob.write(script.m_serial_update);
+		}
+		serializeInstances(blob);
+	}
+
+	// state of running instances, grouped by resource so each group is a few contiguous blocks:
+	// entities, resumable flags, globals and records; one-shot timers follow all groups
+	void serializeInstances(OutputMemoryStream& blob) {
+		Array<u32> indices(m_allocator);
+		for (u32 i = 0; i < m_first_pending; ++i) {
+			const Script& script = m_scripts[i];
+			if (script.m_resource_runtime && !script.m_init_failed) indices.push(i);
+		}
+		// grouped by resource, ordered by path and entity so saving the same world gives the same blob
+		sort(indices.begin(), indices.end(), [&](u32 a, u32 b){
+			const Script& sa = m_scripts[a];
+			const Script& sb = m_scripts[b];
+			if (sa.m_resource != sb.m_resource) return compareString(sa.m_resource->getPath().c_str(), sb.m_resource->getPath().c_str()) < 0;
+			return sa.m_entity.index < sb.m_entity.index;
+		});
+
+		u32 num_groups = 0;
+		for (u32 i = 0; i < (u32)indices.size(); ++i) {
+			if (i == 0 || m_scripts[indices[i]].m_resource != m_scripts[indices[i - 1]].m_resource) ++num_groups;
+		}
+		blob.write(num_groups);
+		for (u32 from = 0; from < (u32)indices.size();) {
+			const ScriptResource* resource = m_scripts[indices[from]].m_resource;
+			u32 to = from + 1;
+			while (to < (u32)indices.size() && m_scripts[indices[to]].m_resource == resource) ++to;
+			
+			// instances of one resource have the same globals and record size
+			const Script& first = m_scripts[indices[from]];
+			blob.write(to - from);
+			blob.write(first.m_globals.size());
+			blob.write(first.m_instance.size());
+			// entity variables are remapped on load
+			u32 num_entity_vars = 0;
+			for (const ScriptResource::Variable& var : resource->m_variables) {
+				if (var.type == ScriptValueType::ENTITY) ++num_entity_vars;
+			}
+			blob.write(num_entity_vars);
+			for (const ScriptResource::Variable& var : resource->m_variables) {
+				if (var.type == ScriptValueType::ENTITY) blob.write(var.offset);
+			}
+			for (u32 i = from; i < to; ++i) blob.write(m_scripts[indices[i]].m_entity);
+			for (u32 i = from; i < to; ++i) blob.write(m_scripts[indices[i]].m_resumable);
+			for (u32 i = from; i < to; ++i) blob.write(m_scripts[indices[i]].m_globals.begin(), m_scripts[indices[i]].m_globals.byte_size());
+			for (u32 i = from; i < to; ++i) blob.write(m_scripts[indices[i]].m_instance.begin(), m_scripts[indices[i]].m_instance.byte_size());
+			from = to;
+		}
+
+		// repeating timers are started again with the instance
+		u32 num_timers = 0;
+		m_timing_wheel.forEach([&](const TimingWheel::Timer& timer, float){
+			if (timer.interval == 0 && isTimerLive(timer)) ++num_timers;
+		});
+		blob.write(num_timers);
+		m_timing_wheel.forEach([&](const TimingWheel::Timer& timer, float remaining){
+			if (timer.interval != 0 || !isTimerLive(timer)) return;
+			ScheduledTimer t = {timer.entity, timer.id, remaining};
+			blob.write(t);
+		});
+	}
+
+	void deserializeInstances(InputMemoryStream& blob, const EntityMap& entity_map) {
+		Array<u32> entity_offsets(m_allocator);
+		const u32 num_groups = blob.read<u32>();
+		for (u32 group = 0; group < num_groups; ++group) {
+			const u32 count = blob.read<u32>();
+			const u32 num_globals = blob.read<u32>();
+			const u32 instance_size = blob.read<u32>();
+			entity_offsets.resize(blob.read<u32>());
+			blob.read(entity_offsets.begin(), entity_offsets.byte_size());
+
+			// scripts of the group, in the order they are stored
+			Array<Script*> scripts(m_allocator);
+			scripts.reserve(count);
+			for (u32 i = 0; i < count; ++i) {
+				EntityRef e;
+				blob.read(e);
+				e = entity_map.get(e);
+				auto iter = m_script_indices.find(e);
+				scripts.push(iter.isValid() ? &m_scripts[iter.value()] : nullptr);
+			}
+			for (Script* script : scripts) {
+				bool resumable;
+				blob.read(resumable);
+				if (script) script->m_resumable = resumable;
+			}
+			for (Script* script : scripts) {
+				if (!script) {
+					blob.skip(num_globals * sizeof(u64));
+					continue;
+				}
+				script->m_globals.resize(num_globals);
+				blob.read(script->m_globals.begin(), script->m_globals.byte_size());
+			}
+			for (Script* script : scripts) {
+				if (!script) {
+					blob.skip(instance_size);
+					continue;
+				}
+				script->m_instance.resize(instance_size);
+				blob.read(script->m_instance.begin(), instance_size);
+				script->m_restore = true;
+				for (u32 offset : entity_offsets) {
+					EntityPtr entity;
+					memcpy(&entity.index, script->m_instance.begin() + offset, sizeof(entity.index));
+					entity = entity_map.get(entity);
+					memcpy(script->m_instance.begin() + offset, &entity.index, sizeof(entity.index));
+				}
+			}
+		}
+
+		const u32 num_timers = blob.read<u32>();
+		m_restored_timers.reserve(m_restored_timers.size() + num_timers);
+		for (u32 i = 0; i < num_timers; ++i) {
+			ScheduledTimer& timer = m_restored_timers.emplace();
+			blob.read(timer);
+			timer.entity = entity_map.get(timer.entity);
 		}
 	}
 
@@ -105,227 +1382,1435 @@ struct ScriptModuleImpl : ScriptModule {
 			blob.read(e);
 			e = entity_map.get(e);
 			const char* path = blob.readString();
-			Script script;
-			script.m_resource = path[0] ? rm.load<ScriptResource>(Path(path)) : nullptr;
-			m_scripts.insert(e, static_cast<Script&&>(script));
+			Script& script = addScript(e);
+			if (version > (i32)ScriptModuleVersion::SERIAL_UPDATE) blob.read(script.m_serial_update);
+			if (path[0]) script.m_resource = rm.load<ScriptResource>(Path(path));
+			else moveScript(m_scripts.size() - 1, ScriptRegion::IDLE);
 			m_world.onComponentCreated(e, SCRIPT_TYPE, this);
 		}
+		if (version > (i32)ScriptModuleVersion::INSTANCE_STATE) deserializeInstances(blob, entity_map);
 	}
 
 	ISystem& getSystem() const override { return m_system; }
 	World& getWorld() override { return m_world; }
 
+	// instances are torn down, compiled resources stay cached so the next start does not need to recompile them
 	void stopGame() override {
 		m_is_game_running = false;
-		m_mouse_move_scripts.clear();
-		m_key_input_scripts.clear();
+		for (EventQueue& queue : m_event_queues) {
+			queue.subscribers.clear();
+			queue.events.clear();
+		}
+		m_timing_wheel.clear();
+		m_restored_timers.clear();
+		for (ScriptLane* lane : m_lanes) {
+			lane->timers.clear();
+			lane->resumables.clear();
+		}
+
+		for (Script& script : m_scripts) {
+			resetInstance(script);
+			script.m_bucket_interval = 0;
+		}
+		m_update_buckets.clear();
+		freeRetiredRuntimes();
+		// all instantiated scripts are idle now and those with a resource are instantiated again on next start
+		m_num_runnable = 0;
+		for (i32 i = m_first_pending - 1; i >= 0; --i) {
+			if (m_scripts[i].m_resource) moveScript(i, ScriptRegion::PENDING);
+		}
+
+		// give resources which failed a chance to be fixed before the next start
+		waitForCompileJobs();
+		Array<ScriptResource*> failed(m_allocator);
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			if (iter.value()->failed) failed.push(iter.key());
+		}
+		for (ScriptResource* resource : failed) {
+			destroyResourceRuntime(*resource, m_resource_runtimes[resource]);
+			m_resource_runtimes.erase(resource);
+		}
 	}
 
 	void startGame() override {
 		m_is_game_running = true;
-		m_environment = m3_NewEnvironment();
 	}
 
-	void onKeyEvent(const InputSystem::Event& event) {
-		for (EntityRef e : m_key_input_scripts) {
-			tryCall(e, "onKeyEvent", event.data.button.key_id);
-		}
+	// properties which are missing or have other type than the import read as zeros and ignore writes
+	static void setProperty(ScriptLane& lane, const ResolvedProperty& prop, ScriptValueType type, EntityRef entity, const PropertyValue& value) {
+		if (!isAccessibleAs(prop, type)) return;
+		if (lane.deferred) {
+			lane.writes.push({DeferredWrite::Type::SET_PROPERTY, entity, &prop, value});
+			return;
+		}
+		setPropertyValue(prop, entity, value);
+	}
+
+	static PropertyValue getProperty(const ResolvedProperty& prop, ScriptValueType type, EntityRef entity) {
+		PropertyValue value = {};
+		if (isAccessibleAs(prop, type)) getPropertyValue(prop, entity, value);
+		return value;
+	}
+
+	static m3ApiRawFunction(API_getPropertyFloat) {
+		m3ApiReturnType(float);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+		
+		m3ApiReturn(getProperty(rt->properties[prop_idx], ScriptValueType::FLOAT, entity).f[0]);
+	}
+
+	static m3ApiRawFunction(API_setPropertyFloat) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		PropertyValue value;
+		m3ApiGetArg(float, x);
+		value.f[0] = x;
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		setProperty(*lane, rt->properties[prop_idx], ScriptValueType::FLOAT, entity, value);
+		return m3Err_none;
+	}
+
+	// fused getPropertyFloat, add and setPropertyFloat, emitted by the compiler for read-modify-writes
+	static m3ApiRawFunction(API_addPropertyFloat) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		m3ApiGetArg(float, delta);
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		const ResolvedProperty& prop = rt->properties[prop_idx];
+		PropertyValue value = getProperty(prop, ScriptValueType::FLOAT, entity);
+		value.f[0] += delta;
+		setProperty(*lane, prop, ScriptValueType::FLOAT, entity, value);
+		return m3Err_none;
+	}
+
+	static m3ApiRawFunction(API_getPropertyI32) {
+		m3ApiReturnType(i32);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+		
+		m3ApiReturn(getProperty(rt->properties[prop_idx], ScriptValueType::I32, entity).i);
+	}
+
+	static m3ApiRawFunction(API_setPropertyI32) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		PropertyValue value;
+		m3ApiGetArg(i32, v);
+		value.i = v;
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		setProperty(*lane, rt->properties[prop_idx], ScriptValueType::I32, entity, value);
+		return m3Err_none;
+	}
+
+	static m3ApiRawFunction(API_getPropertyVec3) {
+		m3ApiMultiValueReturnType(float, x);
+		m3ApiMultiValueReturnType(float, y);
+		m3ApiMultiValueReturnType(float, z);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		const PropertyValue value = getProperty(rt->properties[prop_idx], ScriptValueType::VEC3, entity);
+		m3ApiMultiValueReturn(x, value.f[0]);
+		m3ApiMultiValueReturn(y, value.f[1]);
+		m3ApiMultiValueReturn(z, value.f[2]);
+		m3ApiSuccess();
+	}
+
+	static m3ApiRawFunction(API_setPropertyVec3) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		PropertyValue value = {};
+		for (u32 i = 0; i < 3; ++i) {
+			m3ApiGetArg(float, v);
+			value.f[i] = v;
+		}
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		setProperty(*lane, rt->properties[prop_idx], ScriptValueType::VEC3, entity, value);
+		return m3Err_none;
+	}
+
+	static m3ApiRawFunction(API_getPropertyVec4) {
+		m3ApiMultiValueReturnType(float, x);
+		m3ApiMultiValueReturnType(float, y);
+		m3ApiMultiValueReturnType(float, z);
+		m3ApiMultiValueReturnType(float, w);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		const PropertyValue value = getProperty(rt->properties[prop_idx], ScriptValueType::VEC4, entity);
+		m3ApiMultiValueReturn(x, value.f[0]);
+		m3ApiMultiValueReturn(y, value.f[1]);
+		m3ApiMultiValueReturn(z, value.f[2]);
+		m3ApiMultiValueReturn(w, value.f[3]);
+		m3ApiSuccess();
+	}
+
+	static m3ApiRawFunction(API_setPropertyVec4) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, prop_idx);
+		PropertyValue value;
+		for (u32 i = 0; i < 4; ++i) {
+			m3ApiGetArg(float, v);
+			value.f[i] = v;
+		}
+		if (prop_idx >= (u32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		setProperty(*lane, rt->properties[prop_idx], ScriptValueType::VEC4, entity, value);
+		return m3Err_none;
+	}
+
+	// linked in place of `F`, counts calls of `F` in the calling lane's stats
+	// always linked, so stats can be toggled without recompiling scripts
+	template <M3RawCall F, ScriptImport I>
+	static m3ApiRawFunction(API_counted) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		if (lane->module.m_collect_stats) {
+			ResourceRuntime* rt = (ResourceRuntime*)_ctx->userdata;
+			++rt->lanes[lane->index].stats.import_calls[(u32)I];
+		}
+		return F(runtime, _ctx, _sp, _mem);
+	}
+
+	// single import for all reflected functions, `fn_idx` is index in ResourceRuntime::functions
+	static m3ApiRawFunction(API_callFunction) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(u32, fn_idx);
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArgMem(const u8*, args);
+		if (fn_idx >= (u32)rt->functions.size()) m3ApiTrap("invalid function index");
+
+		const ResolvedFunction& fn = rt->functions[fn_idx];
+		if (!fn.function) return m3Err_none;
+		if (!isInMemory(runtime, _ctx, _mem, args, fn.signature.args_size)) m3ApiTrap(m3Err_trapOutOfBoundsMemoryAccess);
+
+		DeferredCall call;
+		call.function = &fn;
+		call.num_args = 0;
+		if (fn.signature.takes_entity) call.args[call.num_args++] = EntityPtr(entity);
+		for (u32 i = 0; i < fn.signature.num_args; ++i) {
+			reflection::Variant& arg = call.args[call.num_args];
+			switch (fn.function->getArgType(call.num_args).type) {
+				case reflection::Variant::BOOL: arg = readArg<i32>(args) != 0; break;
+				case reflection::Variant::I32: arg = readArg<i32>(args); break;
+				case reflection::Variant::U32: arg = readArg<u32>(args); break;
+				case reflection::Variant::FLOAT: arg = readArg<float>(args); break;
+				case reflection::Variant::ENTITY: {
+					EntityPtr e;
+					e.index = readArg<i32>(args);
+					arg = e;
+					break;
+				}
+				case reflection::Variant::VEC3: arg = readArg<Vec3>(args); break;
+				default: ASSERT(false); break;
+			}
+			++call.num_args;
+		}
+
+		if (lane->deferred) {
+			lane->calls.push(call);
+			return m3Err_none;
+		}
+		// functions can move entities
+		lane->module.invalidateQueryGrid();
+		invoke(call);
+		return m3Err_none;
+	}
+
+	template <typename T>
+	static T readArg(const u8*& args) {
+		T value;
+		memcpy(&value, args, sizeof(value));
+		args += sizeof(value);
+		return value;
+	}
+
+	static void invoke(DeferredCall& call) {
+		call.function->function->invoke(call.function->module, Span(call.args, call.num_args));
+	}
+
+	// writes entities within `radius` into `records`, if `prop_idx` >= 0 only those with the property, returns their count
+	static m3ApiRawFunction(API_queryRadius) {
+		m3ApiReturnType(u32);
+		ScriptLane* lane = getLane(runtime, _ctx);
+		const ResourceRuntime* rt = (const ResourceRuntime*)_ctx->userdata;
+		m3ApiGetArg(float, x);
+		m3ApiGetArg(float, y);
+		m3ApiGetArg(float, z);
+		m3ApiGetArg(float, radius);
+		m3ApiGetArg(i32, prop_idx);
+		m3ApiGetArgMem(u8*, records);
+		m3ApiGetArg(u32, capacity);
+		if (!isInMemory(runtime, _ctx, _mem, records, capacity * sizeof(ScriptQueryRecord))) m3ApiTrap(m3Err_trapOutOfBoundsMemoryAccess);
+		if (prop_idx >= (i32)rt->properties.size()) m3ApiTrap("invalid property index");
+
+		const ResolvedProperty* prop = prop_idx >= 0 ? &rt->properties[prop_idx] : nullptr;
+		// only scalars fit in the record
+		if (prop) {
+			switch (prop->type) {
+				case ResolvedProperty::Type::NONE:
+				case ResolvedProperty::Type::VEC3:
+				case ResolvedProperty::Type::VEC4: m3ApiReturn(0);
+				default: break;
+			}
+		}
+
+		// NaN and infinite radius would match every entity, x - x is not 0 only for those
+		if (!(radius - radius == 0)) m3ApiReturn(0);
+
+		World& world = lane->module.getWorld();
+		const ComponentType cmp_type = prop ? prop->base->cmp->component_type : INVALID_COMPONENT_TYPE;
+		const DVec3 center(x, y, z);
+		const double radius_squared = double(radius) * radius;
+		u32 count = 0;
+		lane->module.getQueryGrid().forEach(center, radius < 0 ? -radius : radius, [&](const QueryGrid::Entry& entry){
+			if (count >= capacity) return false;
+			const EntityRef entity = entry.entity;
+			if (prop && !world.hasComponent(entity, cmp_type)) return true;
+			const DVec3 pos = entry.pos;
+			const DVec3 d = pos - center;
+			if (d.x * d.x + d.y * d.y + d.z * d.z > radius_squared) return true;
+
+			ScriptQueryRecord record;
+			record.entity = entity.index;
+			record.pos[0] = (float)pos.x;
+			record.pos[1] = (float)pos.y;
+			record.pos[2] = (float)pos.z;
+			record.value = 0;
+			if (prop) {
+				PropertyValue value = {};
+				getPropertyValue(*prop, entity, value);
+				memcpy(&record.value, &value, sizeof(record.value));
+			}
+			memcpy(records + count * sizeof(record), &record, sizeof(record));
+			++count;
+			return true;
+		});
+		m3ApiReturn(count);
+	}
+
+	static m3ApiRawFunction(API_setYaw) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(float, yaw);
+		Quat rot(Vec3(0, 1, 0), yaw);
+		if (lane->deferred) {
+			// same target as setRotation, so the last one of them wins
+			lane->writes.push({DeferredWrite::Type::SET_ROTATION, entity, nullptr, {rot.x, rot.y, rot.z, rot.w}});
+			return m3Err_none;
+		}
+		lane->module.getWorld().setRotation(entity, rot);
+		return m3Err_none;
+	}
+
+	// transforms are passed as multiple values, so a vector is a single host call
+	static m3ApiRawFunction(API_getPosition) {
+		m3ApiMultiValueReturnType(float, x);
+		m3ApiMultiValueReturnType(float, y);
+		m3ApiMultiValueReturnType(float, z);
+		ScriptLane* lane = getLane(runtime, _ctx);
+		m3ApiGetArg(EntityRef, entity);
+		const DVec3 pos = lane->module.getWorld().getPosition(entity);
+		m3ApiMultiValueReturn(x, (float)pos.x);
+		m3ApiMultiValueReturn(y, (float)pos.y);
+		m3ApiMultiValueReturn(z, (float)pos.z);
+		m3ApiSuccess();
 	}
 
-	void onMouseMove(const InputSystem::Event& event) {
-		for (EntityRef e : m_mouse_move_scripts) {
-			tryCall(e, "onMouseMove", event.data.axis.x, event.data.axis.y);
+	static m3ApiRawFunction(API_setPosition) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(float, x);
+		m3ApiGetArg(float, y);
+		m3ApiGetArg(float, z);
+		if (lane->deferred) {
+			lane->writes.push({DeferredWrite::Type::SET_POSITION, entity, nullptr, {x, y, z}});
+			return m3Err_none;
 		}
+		lane->module.invalidateQueryGrid();
+		lane->module.getWorld().setPosition(entity, DVec3(x, y, z));
+		return m3Err_none;
 	}
 
-	static m3ApiRawFunction(API_getPropertyFloat) {
-		m3ApiReturnType(float);
-		ScriptModuleImpl* module = (ScriptModuleImpl*)m3_GetUserData(runtime);
-		World& world = module->getWorld();
+	// fused getPosition, add and setPosition, the sum is in floats as if the script computed it
+	static m3ApiRawFunction(API_addPosition) {
+		ScriptLane* lane = getLane(runtime, _ctx);
 		m3ApiGetArg(EntityRef, entity);
-		m3ApiGetArg(StableHash, property_hash);
-		const reflection::PropertyBase* prop = reflection::getPropertyFromHash(property_hash);
-		if (!prop) {
-			logError("Property (hash = ", property_hash.getHashValue(), ") not found");
+		m3ApiGetArg(float, dx);
+		m3ApiGetArg(float, dy);
+		m3ApiGetArg(float, dz);
+		World& world = lane->module.getWorld();
+		const DVec3 pos = world.getPosition(entity);
+		const float x = (float)pos.x + dx;
+		const float y = (float)pos.y + dy;
+		const float z = (float)pos.z + dz;
+		if (lane->deferred) {
+			lane->writes.push({DeferredWrite::Type::SET_POSITION, entity, nullptr, {x, y, z}});
 			return m3Err_none;
 		}
-		const reflection::Property<float>* fprop = static_cast<const reflection::Property<float>*>(prop);
-		ComponentUID cmp;
-		cmp.entity = entity;
-		cmp.module = world.getModule(prop->cmp->component_type);
-		ASSERT(cmp.module);
-		const float value = fprop->get(cmp, -1);
-		ASSERT(false); // TODO check if this function is correct
-		m3ApiReturn(value);
+		lane->module.invalidateQueryGrid();
+		world.setPosition(entity, DVec3(x, y, z));
+		return m3Err_none;
 	}
 
-	static m3ApiRawFunction(API_setPropertyFloat) {
-		ScriptModuleImpl* module = (ScriptModuleImpl*)m3_GetUserData(runtime);
-		World& world = module->getWorld();
+	// the timer is added after all scripts run, see flushTimers
+	static m3ApiRawFunction(API_scheduleTimer) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(u32, timer_id);
+		m3ApiGetArg(float, seconds);
+		lane->timers.push({entity, timer_id, seconds});
+		return m3Err_none;
+	}
+
+	// applied after all scripts run, see flushResumables
+	static m3ApiRawFunction(API_setResumable) {
+		ScriptLane* lane = getLane(runtime, _ctx);
+		m3ApiGetArg(EntityRef, entity);
+		m3ApiGetArg(i32, resumable);
+		lane->resumables.push({entity, resumable != 0});
+		return m3Err_none;
+	}
+
+	static m3ApiRawFunction(API_getRotation) {
+		m3ApiMultiValueReturnType(float, x);
+		m3ApiMultiValueReturnType(float, y);
+		m3ApiMultiValueReturnType(float, z);
+		m3ApiMultiValueReturnType(float, w);
+		ScriptLane* lane = getLane(runtime, _ctx);
+		m3ApiGetArg(EntityRef, entity);
+		const Quat rot = lane->module.getWorld().getRotation(entity);
+		m3ApiMultiValueReturn(x, rot.x);
+		m3ApiMultiValueReturn(y, rot.y);
+		m3ApiMultiValueReturn(z, rot.z);
+		m3ApiMultiValueReturn(w, rot.w);
+		m3ApiSuccess();
+	}
+
+	static m3ApiRawFunction(API_setRotation) {
+		ScriptLane* lane = getLane(runtime, _ctx);
 		m3ApiGetArg(EntityRef, entity);
-		m3ApiGetArg(StableHash, property_hash);
-		m3ApiGetArg(float, value);
-		const reflection::PropertyBase* prop = reflection::getPropertyFromHash(property_hash);
-		if (!prop) {
-			logError("Property (hash = ", property_hash.getHashValue(), ") not found");
+		m3ApiGetArg(float, x);
+		m3ApiGetArg(float, y);
+		m3ApiGetArg(float, z);
+		m3ApiGetArg(float, w);
+		if (lane->deferred) {
+			lane->writes.push({DeferredWrite::Type::SET_ROTATION, entity, nullptr, {x, y, z, w}});
 			return m3Err_none;
 		}
-		const reflection::Property<float>* fprop = static_cast<const reflection::Property<float>*>(prop);
-		ComponentUID cmp;
-		cmp.entity = entity;
-		cmp.module = world.getModule(prop->cmp->component_type);
-		ASSERT(cmp.module);
-		fprop->set(cmp, -1, value);
+		lane->module.getWorld().setRotation(entity, Quat(x, y, z, w));
 		return m3Err_none;
 	}
 
-	static m3ApiRawFunction(API_setYaw) {
-		ScriptModuleImpl* module = (ScriptModuleImpl*)m3_GetUserData(runtime);
-		World& world = module->getWorld();
-		m3ApiGetArg(EntityRef, entity);
+	static m3ApiRawFunction(API_yawToDir) {
+		m3ApiMultiValueReturnType(float, x);
+		m3ApiMultiValueReturnType(float, y);
+		m3ApiMultiValueReturnType(float, z);
 		m3ApiGetArg(float, yaw);
-		Quat rot(Vec3(0, 1, 0), yaw);
-		world.setRotation(entity, rot);
-		return m3Err_none;
+		const Vec3 dir = Quat(Vec3(0, 1, 0), yaw).rotate(Vec3(0, 0, 1));
+		m3ApiMultiValueReturn(x, dir.x);
+		m3ApiMultiValueReturn(y, dir.y);
+		m3ApiMultiValueReturn(z, dir.z);
+		m3ApiSuccess();
+	}
+
+	// applies writes from all lanes in one pass, grouped by property, only the last write to each entity's property
+	void flushWrites() {
+		PROFILE_FUNCTION();
+		invalidateQueryGrid();
+		m_writes.clear();
+		for (ScriptLane* lane : m_lanes) {
+			for (const DeferredWrite& write : lane->writes) {
+				DeferredWrite& w = m_writes.emplace(write);
+				w.order = m_writes.size() - 1;
+			}
+			lane->writes.clear();
+		}
+		// calls go first, in the order scripts made them, so writes of the same frame win over them
+		for (ScriptLane* lane : m_lanes) {
+			for (DeferredCall& call : lane->calls) invoke(call);
+			lane->calls.clear();
+		}
+		if (m_writes.empty()) return;
+
+		sort(m_writes.begin(), m_writes.end(), [](const DeferredWrite& a, const DeferredWrite& b){
+			if (a.type != b.type) return a.type < b.type;
+			if (a.prop != b.prop) return (uintptr)a.prop < (uintptr)b.prop;
+			if (a.entity.index != b.entity.index) return a.entity.index < b.entity.index;
+			return a.order < b.order;
+		});
+
+		ComponentUID cmp;
+		for (i32 i = 0, c = m_writes.size(); i < c; ++i) {
+			const DeferredWrite& write = m_writes[i];
+			if (i + 1 < c && write.hasSameTarget(m_writes[i + 1])) continue;
+
+			switch (write.type) {
+				case DeferredWrite::Type::SET_PROPERTY:
+					setPropertyValue(*write.prop, write.entity, write.value);
+					break;
+				case DeferredWrite::Type::SET_POSITION: {
+					const float* v = write.value.f;
+					m_world.setPosition(write.entity, DVec3(v[0], v[1], v[2]));
+					break;
+				}
+				case DeferredWrite::Type::SET_ROTATION: {
+					const float* v = write.value.f;
+					m_world.setRotation(write.entity, Quat(v[0], v[1], v[2], v[3]));
+					break;
+				}
+			}
+		}
 	}
 
 	void processEvents() {
+		for (EventQueue& queue : m_event_queues) queue.events.clear();
+
 		InputSystem& input = m_engine.getInputSystem();
 		Span<const InputSystem::Event> events = input.getEvents();
 		for (const InputSystem::Event& e : events) {
 			switch(e.type) {
 				case InputSystem::Event::BUTTON:
 					if (e.device->type == InputSystem::Device::KEYBOARD) {
-						onKeyEvent(e);
+						m_event_queues[(u32)ScriptEvent::KEY].events.push(e);
+					}
+					else if (e.device->type == InputSystem::Device::MOUSE) {
+						m_event_queues[(u32)ScriptEvent::MOUSE_BUTTON].events.push(e);
 					}
 					break;
 				case InputSystem::Event::AXIS:
 					if (e.device->type == InputSystem::Device::MOUSE) {
-						onMouseMove(e);
+						m_event_queues[(u32)ScriptEvent::MOUSE_MOVE].events.push(e);
 					}
 					break;
 				default: break;
 			}
 		}
+
+		dispatchEvents();
 	}
 
 	void update(float time_delta) override {
 		PROFILE_FUNCTION();
 		if (!m_is_game_running) return;
 
+		// anything could have moved since the last frame
+		invalidateQueryGrid();
+		reloadChangedResources();
 		processEvents();
+		instantiatePending();
+		if (!m_retired_runtimes.empty()) freeRetiredRuntimes();
+		processTimers(time_delta);
 
-		for (auto iter = m_scripts.begin(), end = m_scripts.end(); iter != end; ++iter) {
-			Script& script = iter.value();
-			if (script.m_init_failed) continue;
-			if (!script.m_resource) continue;
-			if (!script.m_resource->isReady()) continue;
+		collectDue();
+		const bool parallel = m_parallel_update && updateParallel(time_delta);
+		updateBatches(time_delta);
 
-			bool start = false;
-			if (!script.m_runtime) {
-				script.m_runtime = m3_NewRuntime(m_environment, 32 * 1024, this);
-				// TODO optimize - do not parse for each instance
-				auto onError = [&](const char* msg){
-					logError(script.m_resource->getPath(), ": ", msg);
+		for (u32 i = 0; i < m_num_runnable;) {
+			Script& script = m_scripts[i];
+			// failed in a batch or on worker thread
+			if (script.m_init_failed) {
+				moveScript(i, ScriptRegion::IDLE);
+				continue;
+			}
+			// latent nodes are resumed on the main thread, even in batched and parallel scripts
+			if (script.m_resumable) {
+				const M3Result res = call(script, script.m_callbacks[(u32)ScriptCallback::RESUME], time_delta);
+				if (res != m3Err_none) {
+					logError(script.m_resource->getPath(), ": ", res);
 					script.m_init_failed = true;
-					m3_FreeRuntime(script.m_runtime);
-					script.m_module = nullptr;
-					script.m_runtime = nullptr;
-				};
-				const M3Result parse_res = m3_ParseModule(m_environment, &script.m_module, script.m_resource->m_bytecode.data(), (u32)script.m_resource->m_bytecode.size());
-				if (parse_res != m3Err_none) {
-					onError(parse_res);
+					moveScript(i, ScriptRegion::IDLE);
 					continue;
 				}
-				const M3Result load_res = m3_LoadModule(script.m_runtime, script.m_module);
-				if (load_res != m3Err_none) {
-					onError(load_res);
+			}
+			++i;
+		}
+
+		for (EntityRef entity : m_due) {
+			auto iter = m_script_indices.find(entity);
+			if (!iter.isValid()) continue;
+			const u32 idx = iter.value();
+			Script& script = m_scripts[idx];
+			// went idle since collectDue, e.g. its resume failed
+			if (script.m_bucket_interval == 0) continue;
+			// otherwise already updated on worker thread
+			if (!parallel || script.m_serial_update) {
+				const M3Result update_res = call(script, script.m_callbacks[(u32)ScriptCallback::UPDATE], consumeUpdateTime(script, time_delta));
+				if (update_res != m3Err_none) {
+					logError(script.m_resource->getPath(), ": ", update_res);
+					script.m_init_failed = true;
+					moveScript(idx, ScriptRegion::IDLE);
 					continue;
 				}
+			}
+			// distance is checked only when the script updates, not every frame
+			if (script.m_update_policy == ScriptUpdatePolicy::DISTANCE) rebucket(idx);
+		}
 
-				#define LINK(F) \
-					{ \
-						const M3Result link_res = m3_LinkRawFunction(script.m_module, "LumixAPI", #F, nullptr, &ScriptModuleImpl::API_##F); \
-						if (link_res != m3Err_none && link_res != m3Err_functionLookupFailed) { \
-							onError(link_res); \
-							continue; \
-						} \
-					}
+		flushWrites();
+		flushTimers();
+		flushResumables();
+		m_time += time_delta;
+		++m_frame;
+	}
+
+	bool isRunnable(const Script& script) const {
+		if (script.m_init_failed) return false;
+		// waiting latent nodes are resumed no matter the update policy
+		if (script.m_resumable) return true;
+		if (script.m_update_policy == ScriptUpdatePolicy::NONE) return false;
+		return script.m_callbacks[(u32)ScriptCallback::UPDATE] || script.m_callbacks[(u32)ScriptCallback::UPDATE_BATCH];
+	}
+
+	// scripts with NONE policy are runnable only to be resumed, they never get update or updateBatch
+	static bool wantsUpdate(const Script& script) {
+		return script.m_update_policy != ScriptUpdatePolicy::NONE;
+	}
+
+	u32 getUpdateInterval(const Script& script) const {
+		if (script.m_update_policy != ScriptUpdatePolicy::DISTANCE) return script.m_update_interval;
+		if (m_lod_tier_distance <= 0) return 1;
+		const double distance = length(m_world.getPosition(script.m_entity) - m_lod_origin);
+		const u32 tier = u32(minimum(distance / m_lod_tier_distance, (double)ScriptModule::MAX_LOD_TIER));
+		return 1 << tier;
+	}
+
+	// built by the first query after positions could have changed, queries from parallel lanes wait for it
+	const QueryGrid& getQueryGrid() {
+		if (!m_query_grid_valid) {
+			MutexGuard guard(m_query_grid_mutex);
+			if (!m_query_grid_valid) {
+				m_query_grid.build(m_world);
+				m_query_grid_valid = 1;
+			}
+		}
+		return m_query_grid;
+	}
+
+	// called on the main thread when positions change, never while lanes run in parallel
+	void invalidateQueryGrid() { m_query_grid_valid = 0; }
+
+	// phase is derived from entity index, so scripts with the same interval are not all due in the same frame
+	static u32 getPhase(EntityRef entity, u32 interval) {
+		return (interval - u32(entity.index) % interval) % interval;
+	}
+
+	// update is called per instance for runnable scripts with update callback, batched scripts get updateBatch instead
+	bool isUpdatedPerInstance(u32 idx) const {
+		const Script& script = m_scripts[idx];
+		return idx < m_num_runnable && wantsUpdate(script) && script.m_callbacks[(u32)ScriptCallback::UPDATE];
+	}
+
+	void unbucket(Script& script) {
+		if (script.m_bucket_interval == 0) return;
+		for (UpdateBucket& bucket : m_update_buckets) {
+			if (bucket.interval != script.m_bucket_interval) continue;
+			Array<EntityRef>& phase = bucket.phases[getPhase(script.m_entity, bucket.interval)];
+			const u32 slot = script.m_bucket_slot;
+			phase.swapAndPop(slot);
+			// the last script of the phase took the slot
+			if (slot < (u32)phase.size()) m_scripts[m_script_indices[phase[slot]]].m_bucket_slot = slot;
+			break;
+		}
+		script.m_bucket_interval = 0;
+	}
+
+	// moves the script to the bucket of its current interval, or out of buckets if it's not updated per instance
+	void rebucket(u32 idx) {
+		Script& script = m_scripts[idx];
+		const u32 interval = isUpdatedPerInstance(idx) ? getUpdateInterval(script) : 0;
+		if (interval == script.m_bucket_interval) return;
+		// time spent not updated is not passed to update
+		if (script.m_bucket_interval == 0) script.m_last_update_time = m_time;
+		unbucket(script);
+		if (interval == 0) return;
+
+		UpdateBucket* bucket = nullptr;
+		for (UpdateBucket& b : m_update_buckets) {
+			if (b.interval == interval) bucket = &b;
+		}
+		if (!bucket) bucket = &m_update_buckets.emplace(interval, m_allocator);
+		Array<EntityRef>& phase = bucket->phases[getPhase(script.m_entity, interval)];
+		script.m_bucket_slot = phase.size();
+		phase.push(script.m_entity);
+		script.m_bucket_interval = interval;
+	}
+
+	// scripts due in this frame, each bucket visits only its phase for the frame
+	void collectDue() {
+		m_due.clear();
+		for (const UpdateBucket& bucket : m_update_buckets) {
+			for (EntityRef entity : bucket.phases[m_frame % bucket.interval]) m_due.push(entity);
+		}
+	}
+
+	// time since the script's last update including this frame, accumulated over the frames it was not due
+	float consumeUpdateTime(Script& script, float time_delta) const {
+		const double now = m_time + time_delta;
+		const float elapsed = float(now - script.m_last_update_time);
+		script.m_last_update_time = now;
+		return elapsed;
+	}
+
+	// calls onTimer of scripts whose timers expired, scripts without expired timers cost nothing
+	void processTimers(float time_delta) {
+		PROFILE_FUNCTION();
+		m_timing_wheel.advance(time_delta, m_expired_timers);
+		for (const TimingWheel::Timer& timer : m_expired_timers) {
+			// only instantiated scripts, pending ones may still point to runtime of a reloaded resource
+			if (!isTimerLive(timer)) continue;
+			Script& script = m_scripts[m_script_indices[timer.entity]];
+			ScriptBackend::Function* fn = script.m_callbacks[(u32)ScriptCallback::ON_TIMER];
+			if (!fn) continue;
+
+			const M3Result res = call(script, fn, timer.id);
+			if (res != m3Err_none) logError(script.m_resource->getPath(), ": ", res);
+			if (timer.interval > 0) m_timing_wheel.add(timer.entity, timer.id, timer.generation, timer.interval, timer.interval);
+		}
+	}
+
+	// adds timers scheduled by scripts in this frame, lanes can not touch the wheel while running in parallel
+	void flushTimers() {
+		for (ScriptLane* lane : m_lanes) {
+			for (const ScheduledTimer& timer : lane->timers) {
+				auto iter = m_script_indices.find(timer.entity);
+				if (!iter.isValid()) continue;
+				const u32 generation = m_scripts[iter.value()].m_generation;
+				m_timing_wheel.add(timer.entity, timer.id, generation, timer.delay, 0);
+			}
+			lane->timers.clear();
+		}
+	}
 
-				LINK(setYaw);
-				LINK(setPropertyFloat);
-				LINK(getPropertyFloat);
+	// scripts waiting in latent nodes become runnable, scripts with no latent node waiting go idle if they do not update
+	void flushResumables() {
+		for (ScriptLane* lane : m_lanes) {
+			for (const ResumableChange& change : lane->resumables) {
+				auto iter = m_script_indices.find(change.entity);
+				if (!iter.isValid() || iter.value() >= m_first_pending) continue;
+				Script& script = m_scripts[iter.value()];
+				script.m_resumable = change.resumable && script.m_callbacks[(u32)ScriptCallback::RESUME];
+				moveScript(iter.value(), isRunnable(script) ? ScriptRegion::RUNNABLE : ScriptRegion::IDLE);
+			}
+			lane->resumables.clear();
+		}
+	}
 
-				#undef LINK
+	// instances of reloaded resources go back to pending, they are instantiated with the new version
+	// within instantiation budget and keep values of variables with the same name and type, see migrateRecord
+	void reloadChangedResources() {
+		Array<ScriptResource*> changed(m_allocator);
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			ResourceRuntime* rt = iter.value();
+			if (rt->compiling) continue;
+			ScriptResource* resource = iter.key();
+			if (resource->isReady() && rt->generation == resource->m_generation) continue;
+			changed.push(resource);
+		}
 
-				IM3Global self_global = m3_FindGlobal(script.m_module, "self");
-				if (!self_global) {
-					onError("`self` not found");
+		for (ScriptResource* resource : changed) {
+			ResourceRuntime* rt = m_resource_runtimes[resource];
+			// moving a script to pending swaps a not yet visited one to `i`
+			for (u32 i = 0; i < m_first_pending;) {
+				Script& script = m_scripts[i];
+				if (script.m_resource != resource) {
+					++i;
 					continue;
 				}
+				unsubscribe(script);
+				Array<u8> record(static_cast<Array<u8>&&>(script.m_instance));
+				resetInstance(script);
+				script.m_instance = static_cast<Array<u8>&&>(record);
+				script.m_reload_from = rt;
+				moveScript(i, ScriptRegion::PENDING);
+			}
+
+			// only variables are needed for migration
+			for (LaneRuntime& lane : rt->lanes) freeLaneRuntime(lane);
+			rt->lanes.clear();
+			resource->decRefCount();
+			m_resource_runtimes.erase(resource);
+			m_retired_runtimes.push(rt);
+		}
+	}
+
+	// frees retired runtimes no pending script migrates from
+	void freeRetiredRuntimes() {
+		for (i32 i = m_retired_runtimes.size() - 1; i >= 0; --i) {
+			ResourceRuntime* rt = m_retired_runtimes[i];
+			bool used = false;
+			for (u32 j = m_first_pending; j < (u32)m_scripts.size(); ++j) {
+				if (m_scripts[j].m_reload_from == rt) {
+					used = true;
+					break;
+				}
+			}
+			if (used) continue;
+			LUMIX_DELETE(m_allocator, rt);
+			m_retired_runtimes.swapAndPop(i);
+		}
+	}
+
+	// copies values of variables which exist in both versions with the same type
+	static void migrateRecord(const ResourceRuntime& from, const Array<u8>& from_record, const ScriptResource& to, Array<u8>& to_record) {
+		for (const ScriptResource::Variable& var : to.m_variables) {
+			for (const ScriptResource::Variable& prev : from.variables) {
+				if (prev.type != var.type || !equalStrings(prev.name.c_str(), var.name.c_str())) continue;
+				const u32 size = getValueSize(var.type);
+				if (prev.offset + size > (u32)from_record.size() || var.offset + size > (u32)to_record.size()) break;
+				memcpy(to_record.begin() + var.offset, from_record.begin() + prev.offset, size);
+				break;
+			}
+		}
+	}
+
+	bool isOverBudget(const os::Timer& timer) const {
+		return m_instantiation_budget > 0 && timer.getTimeSinceStart() > m_instantiation_budget;
+	}
+
+	// compiles prewarmed resources and instantiates pending scripts, until the frame's budget is spent
+	void instantiatePending() {
+		PROFILE_FUNCTION();
+		os::Timer timer;
+		for (u32 i = 0; i < (u32)m_prewarm_queue.size();) {
+			ScriptResource* resource = m_prewarm_queue[i];
+			if (resource->isEmpty()) {
+				// still loading
+				++i;
+				continue;
+			}
+			if (resource->isReady()) getResourceRuntime(*resource);
+			resource->decRefCount();
+			m_prewarm_queue.swapAndPop(i);
+			if (isOverBudget(timer)) return;
+		}
+
+		for (u32 i = m_first_pending; i < (u32)m_scripts.size(); ++i) {
+			Script& script = m_scripts[i];
+			if (!script.m_resource->isReady()) continue;
+			// leave it pending until its resource is compiled in background
+			if (getResourceRuntime(*script.m_resource)->compiling) continue;
+
+			instantiate(script);
+			moveScript(i, isRunnable(script) ? ScriptRegion::RUNNABLE : ScriptRegion::IDLE);
+			if (isOverBudget(timer)) return;
+		}
+	}
+
+	// calls updateBatch once per resource and group of instances which fit in memory, instead of update per instance
+	void updateBatches(float time_delta) {
+		PROFILE_FUNCTION();
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			iter.value()->batch.clear();
+			iter.value()->serial_batch.clear();
+		}
+		bool any_batch = false;
+		for (u32 i = 0; i < m_num_runnable; ++i) {
+			const Script& script = m_scripts[i];
+			if (!script.m_callbacks[(u32)ScriptCallback::UPDATE_BATCH]) continue;
+			if (!wantsUpdate(script)) continue;
+			// writes and calls of serial instances are not deferred, so they can not share a batch with deferred ones
+			if (script.m_serial_update) script.m_resource_runtime->serial_batch.push(i);
+			else script.m_resource_runtime->batch.push(i);
+			any_batch = true;
+		}
+		if (!any_batch) return;
+
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			ResourceRuntime* rt = iter.value();
+			if (rt->batch.empty() && rt->serial_batch.empty()) continue;
+			// instance policies do not apply, the whole batch uses the resource's interval
+			rt->skipped_time += time_delta;
+			const u32 interval = iter.key()->m_update_interval;
+			if (interval > 1 && m_frame % interval != 0) continue;
+			const float batch_time_delta = rt->skipped_time;
+			rt->skipped_time = 0;
+
+			const u32 instance_size = iter.key()->m_instance_size;
+			const LaneRuntime& lane_rt = rt->lanes[0];
+			ScriptBackend::Function* fn = lane_rt.callbacks[(u32)ScriptCallback::UPDATE_BATCH];
+			m_lanes[0]->deferred = true;
+			for (u32 from = 0; from < (u32)rt->batch.size(); from += rt->max_batch_size) {
+				const u32 count = minimum(rt->max_batch_size, rt->batch.size() - from);
+				u32 mem_size;
+				u8* mem = m_backend->getMemory(lane_rt.runtime, mem_size);
+				for (u32 j = 0; j < count; ++j) {
+					memcpy(mem + j * instance_size, m_scripts[rt->batch[from + j]].m_instance.begin(), instance_size);
+				}
 				
-				M3TaggedValue self_value;
-				self_value.type = c_m3Type_i32;
-				self_value.value.i32 = iter.key().index;
-				M3Result set_self_res = m3_SetGlobal(self_global, &self_value);
-				if (set_self_res != m3Err_none) {
-					onError(set_self_res);
-					continue;
+				profiler::beginBlock("script update batch");
+				profiler::pushString(iter.key()->getPath().c_str());
+				os::Timer timer;
+				const M3Result res = invoke(lane_rt.runtime, *rt, fn, batch_time_delta, 0, count);
+				if (m_collect_stats) {
+					rt->lanes[0].stats.call_time += timer.getTimeSinceStart();
+					++rt->lanes[0].stats.calls;
+				}
+				profiler::endBlock();
+				
+				mem = m_backend->getMemory(lane_rt.runtime, mem_size);
+				for (u32 j = 0; j < count; ++j) {
+					Script& script = m_scripts[rt->batch[from + j]];
+					memcpy(script.m_instance.begin(), mem + j * instance_size, instance_size);
+					if (res != m3Err_none) script.m_init_failed = true;
+				}
+				if (res != m3Err_none) logError(iter.key()->getPath(), ": ", res);
+			}
+
+			// due in the same frames as the rest of the batch, with the same time delta
+			for (u32 idx : rt->serial_batch) {
+				Script& script = m_scripts[idx];
+				const M3Result res = call(script, script.m_callbacks[(u32)ScriptCallback::UPDATE_BATCH], batch_time_delta, 0, 1);
+				if (res != m3Err_none) {
+					logError(iter.key()->getPath(), ": ", res);
+					script.m_init_failed = true;
 				}
+			}
+		}
+	}
 
-				IM3Function tmp_fn;
-				if (m3_FindFunction(&tmp_fn, script.m_runtime, "onMouseMove") == m3Err_none) {
-					m_mouse_move_scripts.push(iter.key());
+	// creates lanes and their runtimes, so `num_lanes` lanes can run any resource
+	bool prepareLanes(u32 num_lanes) {
+		while ((u32)m_lanes.size() < num_lanes) {
+			m_lanes.push(LUMIX_NEW(m_allocator, ScriptLane)(*this, m_lanes.size(), m_allocator));
+		}
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			ResourceRuntime* rt = iter.value();
+			if (rt->failed || rt->compiling) continue;
+			while ((u32)rt->lanes.size() < num_lanes) {
+				LaneRuntime& lane = rt->lanes.emplace();
+				const M3Result res = initLaneRuntime(*iter.key(), *rt, *m_lanes[rt->lanes.size() - 1], lane);
+				if (res != m3Err_none) {
+					logError(iter.key()->getPath(), ": ", res);
+					rt->lanes.pop();
+					return false;
 				}
-				if (m3_FindFunction(&tmp_fn, script.m_runtime, "onKeyEvent") == m3Err_none) {
-					m_key_input_scripts.push(iter.key());
+			}
+		}
+		return true;
+	}
+
+	// updates due scripts except those with m_serial_update
+	// returns false if scripts could not be updated in parallel and all must be updated on the main thread
+	bool updateParallel(float time_delta) {
+		PROFILE_FUNCTION();
+		const u32 MIN_BATCH_SIZE = 64;
+		const u32 num_due = (u32)m_due.size();
+		const u32 num_batches = minimum((u32)jobs::getWorkersCount(), (num_due + MIN_BATCH_SIZE - 1) / MIN_BATCH_SIZE);
+		if (num_batches < 2) return false;
+		if (!prepareLanes(num_batches + 1)) {
+			logError("Failed to prepare parallel script update, falling back to serial update");
+			m_parallel_update = false;
+			return false;
+		}
+
+		const u32 batch_size = (num_due + num_batches - 1) / num_batches;
+		jobs::forEach(num_batches, 1, [&](i32 batch, i32){
+			PROFILE_BLOCK("script batch");
+			ScriptLane& lane = *m_lanes[batch + 1];
+			const u32 from = batch * batch_size;
+			const u32 to = minimum(from + batch_size, num_due);
+			for (u32 i = from; i < to; ++i) {
+				Script& script = m_scripts[m_script_indices[m_due[i]]];
+				if (script.m_serial_update) continue;
+
+				const LaneRuntime& lane_rt = script.m_resource_runtime->lanes[lane.index];
+				const M3Result res = call(lane_rt, script, lane_rt.callbacks[(u32)ScriptCallback::UPDATE], consumeUpdateTime(script, time_delta));
+				if (res != m3Err_none) {
+					logError(script.m_resource->getPath(), ": ", res);
+					script.m_init_failed = true;
 				}
-				M3Result find_start_res = m3_FindFunction(&tmp_fn, script.m_runtime, "start");
-				if (find_start_res == m3Err_none) {
-					m3_CallV(tmp_fn);
+			}
+		});
+
+		return true;
+	}
+
+	// timers of destroyed or reinstantiated scripts stay in the wheel until they expire, they are ignored
+	bool isTimerLive(const TimingWheel::Timer& timer) const {
+		auto iter = m_script_indices.find(timer.entity);
+		if (!iter.isValid() || iter.value() >= m_first_pending) return false;
+		const Script& script = m_scripts[iter.value()];
+		return script.m_generation == timer.generation && !script.m_init_failed;
+	}
+
+	void instantiate(Script& script) {
+		script.m_generation = ++m_last_generation;
+		Array<u8> prev_record(static_cast<Array<u8>&&>(script.m_instance));
+		Array<u64> saved_globals(m_allocator);
+		const bool restore = script.m_restore;
+		script.m_restore = false;
+		if (restore) saved_globals = static_cast<Array<u64>&&>(script.m_globals);
+		const ResourceRuntime* reload_from = script.m_reload_from;
+		script.m_reload_from = nullptr;
+
+		ResourceRuntime* rt = getResourceRuntime(*script.m_resource);
+		if (rt->failed) {
+			script.m_init_failed = true;
+			return;
+		}
+
+		script.m_resource_runtime = rt;
+		script.m_runtime = rt->lanes[0].runtime;
+		script.m_module = rt->lanes[0].module;
+		script.m_globals.resize(rt->initial_globals.size());
+		memcpy(script.m_globals.begin(), rt->initial_globals.begin(), rt->initial_globals.byte_size());
+		if (script.m_resource->m_instance_size > 0) {
+			// record starts with self, variables are zero
+			script.m_instance.resize(script.m_resource->m_instance_size);
+			memset(script.m_instance.begin(), 0, script.m_instance.byte_size());
+		}
+		// deserialized instance continues with its saved state, it's not started again
+		const bool restored = restore
+			&& saved_globals.size() == script.m_globals.size()
+			&& prev_record.size() == script.m_instance.size();
+		if (restore && !restored) logError(script.m_resource->getPath(), ": saved state does not match the script, it's started again");
+		if (restored) {
+			memcpy(script.m_globals.begin(), saved_globals.begin(), saved_globals.byte_size());
+			if (!prev_record.empty()) memcpy(script.m_instance.begin(), prev_record.begin(), prev_record.byte_size());
+		}
+		if (script.m_resource->m_instance_size > 0) {
+			const i32 self = script.m_entity.index;
+			memcpy(script.m_instance.begin(), &self, sizeof(self));
+		}
+		else {
+			script.m_globals[rt->self_global] = (u32)script.m_entity.index;
+		}
+		// hot reloaded instance continues with its state, it's not started again
+		const bool migrated = reload_from && !prev_record.empty() && !script.m_instance.empty();
+		if (migrated) migrateRecord(*reload_from, prev_record, *script.m_resource, script.m_instance);
+
+		memcpy(script.m_callbacks, rt->lanes[0].callbacks, sizeof(script.m_callbacks));
+		script.m_resumable = restored && script.m_resumable && script.m_callbacks[(u32)ScriptCallback::RESUME];
+		if (!script.m_update_policy_override) {
+			script.m_update_policy = script.m_resource->m_update_policy;
+			script.m_update_interval = clamp(script.m_resource->m_update_interval, 1u, ScriptModule::MAX_UPDATE_INTERVAL);
+		}
+
+		for (u32 i = 0; i < (u32)ScriptEvent::COUNT; ++i) {
+			if (script.m_callbacks[(u32)EVENT_CALLBACKS[i]]) subscribe(script, (ScriptEvent)i);
+		}
+		if (ScriptBackend::Function* start_fn = migrated || restored ? nullptr : script.m_callbacks[(u32)ScriptCallback::START]) {
+			const M3Result start_res = call(script, start_fn);
+			if (start_res != m3Err_none) logError(script.m_resource->getPath(), ": ", start_res);
+		}
+		if (script.m_callbacks[(u32)ScriptCallback::ON_TIMER]) {
+			for (const ScriptResource::Timer& timer : script.m_resource->m_timers) {
+				m_timing_wheel.add(script.m_entity, timer.id, script.m_generation, timer.interval, timer.interval);
+			}
+		}
+		if (restored) restoreTimers(script);
+	}
+
+	// one-shot timers the instance had scheduled when it was serialized, only right after deserialization
+	void restoreTimers(const Script& script) {
+		for (i32 i = m_restored_timers.size() - 1; i >= 0; --i) {
+			const ScheduledTimer& timer = m_restored_timers[i];
+			if (timer.entity != script.m_entity) continue;
+			m_timing_wheel.add(timer.entity, timer.id, script.m_generation, timer.delay, 0);
+			m_restored_timers.swapAndPop(i);
+		}
+	}
+
+	// parses, links and compiles the resource's bytecode in a new runtime owned by the lane
+	M3Result initLaneRuntime(ScriptResource& resource, ResourceRuntime& rt, ScriptLane& lane, LaneRuntime& lane_rt) {
+		// backend's shared state and stack pool are shared with background compile jobs
+		MutexGuard guard(m_wasm_mutex);
+		WasmAllocatorScope allocator_scope(m_wasm_allocator);
+		// compiler's estimate, corrected once the module is compiled and exact size is known
+		const u32 estimated_stack_size = resource.m_stack_size ? resource.m_stack_size : 32 * 1024;
+		lane_rt.stack = m_stack_pool.alloc(estimated_stack_size);
+		lane_rt.runtime = m_backend->createRuntime(lane_rt.stack.mem, lane_rt.stack.size, &lane);
+		auto onError = [&](M3Result res) {
+			releaseLaneRuntime(lane_rt);
+			return res;
+		};
+		if (!lane_rt.runtime) return onError(m3Err_mallocFailed);
+
+		const Span<const u8> bytecode(resource.m_bytecode.data(), (u32)resource.m_bytecode.size());
+		const M3Result load_res = m_backend->loadModule(lane_rt.runtime, bytecode, lane_rt.module);
+		if (load_res != m3Err_none) return onError(load_res);
+
+		const M3RawCall* imports = getImportFunctions();
+		for (u32 i = 0; i < (u32)ScriptImport::COUNT; ++i) {
+			const M3Result link_res = m_backend->linkFunction(lane_rt.module, "LumixAPI", getScriptImportName((ScriptImport)i), imports[i], &rt);
+			if (link_res != m3Err_none && link_res != m3Err_functionLookupFailed) return onError(link_res);
+		}
+
+		// compile everything now, lazy compilation would touch the shared state from worker threads
+		const M3Result compile_res = m_backend->compile(lane_rt.module);
+		if (compile_res != m3Err_none) return onError(compile_res);
+
+		const u32 stack_size = StackPool::roundSize(m_backend->getRequiredStackSize(lane_rt.module));
+		if (stack_size != lane_rt.stack.size) {
+			m_stack_pool.free(lane_rt.stack);
+			lane_rt.stack = m_stack_pool.alloc(stack_size);
+			m_backend->setStack(lane_rt.runtime, lane_rt.stack.mem, lane_rt.stack.size);
+		}
+
+		for (u32 i = 0; i < (u32)ScriptCallback::COUNT; ++i) {
+			const M3Result find_res = m_backend->findFunction(lane_rt.runtime, CALLBACK_NAMES[i], lane_rt.callbacks[i]);
+			if (find_res == m3Err_none) continue;
+			if (find_res != m3Err_functionLookupFailed) return onError(find_res);
+			lane_rt.callbacks[i] = nullptr;
+		}
+		return m3Err_none;
+	}
+
+	void destroyResourceRuntime(ScriptResource& resource, ResourceRuntime* rt) {
+		for (LaneRuntime& lane : rt->lanes) freeLaneRuntime(lane);
+		resource.decRefCount();
+		LUMIX_DELETE(m_allocator, rt);
+	}
+
+	void freeLaneRuntime(LaneRuntime& lane_rt) {
+		MutexGuard guard(m_wasm_mutex);
+		releaseLaneRuntime(lane_rt);
+	}
+
+	// caller must hold m_wasm_mutex
+	void releaseLaneRuntime(LaneRuntime& lane_rt) {
+		WasmAllocatorScope allocator_scope(m_wasm_allocator);
+		if (lane_rt.runtime) m_backend->destroyRuntime(lane_rt.runtime);
+		m_stack_pool.free(lane_rt.stack);
+		lane_rt.runtime = nullptr;
+		lane_rt.module = nullptr;
+		lane_rt.stack = {};
+	}
+
+	void resolveFunctions(const ScriptResource& resource, ResourceRuntime& rt) {
+		rt.functions.reserve(resource.m_functions.size());
+		for (StableHash hash : resource.m_functions) {
+			ResolvedFunction& resolved = rt.functions.emplace();
+			for (const reflection::RegisteredComponent& cmp : reflection::getComponents()) {
+				for (const reflection::FunctionBase* function : cmp.cmp->functions) {
+					if (getScriptFunctionHash(cmp.cmp->name, function->name) != hash) continue;
+					if (!getScriptFunctionSignature(*function, resolved.signature)) {
+						logError(resource.getPath(), ": function ", cmp.cmp->name, ".", function->name, " can not be called by scripts");
+						continue;
+					}
+					resolved.module = m_world.getModule(cmp.cmp->component_type);
+					if (resolved.module) resolved.function = function;
 				}
 			}
+			if (!resolved.function) logError(resource.getPath(), ": function (hash = ", hash.getHashValue(), ") not found");
+		}
+	}
+
+	void resolveProperties(const ScriptResource& resource, ResourceRuntime& rt) {
+		rt.properties.reserve(resource.m_properties.size());
+		for (StableHash hash : resource.m_properties) {
+			ResolvedProperty& resolved = rt.properties.emplace();
+			const reflection::PropertyBase* prop = reflection::getPropertyFromHash(hash);
+			if (!prop) {
+				logError(resource.getPath(), ": property (hash = ", hash.getHashValue(), ") not found");
+				continue;
+			}
+
+			struct : reflection::IEmptyPropertyVisitor {
+				void visit(const reflection::Property<float>& prop) override { resolved->type = ResolvedProperty::Type::FLOAT; resolved->f = &prop; }
+				void visit(const reflection::Property<i32>& prop) override { resolved->type = ResolvedProperty::Type::I32; resolved->i = &prop; }
+				void visit(const reflection::Property<u32>& prop) override { resolved->type = ResolvedProperty::Type::U32; resolved->u = &prop; }
+				void visit(const reflection::Property<bool>& prop) override { resolved->type = ResolvedProperty::Type::BOOL; resolved->b = &prop; }
+				void visit(const reflection::Property<EntityPtr>& prop) override { resolved->type = ResolvedProperty::Type::ENTITY; resolved->e = &prop; }
+				void visit(const reflection::Property<Vec3>& prop) override { resolved->type = ResolvedProperty::Type::VEC3; resolved->v3 = &prop; }
+				void visit(const reflection::Property<Vec4>& prop) override { resolved->type = ResolvedProperty::Type::VEC4; resolved->v4 = &prop; }
+				ResolvedProperty* resolved;
+			} visitor;
+			visitor.resolved = &resolved;
+			prop->visit(visitor);
+			if (resolved.type == ResolvedProperty::Type::NONE) {
+				logError(resource.getPath(), ": property ", prop->name, " has type not supported by scripts");
+				continue;
+			}
+
+			resolved.module = m_world.getModule(prop->cmp->component_type);
+			if (!resolved.module) resolved.type = ResolvedProperty::Type::NONE;
+		}
+	}
+
+	// parses, links and compiles the resource's bytecode once, all instances then share the result
+	// with background compile enabled, the returned runtime can still be compiling, see ResourceRuntime::compiling
+	ResourceRuntime* getResourceRuntime(ScriptResource& resource) {
+		auto iter = m_resource_runtimes.find(&resource);
+		if (iter.isValid()) return iter.value();
+
+		ResourceRuntime* rt = LUMIX_NEW(m_allocator, ResourceRuntime)(m_allocator);
+		m_resource_runtimes.insert(&resource, rt);
+		// keep the bytecode alive, the module references it
+		resource.incRefCount();
+		rt->generation = resource.m_generation;
+		rt->backend = m_backend;
+		rt->native = findScriptNative(StableHash(resource.m_bytecode.data(), (u32)resource.m_bytecode.size()));
+		rt->variables.reserve(resource.m_variables.size());
+		for (const ScriptResource::Variable& var : resource.m_variables) {
+			ScriptResource::Variable& copy = rt->variables.emplace(m_allocator);
+			copy.name = var.name;
+			copy.type = var.type;
+			copy.offset = var.offset;
+		}
+
+		ScriptLane* main_lane = m_lanes[0];
+		if (m_background_compile) {
+			rt->compiling = 1;
+			jobs::runLambda([this, &resource, rt, main_lane](){
+				PROFILE_BLOCK("compile script");
+				compileResourceRuntime(resource, *rt, *main_lane);
+				rt->compiling = 0;
+			}, &resource.m_compile_jobs);
+			return rt;
+		}
+
+		compileResourceRuntime(resource, *rt, *main_lane);
+		return rt;
+	}
+
+	// compile jobs are counted by their resources, see ScriptResource::m_compile_jobs
+	void waitForCompileJobs() {
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			if (iter.value()->compiling) jobs::wait(&iter.key()->m_compile_jobs);
+		}
+	}
+
+	// touches only `rt`, immutable engine state and mutex-guarded wasm3 state, so it can run on any thread
+	void compileResourceRuntime(ScriptResource& resource, ResourceRuntime& rt_ref, ScriptLane& main_lane) {
+		ResourceRuntime* rt = &rt_ref;
+		auto onError = [&](const char* msg) {
+			logError(resource.getPath(), ": ", msg);
+			rt->failed = true;
+			for (LaneRuntime& lane : rt->lanes) freeLaneRuntime(lane);
+			rt->lanes.clear();
+		};
+
+		resolveProperties(resource, *rt);
+		resolveFunctions(resource, *rt);
+		LaneRuntime& main_rt = rt->lanes.emplace();
+		const M3Result init_res = initLaneRuntime(resource, *rt, main_lane, main_rt);
+		if (init_res != m3Err_none) return onError(init_res);
+
+		const u32 num_globals = m_backend->getGlobalCount(main_rt.module);
+		rt->initial_globals.resize(num_globals);
+		m_backend->getGlobals(main_rt.module, rt->initial_globals.begin());
+
+		if (resource.m_instance_size > 0) {
+			u32 mem_size = 0;
+			m_backend->getMemory(main_rt.runtime, mem_size);
+			if (mem_size < resource.m_instance_size + resource.m_reserved_memory) return onError("instance does not fit in memory");
+			rt->max_batch_size = (mem_size - resource.m_reserved_memory) / resource.m_instance_size;
+			return;
+		}
+
+		const i32 self_idx = [&](){
+			for (u32 i = 0; i < num_globals; ++i) {
+				const char* name = m_backend->getGlobalName(main_rt.module, i);
+				if (name && equalStrings(name, "self")) return (i32)i;
+			}
+			return -1;
+		}();
+		if (self_idx < 0) return onError("`self` not found");
+
+		rt->self_global = self_idx;
+	}
+
+	ScriptRegion getRegion(u32 idx) const {
+		if (idx < m_num_runnable) return ScriptRegion::RUNNABLE;
+		if (idx < m_first_pending) return ScriptRegion::IDLE;
+		return ScriptRegion::PENDING;
+	}
 
-			IM3Function update_fn;
-			M3Result find_update_res = m3_FindFunction(&update_fn, script.m_runtime, "update");
-			if (find_update_res == m3Err_none) {
-				m3_CallV(update_fn, time_delta);
+	void swapScripts(u32 a, u32 b) {
+		if (a == b) return;
+		Script tmp(static_cast<Script&&>(m_scripts[a]));
+		m_scripts[a] = static_cast<Script&&>(m_scripts[b]);
+		m_scripts[b] = static_cast<Script&&>(tmp);
+		m_script_indices[m_scripts[a].m_entity] = a;
+		m_script_indices[m_scripts[b].m_entity] = b;
+	}
+
+	// moves script across region boundaries, one swap per crossed boundary, returns its new index
+	// swapped scripts stay in their regions, so only the moved one changes its update bucket
+	u32 moveScript(u32 idx, ScriptRegion to) {
+		for (;;) {
+			const ScriptRegion from = getRegion(idx);
+			if (from == to) break;
+			if (from < to) {
+				if (from == ScriptRegion::RUNNABLE) {
+					--m_num_runnable;
+					swapScripts(idx, m_num_runnable);
+					idx = m_num_runnable;
+				}
+				else {
+					--m_first_pending;
+					swapScripts(idx, m_first_pending);
+					idx = m_first_pending;
+				}
 			}
-			else if (find_update_res != m3Err_functionLookupFailed) {
-				logError(script.m_resource->getPath(), ": ", find_update_res);
-				script.m_init_failed = true;
+			else {
+				if (from == ScriptRegion::PENDING) {
+					swapScripts(idx, m_first_pending);
+					idx = m_first_pending;
+					++m_first_pending;
+				}
+				else {
+					swapScripts(idx, m_num_runnable);
+					idx = m_num_runnable;
+					++m_num_runnable;
+				}
 			}
 		}
+		rebucket(idx);
+		return idx;
+	}
+
+	// new scripts are pending
+	Script& addScript(EntityRef entity) {
+		m_script_indices.insert(entity, m_scripts.size());
+		return m_scripts.emplace(entity, m_allocator);
 	}
 
 	void destroyScript(EntityRef entity) {
-		m_mouse_move_scripts.eraseItem(entity);
-		m_key_input_scripts.eraseItem(entity);
-		m_scripts.erase(entity);
+		unsubscribe(getScript(entity));
+		const u32 idx = moveScript(m_script_indices[entity], ScriptRegion::PENDING);
+		swapScripts(idx, m_scripts.size() - 1);
+		m_scripts.pop();
+		m_script_indices.erase(entity);
 		m_world.onComponentDestroyed(entity, SCRIPT_TYPE, this);
 	}
 
 	void createScript(EntityRef entity) {
-		m_scripts.insert(entity);
+		addScript(entity);
+		moveScript(m_scripts.size() - 1, ScriptRegion::IDLE);
 		m_world.onComponentCreated(entity, SCRIPT_TYPE, this);
 	}
 
 	Script& getScript(EntityRef entity) override {
-		return m_scripts[entity];
+		return m_scripts[m_script_indices[entity]];
 	}
 
-	void setScriptResource(EntityRef entity, const Path& path) {
-		Script& script = m_scripts[entity];
+	void setScriptResource(EntityRef entity, const Path& path) override {
+		const u32 idx = moveScript(m_script_indices[entity], ScriptRegion::PENDING);
+		Script& script = m_scripts[idx];
 		if (script.m_resource) script.m_resource->decRefCount();
+		unsubscribe(script);
+		resetInstance(script);
 		if (path.isEmpty()) {
 			script.m_resource = nullptr;
+			moveScript(idx, ScriptRegion::IDLE);
 			return;
 		}
 		script.m_resource = m_engine.getResourceManager().load<ScriptResource>(path);
 	}
 
+	// drops all runtime state of the script, it can be instantiated again, subscriber lists must be updated by caller
+	static void resetInstance(Script& script) {
+		for (u32& idx : script.m_subscriptions) idx = U32_MAX;
+		script.m_resource_runtime = nullptr;
+		script.m_reload_from = nullptr;
+		script.m_runtime = nullptr;
+		script.m_module = nullptr;
+		script.m_init_failed = false;
+		script.m_resumable = false;
+		script.m_restore = false;
+		script.m_globals.clear();
+		script.m_instance.clear();
+		memset(script.m_callbacks, 0, sizeof(script.m_callbacks));
+	}
+
+	void setSerialUpdate(EntityRef entity, bool value) { getScript(entity).m_serial_update = value; }
+	bool getSerialUpdate(EntityRef entity) { return getScript(entity).m_serial_update; }
+
+	void setParallelUpdate(bool enable) override { m_parallel_update = enable; }
+	bool isParallelUpdate() const override { return m_parallel_update; }
+	void setInstantiationBudget(float seconds) override { m_instantiation_budget = seconds; }
+	float getInstantiationBudget() const override { return m_instantiation_budget; }
+	void setBackgroundCompile(bool enable) override { m_background_compile = enable; }
+	bool isBackgroundCompile() const override { return m_background_compile; }
+
+	void setUpdatePolicy(EntityRef entity, ScriptUpdatePolicy policy, u32 interval) override {
+		const u32 idx = m_script_indices[entity];
+		Script& script = m_scripts[idx];
+		script.m_update_policy = policy;
+		script.m_update_interval = clamp(interval, 1u, ScriptModule::MAX_UPDATE_INTERVAL);
+		script.m_update_policy_override = true;
+		// pending scripts are placed once instantiated
+		if (idx < m_first_pending) moveScript(idx, isRunnable(script) ? ScriptRegion::RUNNABLE : ScriptRegion::IDLE);
+	}
+
+	void setLOD(const DVec3& origin, float tier_distance) override {
+		m_lod_origin = origin;
+		m_lod_tier_distance = tier_distance;
+	}
+
+	void setCollectStats(bool enable) override { m_collect_stats = enable; }
+	bool isCollectingStats() const override { return m_collect_stats; }
+
+	bool getStats(ScriptResource& resource, ScriptStats& stats) override {
+		auto iter = m_resource_runtimes.find(&resource);
+		if (!iter.isValid() || iter.value()->compiling || iter.value()->failed) return false;
+
+		stats = {};
+		for (const LaneRuntime& lane : iter.value()->lanes) stats.add(lane.stats);
+		return true;
+	}
+
+	void resetStats() override {
+		for (auto iter = m_resource_runtimes.begin(), end = m_resource_runtimes.end(); iter != end; ++iter) {
+			ResourceRuntime* rt = iter.value();
+			if (rt->compiling) continue;
+			for (LaneRuntime& lane : rt->lanes) lane.stats = {};
+		}
+	}
+
+	bool getNodeCounters(ScriptResource& resource, Span<u32> counters) override {
+		auto iter = m_resource_runtimes.find(&resource);
+		if (!iter.isValid() || iter.value()->compiling || iter.value()->failed) return false;
+
+		for (u32& c : counters) c = 0;
+		const u32 num = minimum(counters.length(), (u32)resource.m_profiled_nodes.size());
+		for (const LaneRuntime& lane : iter.value()->lanes) {
+			u32 mem_size;
+			const u8* mem = m_backend->getMemory(lane.runtime, mem_size);
+			if (!mem || resource.m_profile_offset + num * sizeof(u32) > mem_size) continue;
+			for (u32 i = 0; i < num; ++i) {
+				u32 value;
+				memcpy(&value, mem + resource.m_profile_offset + i * sizeof(u32), sizeof(value));
+				counters[i] += value;
+			}
+		}
+		return true;
+	}
+
+	void prewarm(const Path& path) override {
+		m_prewarm_queue.push(m_engine.getResourceManager().load<ScriptResource>(path));
+	}
+
+	ScriptBackend& getBackend() override { return *m_backend; }
+
 	Path getScriptResource(EntityRef entity) {
-		Script& script = m_scripts[entity];
+		const Script& script = getScript(entity);
 		ScriptResource* res = script.m_resource;
 		return res ? res->getPath() : Path();
 	}
@@ -334,11 +2819,53 @@ struct ScriptModuleImpl : ScriptModule {
 	Engine& m_engine;
 	ISystem& m_system;
 	World& m_world;
-	HashMap<EntityRef, Script> m_scripts;
-	Array<EntityRef> m_mouse_move_scripts;
-	Array<EntityRef> m_key_input_scripts;
+	// partitioned by ScriptRegion, runnable scripts first so update iterates them linearly
+	Array<Script> m_scripts;
+	u32 m_num_runnable = 0;
+	u32 m_first_pending = 0;
+	// scripts are stored by entity in update buckets, their indices change when they move between regions
+	HashMap<EntityRef, u32> m_script_indices;
+	// indexed by ScriptEvent
+	Array<EventQueue> m_event_queues;
+	HashMap<ScriptResource*, ResourceRuntime*> m_resource_runtimes;
+	Array<ScriptLane*> m_lanes;
+	// merged writes from all lanes, kept to reuse memory
+	Array<DeferredWrite> m_writes;
+	// all wasm3 memory of this world, see WasmAllocatorScope
+	TagAllocator m_wasm_allocator;
+	StackPool m_stack_pool;
+	// loaded resources which should be compiled before any script needs them
+	Array<ScriptResource*> m_prewarm_queue;
+	// runtimes of reloaded resources' previous versions, see Script::m_reload_from
+	Array<ResourceRuntime*> m_retired_runtimes;
+	TimingWheel m_timing_wheel;
+	// kept to reuse memory
+	Array<TimingWheel::Timer> m_expired_timers;
+	// deserialized one-shot timers waiting for their instances, see restoreTimers
+	Array<ScheduledTimer> m_restored_timers;
+	float m_instantiation_budget = 0;
+	// incremented after each update, each bucket's scripts with phase m_frame % interval are due
+	u32 m_frame = 0;
+	// last Script::m_generation given to an instance
+	u32 m_last_generation = 0;
+	// sum of time deltas of all updates, scripts measure time since their last update against it
+	double m_time = 0;
+	Array<UpdateBucket> m_update_buckets;
+	// kept to reuse memory
+	Array<EntityRef> m_due;
+	DVec3 m_lod_origin = DVec3(0);
+	float m_lod_tier_distance = 0;
 	bool m_is_game_running = false;
-	IM3Environment m_environment = nullptr;
+	bool m_parallel_update = false;
+	bool m_background_compile = false;
+	bool m_collect_stats = false;
+	// guards backend's shared state, e.g. wasm3's environment, and m_stack_pool
+	Mutex m_wasm_mutex;
+	// positions of all entities for queryRadius, see getQueryGrid
+	QueryGrid m_query_grid;
+	AtomicI32 m_query_grid_valid = 0;
+	Mutex m_query_grid_mutex;
+	ScriptBackend* m_backend = nullptr;
 };
 
 struct ScriptManager : ResourceManager {
@@ -361,6 +2888,7 @@ struct VisualScriptPlugin : ISystem {
 		, m_allocator(engine.getAllocator())
 		, m_script_manager(engine.getAllocator())
 	{
+		g_wasm_default_allocator = &engine.getAllocator();
 		OutputMemoryStream wasm_bin(engine.getAllocator());
 		(void)engine.getFileSystem().getContentSync(Path("test.wasm"), wasm_bin);
 
@@ -368,7 +2896,8 @@ struct VisualScriptPlugin : ISystem {
 	
 		LUMIX_MODULE(ScriptModuleImpl, "script")
 			.LUMIX_CMP(Script, "script", "Script")
-				.LUMIX_PROP(ScriptResource, "Script").resourceAttribute(ScriptResource::TYPE);
+				.LUMIX_PROP(ScriptResource, "Script").resourceAttribute(ScriptResource::TYPE)
+				.LUMIX_PROP(SerialUpdate, "Serial update");
 	}
 
 	const char* getName() const override { return "script"; }
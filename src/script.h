@@ -1,25 +1,133 @@
 #pragma once
 
+#include "core/array.h"
+#include "core/crt.h"
+#include "core/hash.h"
+#include "core/job_system.h"
+#include "core/math.h"
+#include "core/string.h"
 #include "engine/plugin.h"
 #include "../external/wasm3.h"
 
 namespace Lumix {
 
+namespace reflection { struct FunctionBase; }
+
 enum class ScriptValueType : u32 {
 	U32_DEPRECATED,
 	I32,
 	FLOAT,
-	ENTITY
+	ENTITY,
+	// f32 components
+	VEC3,
+	QUAT,
+	VEC4
+};
+
+// functions exported by scripts and called by the engine
+enum class ScriptCallback : u32 {
+	UPDATE,
+	START,
+	ON_KEY_EVENT,
+	ON_MOUSE_MOVE,
+	ON_MOUSE_BUTTON,
+	// replaces UPDATE in scripts compiled in batch update mode
+	UPDATE_BATCH,
+	// onTimer(timer id), called when a timer scheduled by the script expires
+	ON_TIMER,
+	// resume(time delta), called each frame while the script waits in a latent node, see Script::m_resumable
+	RESUME,
+
+	COUNT
+};
+
+// events dispatched to scripts, a script subscribes to an event by exporting its callback
+enum class ScriptEvent : u32 {
+	KEY,
+	MOUSE_MOVE,
+	MOUSE_BUTTON,
+
+	COUNT
+};
+
+// how often the engine calls an instance's update
+enum class ScriptUpdatePolicy : u32 {
+	// every n-th frame, time delta passed to update is accumulated over skipped frames
+	INTERVAL,
+	// the farther from ScriptModule's LOD origin, the less often, see ScriptModule::setLOD
+	DISTANCE,
+	// update is never called, the script runs only from events and timers
+	NONE
+};
+
+// host functions imported by scripts from "LumixAPI"
+enum class ScriptImport : u32 {
+	SET_YAW,
+	SET_PROPERTY_FLOAT,
+	GET_PROPERTY_FLOAT,
+	SET_PROPERTY_I32,
+	GET_PROPERTY_I32,
+	SET_PROPERTY_VEC3,
+	GET_PROPERTY_VEC3,
+	SET_PROPERTY_VEC4,
+	GET_PROPERTY_VEC4,
+	GET_POSITION,
+	SET_POSITION,
+	GET_ROTATION,
+	SET_ROTATION,
+	YAW_TO_DIR,
+	CALL_FUNCTION,
+	QUERY_RADIUS,
+	// fused read-modify-writes
+	ADD_PROPERTY_FLOAT,
+	ADD_POSITION,
+	SCHEDULE_TIMER,
+	SET_RESUMABLE,
+
+	COUNT
+};
+
+const char* getScriptImportName(ScriptImport import);
+
+// execution statistics of a resource, collected only while ScriptModule::isCollectingStats
+struct ScriptStats {
+	void add(const ScriptStats& rhs) {
+		for (u32 i = 0; i < (u32)ScriptImport::COUNT; ++i) import_calls[i] += rhs.import_calls[i];
+		calls += rhs.calls;
+		call_time += rhs.call_time;
+	}
+
+	// indexed by ScriptImport
+	u64 import_calls[(u32)ScriptImport::COUNT] = {};
+	// calls of exported functions by the engine, a batch update counts as one call
+	u64 calls = 0;
+	// seconds spent in those calls
+	double call_time = 0;
 };
 
 struct ScriptResource : Resource {
 	static ResourceType TYPE;
 
 	enum class Version : u32 {
+		PROPERTY_TABLE,
+		STACK_SIZE,
+		INSTANCE_SIZE,
+		VARIABLES,
+		FUNCTIONS,
+		RESERVED_MEMORY,
+		PROFILED_NODES,
+		TIMERS,
+		UPDATE_POLICY,
 
 		LAST
 	};
 
+	// scripts put arguments of host calls in this many bytes at the end of linear memory
+	static constexpr u32 SCRATCH_SIZE = 256;
+
+	// followed by u32 stack size, u32 instance size, u32 reserved memory, u32 variable count, variables, u32 property count,
+	// property hashes, u32 function count, function hashes, u32 profile offset, u32 profiled node count, node ids,
+	// u32 timer count, timers, u32 update policy, u32 update interval and WASM bytecode
 	struct Header {
 		static const u32 MAGIC = '_scr';
 
@@ -27,6 +135,21 @@ struct ScriptResource : Resource {
 		Version version = Version::LAST;
 	};
 
+	// variable stored in an instance record
+	struct Variable {
+		Variable(IAllocator& allocator) : name(allocator) {}
+		String name;
+		ScriptValueType type;
+		u32 offset;
+	};
+
+	// repeating timer started with each instance
+	struct Timer {
+		// passed to onTimer
+		u32 id;
+		float interval;
+	};
+
 	ScriptResource(const Path& path, ResourceManager& resource_manager, IAllocator& allocator);
 
 	ResourceType getType() const override { return TYPE; }
@@ -34,22 +157,244 @@ struct ScriptResource : Resource {
 	bool load(Span<const u8> mem) override;
 
 	IAllocator& m_allocator;
+	// background compile jobs of all script modules, they read the resource so unload waits for them
+	jobs::Counter m_compile_jobs;
+	// the only copy of the WASM, wasm3 parses it in place and modules of all lanes reference it
 	OutputMemoryStream m_bytecode;
+	// estimated by the compiler, 0 if unknown
+	u32 m_stack_size = 0;
+	// size of instance record kept in linear memory, 0 if instance state is in globals
+	// record starts with i32 self, followed by m_variables
+	u32 m_instance_size = 0;
+	// bytes at the end of linear memory used for host call buffers, instance records can not be there
+	u32 m_reserved_memory = SCRATCH_SIZE;
+	Array<Variable> m_variables;
+	// properties accessed by the script, bytecode refers to them by index
+	Array<StableHash> m_properties;
+	// reflected functions called by the script, see getScriptFunctionHash
+	Array<StableHash> m_functions;
+	// graph nodes counting their executions, the script keeps u32 counters at m_profile_offset in linear memory
+	Array<u32> m_profiled_nodes;
+	u32 m_profile_offset = 0;
+	Array<Timer> m_timers;
+	// default of the resource's instances, batched instances are all updated with the resource's interval
+	ScriptUpdatePolicy m_update_policy = ScriptUpdatePolicy::INTERVAL;
+	u32 m_update_interval = 1;
+	// incremented on each load, so users can tell the resource was reloaded
+	u32 m_generation = 0;
 };
 
+// entry written by query imports, e.g. queryRadius
+struct ScriptQueryRecord {
+	i32 entity;
+	float pos[3];
+	// raw 4 bytes of the queried scalar property, zero if the query has no property
+	u32 value;
+};
+
+// reflected function as seen by scripts
+// arguments are passed in scratch memory, 4 bytes per component, except leading entity which is the entity passed to callFunction
+struct ScriptFunctionSignature {
+	static constexpr u32 MAX_ARGS = 8;
+
+	bool takes_entity = false;
+	u32 num_args = 0;
+	ScriptValueType args[MAX_ARGS];
+	u32 args_size = 0;
+};
+
+// false if scripts can not call the function, e.g. it has an argument of unsupported type
+bool getScriptFunctionSignature(const reflection::FunctionBase& function, ScriptFunctionSignature& signature);
+StableHash getScriptFunctionHash(const char* component_name, const char* function_name);
+
+// executes scripts' wasm, each lane of each resource gets its own runtime with the resource's module loaded in it
+// the interface uses wasm3's ABI and any backend must follow it, even if it does not use wasm3:
+// * host functions are M3RawCall, wasm3's raw calling convention: backend passes its Runtime as `runtime`,
+//   M3ImportContext with userdata given to linkFunction, results followed by arguments in `_sp` and linear memory in `_mem`
+// * functions returning M3Result return null on success, otherwise one of wasm3's m3Err_* or a static string
+struct ScriptBackend {
+	// owned by the backend
+	struct Runtime;
+	struct Module;
+	struct Function;
+
+	enum class ValueType : u32 {
+		NONE,
+		I32,
+		I64,
+		F32,
+		F64
+	};
+
+	virtual ~ScriptBackend() {}
+	// e.g. to tell benchmark results apart
+	virtual const char* getName() const = 0;
+	// `stack` of `stack_size` bytes is owned by the caller, `userdata` is returned by getUserData
+	virtual Runtime* createRuntime(void* stack, u32 stack_size, void* userdata) = 0;
+	// frees the runtime's module too
+	virtual void destroyRuntime(Runtime* runtime) = 0;
+	// runtime must not be executing
+	virtual void setStack(Runtime* runtime, void* stack, u32 stack_size) = 0;
+	virtual void* getUserData(Runtime* runtime) = 0;
+	// parses `bytecode` and loads it in `runtime`, `bytecode` must outlive the runtime
+	virtual M3Result loadModule(Runtime* runtime, Span<const u8> bytecode, Module*& module) = 0;
+	// m3Err_functionLookupFailed if the module does not import the function
+	virtual M3Result linkFunction(Module* module, const char* module_name, const char* name, M3RawCall function, void* userdata) = 0;
+	// compiles all functions, so nothing is compiled lazily during calls
+	virtual M3Result compile(Module* module) = 0;
+	// stack size in bytes which is enough to call any function in compiled module, including nested calls
+	virtual u32 getRequiredStackSize(Module* module) = 0;
+	// m3Err_functionLookupFailed if the module does not export the function
+	virtual M3Result findFunction(Runtime* runtime, const char* name, Function*& function) = 0;
+	virtual const char* getFunctionName(Function* function) = 0;
+	virtual u32 getArgCount(Function* function) = 0;
+	virtual ValueType getArgType(Function* function, u32 idx) = 0;
+	// arguments as passed to variadic functions, f32 promoted to double
+	virtual M3Result callVL(Function* function, va_list args) = 0;
+	virtual u8* getMemory(Runtime* runtime, u32& size) = 0;
+	virtual u32 getGlobalCount(Module* module) = 0;
+	// null if the global is not exported
+	virtual const char* getGlobalName(Module* module, u32 idx) = 0;
+	virtual ValueType getGlobalType(Module* module, u32 idx) = 0;
+	// raw values of all module's globals, `values` must have getGlobalCount elements
+	virtual void getGlobals(Module* module, u64* values) = 0;
+	virtual void setGlobals(Module* module, const u64* values) = 0;
+};
+
+// what native code generated from a script needs to call host functions, see ScriptNative
+struct ScriptNativeContext {
+	// `sp` holds results followed by arguments, one u64 slot each, the layout wasm3 passes to raw functions
+	M3Result call(ScriptImport import, u64* sp) const {
+		return (M3Result)imports[(u32)import]((IM3Runtime)runtime, import_context, (uint64_t*)sp, memory);
+	}
+
+	u32 load(u32 address) const {
+		u32 value;
+		memcpy(&value, memory + address, sizeof(value));
+		return value;
+	}
+
+	void store(u32 address, u32 value) const { memcpy(memory + address, &value, sizeof(value)); }
+
+	static float toF32(u64 value) {
+		const u32 bits = (u32)value;
+		float res;
+		memcpy(&res, &bits, sizeof(res));
+		return res;
+	}
+
+	static u64 fromF32(float value) {
+		u32 bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	ScriptBackend::Runtime* runtime;
+	IM3ImportContext import_context;
+	// linear memory of the script's module, with the instance's record already swapped in
+	u8* memory;
+	// indexed by ScriptImport
+	const M3RawCall* imports;
+};
+
+// `args` are raw values of the callback's arguments, f32 as bits in the low half
+using ScriptNativeFunction = M3Result (*)(const ScriptNativeContext& ctx, const u64* args);
+
+// C++ translated from a script's wasm by the editor and built into the game,
+// its callbacks run instead of the interpreted ones in any resource with the same bytecode
+struct ScriptNative {
+	// StableHash of ScriptResource::m_bytecode
+	StableHash bytecode_hash;
+	// indexed by ScriptCallback, null callbacks are interpreted
+	ScriptNativeFunction callbacks[(u32)ScriptCallback::COUNT];
+	ScriptNative* next = nullptr;
+};
+
+// called by static initializers of the generated code, `native` must outlive all script modules
+void registerScriptNative(ScriptNative& native);
+const ScriptNative* findScriptNative(StableHash bytecode_hash);
+const char* getScriptCallbackName(ScriptCallback callback);
+
 struct Script {
-	Script() {}
+	Script(EntityRef entity, IAllocator& allocator);
 	Script(Script&& script);
+	Script& operator=(Script&& script);
 	~Script();
 
+	EntityRef m_entity;
 	bool m_init_failed = false;
-	IM3Runtime m_runtime = nullptr;
-	IM3Module m_module = nullptr;
+	// keep on the main thread even when ScriptModule updates in parallel, world writes are applied immediately
+	bool m_serial_update = false;
+	// unique in the module for each instantiation, timers scheduled by previous instances are ignored
+	// even if the component was destroyed and created again
+	u32 m_generation = 0;
+	ScriptUpdatePolicy m_update_policy = ScriptUpdatePolicy::INTERVAL;
+	// frames between updates with ScriptUpdatePolicy::INTERVAL
+	u32 m_update_interval = 1;
+	// set by ScriptModule::setUpdatePolicy, resource's default is not applied on instantiation then
+	bool m_update_policy_override = false;
+	// game time of the last update, the time since then is passed to update once the script is due
+	double m_last_update_time = 0;
+	// interval of the update bucket the script is in, 0 if update is not called for this instance
+	u32 m_bucket_interval = 0;
+	// index in the bucket's phase array, valid only if m_bucket_interval is not 0
+	u32 m_bucket_slot = 0;
+	// set by the script while any of its latent nodes waits, resume is called only then
+	bool m_resumable = false;
+	// m_globals and m_instance hold deserialized state, the instance continues with it instead of being started
+	bool m_restore = false;
+	// runtime and module are shared by all instances of m_resource, owned by ScriptModule
+	struct ResourceRuntime* m_resource_runtime = nullptr;
+	// runtime of the resource's previous version while the script waits to be instantiated after hot reload,
+	// m_instance then holds the record of the previous version
+	struct ResourceRuntime* m_reload_from = nullptr;
+	ScriptBackend::Runtime* m_runtime = nullptr;
+	ScriptBackend::Module* m_module = nullptr;
 	ScriptResource* m_resource = nullptr;
+	// this instance's values of m_module's globals, swapped into the module around each call
+	Array<u64> m_globals;
+	// this instance's record, copied to module's linear memory around each call, see ScriptResource::m_instance_size
+	Array<u8> m_instance;
+	// resolved at instantiation, null if the script does not export the function
+	ScriptBackend::Function* m_callbacks[(u32)ScriptCallback::COUNT] = {};
+	// index in ScriptModule's subscriber list of each event, U32_MAX if not subscribed
+	u32 m_subscriptions[(u32)ScriptEvent::COUNT];
 };
 
 struct ScriptModule : IModule {
 	virtual Script& getScript(EntityRef entity) = 0;
+	// the script is reinstantiated once the resource is loaded, empty path removes the resource
+	virtual void setScriptResource(EntityRef entity, const Path& path) = 0;
+	// run update of scripts on worker threads, world writes are deferred until all batches finish
+	virtual void setParallelUpdate(bool enable) = 0;
+	virtual bool isParallelUpdate() const = 0;
+	// max time in seconds spent instantiating scripts per frame, the rest waits for next frames, 0 = unlimited
+	virtual void setInstantiationBudget(float seconds) = 0;
+	virtual float getInstantiationBudget() const = 0;
+	// compile resources on worker threads, scripts wait in pending state until their resource is compiled
+	virtual void setBackgroundCompile(bool enable) = 0;
+	virtual bool isBackgroundCompile() const = 0;
+	// execution counts of resource's profiled nodes summed over all lanes, indexed as ScriptResource::m_profiled_nodes
+	// returns false if the resource is not compiled in this module
+	virtual bool getNodeCounters(ScriptResource& resource, Span<u32> counters) = 0;
+	// count host calls and time script calls, has a small cost on each import call even when disabled
+	virtual void setCollectStats(bool enable) = 0;
+	virtual bool isCollectingStats() const = 0;
+	// stats of the resource summed over all lanes, returns false if the resource is not compiled in this module
+	virtual bool getStats(ScriptResource& resource, ScriptStats& stats) = 0;
+	virtual void resetStats() = 0;
+	// overrides the resource's policy for the instance, `interval` is in frames and used only by ScriptUpdatePolicy::INTERVAL
+	// `interval` is clamped to MAX_UPDATE_INTERVAL
+	static constexpr u32 MAX_UPDATE_INTERVAL = 1024;
+	virtual void setUpdatePolicy(EntityRef entity, ScriptUpdatePolicy policy, u32 interval) = 0;
+	// scripts with ScriptUpdatePolicy::DISTANCE are updated every 2^n-th frame, n = distance from `origin` / `tier_distance`
+	// clamped to MAX_LOD_TIER, `tier_distance` <= 0 updates them every frame
+	static constexpr u32 MAX_LOD_TIER = 4;
+	virtual void setLOD(const DVec3& origin, float tier_distance) = 0;
+	// load and compile the script ahead of time, so instantiating it later is cheap
+	virtual void prewarm(const Path& path) = 0;
+	// runs scripts of this module
+	virtual ScriptBackend& getBackend() = 0;
 };
 
 